@@ -9,11 +9,54 @@
 #include "defs.h"
 
 #include <regex.h>
+#include <stdarg.h>
 
 #include "filter.h"
 #include "number_set.h"
 #include "xstring.h"
 
+/*
+ * The first error encountered while parsing a specification,
+ * and whether it has to be reported with a hint on usage.
+ */
+static char *parse_error;
+static bool parse_error_help;
+
+static void ATTRIBUTE_FORMAT((printf, 2, 3))
+set_parse_error(const bool help, const char *fmt, ...)
+{
+	if (parse_error)
+		return;
+
+	va_list p;
+
+	va_start(p, fmt);
+	parse_error = xvasprintf(fmt, p);
+	va_end(p);
+
+	parse_error_help = help;
+}
+
+static char *
+take_parse_error(void)
+{
+	char *const err = parse_error;
+
+	parse_error = NULL;
+	return err;
+}
+
+static void
+die_on_parse_error(char *const err)
+{
+	if (!err)
+		return;
+
+	if (parse_error_help)
+		error_msg_and_help("%s", err);
+	else
+		error_msg_and_die("%s", err);
+}
 
 /**
  * Checks whether a @-separated personality specification suffix is present.
@@ -42,8 +85,9 @@ qualify_syscall_separate_personality(const char *s, unsigned int *p)
 		}
 	}
 
-	error_msg_and_help("incorrect personality designator '%s'"
-			   " in qualification '%s'", pos + 1, s);
+	set_parse_error(true, "incorrect personality designator '%s'"
+			" in qualification '%s'", pos + 1, s);
+	return NULL;
 }
 
 static bool
@@ -88,13 +132,13 @@ qualify_syscall_number(const char *s, struct number_set *set)
 }
 
 static void
-regerror_msg_and_die(int errcode, const regex_t *preg,
-		     const char *str, const char *pattern)
+set_regerror(int errcode, const regex_t *preg,
+	     const char *str, const char *pattern)
 {
 	char buf[512];
 
 	regerror(errcode, preg, buf, sizeof(buf));
-	error_msg_and_die("%s: %s: %s", str, pattern, buf);
+	set_parse_error(false, "%s: %s: %s", str, pattern, buf);
 }
 
 static bool
@@ -103,8 +147,10 @@ qualify_syscall_regex(const char *s, struct number_set *set)
 	regex_t preg;
 	int rc;
 
-	if ((rc = regcomp(&preg, s, REG_EXTENDED | REG_NOSUB)) != 0)
-		regerror_msg_and_die(rc, &preg, "regcomp", s);
+	if ((rc = regcomp(&preg, s, REG_EXTENDED | REG_NOSUB)) != 0) {
+		set_regerror(rc, &preg, "regcomp", s);
+		return false;
+	}
 
 	bool found = false;
 
@@ -129,8 +175,11 @@ qualify_syscall_regex(const char *s, struct number_set *set)
 
 			if (rc == REG_NOMATCH)
 				continue;
-			else if (rc)
-				regerror_msg_and_die(rc, &preg, "regexec", s);
+			else if (rc) {
+				set_regerror(rc, &preg, "regexec", s);
+				regfree(&preg);
+				return false;
+			}
 
 			add_number_to_set_array(i, set, p);
 			found = true;
@@ -272,9 +321,11 @@ qualify_syscall(const char *token, struct number_set *set)
 /*
  * Add syscall numbers to SETs for each supported personality
  * according to STR specification.
+ * Return NULL on success, otherwise a message describing the error
+ * that has to be freed by the caller.
  */
-void
-qualify_syscall_tokens(const char *const str, struct number_set *const set)
+char *
+parse_syscall_tokens(const char *const str, struct number_set *const set)
 {
 	/* Clear all sets. */
 	clear_number_set_array(set, SUPPORTED_PERSONALITIES);
@@ -295,11 +346,11 @@ qualify_syscall_tokens(const char *const str, struct number_set *const set)
 		 * Subsequent is_number_in_set* invocations
 		 * will return set[p]->not.
 		 */
-		return;
+		return NULL;
 	} else if (strcmp(s, "all") == 0) {
 		/* "all" == "!none" */
 		invert_number_set_array(set, SUPPORTED_PERSONALITIES);
-		return;
+		return NULL;
 	}
 
 	/*
@@ -307,7 +358,7 @@ qualify_syscall_tokens(const char *const str, struct number_set *const set)
 	 * For each token, call qualify_syscall that will take care
 	 * if adding appropriate syscall numbers to sets.
 	 * The absence of tokens or a negative return code
-	 * from qualify_syscall is a fatal error.
+	 * from qualify_syscall is an error.
 	 */
 	char *copy = xstrdup(s);
 	char *saveptr = NULL;
@@ -317,21 +368,34 @@ qualify_syscall_tokens(const char *const str, struct number_set *const set)
 	     token; token = strtok_r(NULL, ",", &saveptr)) {
 		done = qualify_syscall(token, set);
 		if (!done)
-			error_msg_and_die("invalid system call '%s'", token);
+			set_parse_error(false, "invalid system call '%s'",
+					token);
+		if (parse_error)
+			break;
 	}
 
 	free(copy);
 
 	if (!done)
-		error_msg_and_die("invalid system call '%s'", str);
+		set_parse_error(false, "invalid system call '%s'", str);
+
+	return take_parse_error();
+}
+
+void
+qualify_syscall_tokens(const char *const str, struct number_set *const set)
+{
+	die_on_parse_error(parse_syscall_tokens(str, set));
 }
 
 /*
  * Add numbers to SET according to STR specification.
+ * Return NULL on success, otherwise a message describing the error
+ * that has to be freed by the caller.
  */
-void
-qualify_tokens(const char *const str, struct number_set *const set,
-	       string_to_uint_func func, const char *const name)
+char *
+parse_tokens(const char *const str, struct number_set *const set,
+	     string_to_uint_func func, const char *const name)
 {
 	/* Clear the set. */
 	clear_number_set_array(set, 1);
@@ -352,11 +416,11 @@ qualify_tokens(const char *const str, struct number_set *const set,
 		 * Subsequent is_number_in_set* invocations
 		 * will return set->not.
 		 */
-		return;
+		return NULL;
 	} else if (strcmp(s, "all") == 0) {
 		/* "all" == "!none" */
 		invert_number_set_array(set, 1);
-		return;
+		return NULL;
 	}
 
 	/*
@@ -364,7 +428,7 @@ qualify_tokens(const char *const str, struct number_set *const set,
 	 * For each token, find out the corresponding number
 	 * by calling FUNC, and add that number to the set.
 	 * The absence of tokens or a negative answer
-	 * from FUNC is a fatal error.
+	 * from FUNC is an error.
 	 */
 	char *copy = xstrdup(s);
 	char *saveptr = NULL;
@@ -373,8 +437,10 @@ qualify_tokens(const char *const str, struct number_set *const set,
 	for (const char *token = strtok_r(copy, ",", &saveptr);
 	     token; token = strtok_r(NULL, ",", &saveptr)) {
 		number = func(token);
-		if (number < 0)
-			error_msg_and_die("invalid %s '%s'", name, token);
+		if (number < 0) {
+			set_parse_error(false, "invalid %s '%s'", name, token);
+			break;
+		}
 
 		add_number_to_set(number, set);
 	}
@@ -382,5 +448,14 @@ qualify_tokens(const char *const str, struct number_set *const set,
 	free(copy);
 
 	if (number < 0)
-		error_msg_and_die("invalid %s '%s'", name, str);
+		set_parse_error(false, "invalid %s '%s'", name, str);
+
+	return take_parse_error();
+}
+
+void
+qualify_tokens(const char *const str, struct number_set *const set,
+	       string_to_uint_func func, const char *const name)
+{
+	die_on_parse_error(parse_tokens(str, set, func, name));
 }
@@ -0,0 +1,261 @@
+/*
+ * Cgroup membership (--cgroup option): strace attaches to the processes
+ * of the cgroup at startup, and reads its cgroup.procs again periodically
+ * to attach to the processes that have migrated into the cgroup since then.
+ *
+ * The kernel does not notify about migrations, it only notifies about
+ * the changes of the "populated" state in cgroup.events, so the latter
+ * is watched with inotify to learn without delay that an empty cgroup
+ * has got its first process, and an empty cgroup is not scanned until then.
+ * The parent directory is watched for the removal of the cgroup.
+ * There is no cgroup.events in cgroup v1, such cgroups are always
+ * scanned periodically.  The scans of a cgroup that has no new members
+ * get less frequent, down to max_scan_interval.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include "xstring.h"
+
+static const struct timespec min_scan_interval = { .tv_nsec = 100000000 };
+static const struct timespec max_scan_interval = { .tv_sec = 2 };
+static struct timespec scan_interval;
+
+static int dir_fd = -1;
+static int inotify_fd = -1;
+/* SIGCHLD, blocked by the caller of cgroup_open.  */
+static int sigchld_fd = -1;
+/* Whether cgroup.events is watched.  */
+static bool events_watched;
+/* Whether cgroup.procs was not empty in the last scan.  */
+static bool populated;
+/* cgroup.procs cannot be read in threaded cgroups.  */
+static const char *procs_name = "cgroup.procs";
+static struct timespec next_scan_ts;
+static bool scan_requested;
+
+static char *procs_buf;
+static size_t procs_buf_size;
+
+void
+cgroup_open(const char *path)
+{
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0)
+		perror_msg_and_die("%s", path);
+	if (faccessat(dir_fd, procs_name, R_OK, 0))
+		perror_msg_and_die("%s/%s", path, procs_name);
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		perror_msg_and_die("inotify_init1");
+
+	static const char events_path[] = "/proc/self/fd/%d/cgroup.events";
+	char name[sizeof(events_path) + sizeof(int) * 3];
+
+	xsprintf(name, events_path, dir_fd);
+	if (inotify_add_watch(inotify_fd, name, IN_MODIFY) >= 0)
+		events_watched = true;
+	else if (errno != ENOENT)
+		perror_msg_and_die("inotify_add_watch: %s/cgroup.events", path);
+
+	xsprintf(name, "/proc/self/fd/%d/..", dir_fd);
+	if (inotify_add_watch(inotify_fd, name, IN_DELETE | IN_ONLYDIR) < 0)
+		perror_msg_and_die("inotify_add_watch: %s/..", path);
+
+	sigset_t sigchld_set;
+
+	sigemptyset(&sigchld_set);
+	sigaddset(&sigchld_set, SIGCHLD);
+	sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sigchld_fd < 0)
+		perror_msg_and_die("signalfd");
+
+	scan_interval = min_scan_interval;
+}
+
+void
+cgroup_close(void)
+{
+	if (sigchld_fd >= 0) {
+		close(sigchld_fd);
+		sigchld_fd = -1;
+	}
+
+	if (inotify_fd >= 0) {
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+
+	if (dir_fd >= 0) {
+		close(dir_fd);
+		dir_fd = -1;
+	}
+}
+
+/*
+ * Read the whole file, it is regenerated by the kernel on every read,
+ * so its size is not known in advance.
+ */
+static ssize_t
+read_procs(void)
+{
+	const int fd = openat(dir_fd, procs_name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	size_t len = 0;
+
+	for (;;) {
+		if (procs_buf_size - len < 2)
+			procs_buf = xgrowarray(procs_buf, &procs_buf_size, 1);
+
+		const ssize_t rc = read(fd, procs_buf + len,
+					procs_buf_size - len - 1);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			const int saved_errno = errno;
+			close(fd);
+			errno = saved_errno;
+			return -1;
+		}
+		if (!rc)
+			break;
+		len += rc;
+	}
+
+	close(fd);
+	procs_buf[len] = '\0';
+
+	return len;
+}
+
+/*
+ * Pass every process of the cgroup to attach, which returns true
+ * if it has attached to the process.
+ * Return false if the cgroup has been removed.
+ */
+bool
+cgroup_scan(bool (*attach)(int pid))
+{
+	scan_requested = false;
+
+	ssize_t len = read_procs();
+
+	if (len < 0 && errno == EOPNOTSUPP &&
+	    !strcmp(procs_name, "cgroup.procs")) {
+		procs_name = "cgroup.threads";
+		len = read_procs();
+	}
+
+	if (len < 0) {
+		if (errno == ENOENT || errno == ENODEV)
+			return false;
+		perror_msg_and_die("read: %s", procs_name);
+	}
+
+	bool attached = false;
+
+	populated = false;
+	for (char *p = procs_buf; *p; ) {
+		char *const end = p + strcspn(p, "\n");
+		const char c = *end;
+
+		*end = '\0';
+		const int pid = string_to_uint(p);
+		if (pid > 0) {
+			populated = true;
+			attached |= attach(pid);
+		}
+		if (!c)
+			break;
+		p = end + 1;
+	}
+
+	if (attached) {
+		scan_interval = min_scan_interval;
+	} else {
+		ts_add(&scan_interval, &scan_interval, &scan_interval);
+		if (ts_cmp(&scan_interval, &max_scan_interval) > 0)
+			scan_interval = max_scan_interval;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &next_scan_ts);
+	ts_add(&next_scan_ts, &next_scan_ts, &scan_interval);
+
+	return true;
+}
+
+/* Whether the cgroup is only to be scanned on inotify events.  */
+static bool
+scan_on_events_only(void)
+{
+	return events_watched && !populated;
+}
+
+/* Return true if the cgroup is to be scanned now.  */
+bool
+cgroup_scan_due(void)
+{
+	char buf[sizeof(struct inotify_event) + NAME_MAX + 1]
+		ATTRIBUTE_ALIGNED(sizeof(struct inotify_event));
+
+	while (read(inotify_fd, buf, sizeof(buf)) > 0)
+		scan_requested = true;
+
+	if (scan_requested)
+		return true;
+	if (scan_on_events_only())
+		return false;
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ts_cmp(&now, &next_scan_ts) >= 0;
+}
+
+/*
+ * Wait until the next scan of the cgroup is due or, if there are tracees,
+ * SIGCHLD arrives.  Return -1 if the wait has been interrupted by a signal.
+ */
+int
+cgroup_wait(const bool tracees)
+{
+	struct pollfd pfds[] = {
+		{ .fd = inotify_fd, .events = POLLIN },
+		{ .fd = sigchld_fd, .events = POLLIN },
+	};
+	struct timespec timeout;
+
+	if (!scan_on_events_only()) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (ts_cmp(&now, &next_scan_ts) >= 0)
+			return 0;
+		ts_sub(&timeout, &next_scan_ts, &now);
+	}
+
+	const int rc = ppoll(pfds, tracees ? 2 : 1,
+			     scan_on_events_only() ? NULL : &timeout, NULL);
+
+	if (rc > 0 && (pfds[1].revents & POLLIN)) {
+		struct signalfd_siginfo si;
+
+		while (read(sigchld_fd, &si, sizeof(si)) > 0)
+			;
+	}
+
+	return rc;
+}
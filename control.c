@@ -0,0 +1,239 @@
+/*
+ * Control socket (--control option): a UNIX stream socket that accepts
+ * line-based requests from local clients while tracing is in progress.
+ *
+ * The listening socket and the client sockets are in O_ASYNC mode,
+ * the SIGIO handler only sets a flag, and the requests are served
+ * by control_process() from the main loop, so tracing never waits
+ * for a client.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CONTROL_LINE_MAX 4096
+
+struct control_client {
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE_MAX];
+};
+
+static const char *control_path;
+static int control_fd = -1;
+static struct control_client **clients;
+static size_t nclients;
+static size_t clients_size;
+
+static void
+set_async(const int fd)
+{
+	if (fcntl(fd, F_SETOWN, getpid()) < 0 ||
+	    fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK | O_ASYNC) < 0)
+		perror_msg_and_die("fcntl");
+}
+
+void
+control_open(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		error_msg_and_die("control socket path is too long: %s", path);
+	strcpy(addr.sun_path, path);
+
+	control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (control_fd < 0)
+		perror_msg_and_die("socket");
+
+	if (bind(control_fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_die("bind: %s", path);
+	control_path = path;
+
+	if (listen(control_fd, 8))
+		perror_msg_and_die("listen: %s", path);
+
+	set_async(control_fd);
+}
+
+void
+control_close(void)
+{
+	for (size_t i = 0; i < nclients; ++i) {
+		close(clients[i]->fd);
+		free(clients[i]);
+	}
+	nclients = 0;
+
+	if (control_fd >= 0) {
+		close(control_fd);
+		control_fd = -1;
+	}
+
+	if (control_path) {
+		unlink(control_path);
+		control_path = NULL;
+	}
+}
+
+static void
+control_reply(const int fd, const char *buf, size_t len)
+{
+	/*
+	 * The socket is non-blocking, a client that does not read
+	 * its replies loses them instead of stalling the tracer.
+	 */
+	while (len) {
+		const ssize_t rc = send(fd, buf, len, MSG_NOSIGNAL);
+
+		if (rc <= 0) {
+			if (rc < 0 && errno == EINTR)
+				continue;
+			debug_msg("control client %d: reply truncated", fd);
+			return;
+		}
+		buf += rc;
+		len -= rc;
+	}
+}
+
+/*
+ * "set path=PATH" makes PATH the only path traced (-P option),
+ * "set path=" stops path tracing, "add path=PATH" adds PATH to the traced
+ * paths, "set QUALIFIER=VALUE" changes a qualifier as -e does.
+ */
+static void
+control_set(FILE *fp, const char *arg, const bool add)
+{
+	const char *path = STR_STRIP_PREFIX(arg, "path=");
+
+	if (path != arg) {
+		if (!add)
+			pathtrace_clear_set(&global_path_set);
+		if (*path)
+			pathtrace_select(path);
+	} else if (add) {
+		fprintf(fp, "error: cannot add '%s'\n", arg);
+		return;
+	} else {
+		char *err = requalify(arg);
+
+		if (err) {
+			fprintf(fp, "error: %s\n", err);
+			free(err);
+			return;
+		}
+	}
+
+	debug_msg("control: %s %s", add ? "add" : "set", arg);
+	fputs("ok\n", fp);
+}
+
+static void
+control_execute(const int fd, const char *cmd)
+{
+#if HAVE_OPEN_MEMSTREAM
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp = open_memstream(&buf, &len);
+
+	if (!fp)
+		perror_msg_and_die("open_memstream");
+
+	const char *arg;
+
+	if (!strcmp(cmd, "summary") || !strcmp(cmd, "snapshot")) {
+		print_snapshot(fp);
+	} else if ((arg = STR_STRIP_PREFIX(cmd, "set ")) != cmd) {
+		control_set(fp, arg, false);
+	} else if ((arg = STR_STRIP_PREFIX(cmd, "add ")) != cmd) {
+		control_set(fp, arg, true);
+	} else {
+		fprintf(fp, "error: unknown command: %s\n", cmd);
+	}
+
+	fclose(fp);
+	control_reply(fd, buf, len);
+	free(buf);
+#endif
+}
+
+/* Returns false if the client is to be disconnected. */
+static bool
+control_read(struct control_client *c)
+{
+	for (;;) {
+		const ssize_t rc = read(c->fd, c->buf + c->len,
+					sizeof(c->buf) - c->len);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN;
+		}
+		if (rc == 0)
+			return false;
+
+		c->len += rc;
+
+		char *line = c->buf;
+		char *nl;
+
+		while ((nl = memchr(line, '\n', c->len - (line - c->buf)))) {
+			*nl = '\0';
+			if (nl > line && nl[-1] == '\r')
+				nl[-1] = '\0';
+			if (*line)
+				control_execute(c->fd, line);
+			line = nl + 1;
+		}
+
+		c->len -= line - c->buf;
+		memmove(c->buf, line, c->len);
+
+		if (c->len == sizeof(c->buf)) {
+			static const char msg[] = "error: line is too long\n";
+
+			control_reply(c->fd, msg, sizeof(msg) - 1);
+			return false;
+		}
+	}
+}
+
+void
+control_process(void)
+{
+	if (control_fd < 0)
+		return;
+
+	int fd;
+
+	while ((fd = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		set_async(fd);
+
+		if (nclients >= clients_size)
+			clients = xgrowarray(clients, &clients_size,
+					     sizeof(*clients));
+		clients[nclients] = xzalloc(sizeof(*clients[nclients]));
+		clients[nclients]->fd = fd;
+		++nclients;
+	}
+
+	for (size_t i = 0; i < nclients;) {
+		if (control_read(clients[i])) {
+			++i;
+			continue;
+		}
+
+		close(clients[i]->fd);
+		free(clients[i]);
+		clients[i] = clients[--nclients];
+	}
+}
@@ -18,6 +18,12 @@
 
 #include <stdarg.h>
 
+/* Per-errno counter, an element of a sparse errno histogram */
+struct errno_count {
+	unsigned int error;
+	uint64_t count;
+};
+
 /* Per-syscall stats structure */
 struct call_counts {
 	/* time may be total latency or system time */
@@ -26,6 +32,10 @@ struct call_counts {
 	struct timespec time_max;
 	struct timespec time_avg;
 	uint64_t calls, errors;
+	/* errno histogram, sorted by count in descending order */
+	struct errno_count *errnos;
+	size_t errnos_used;
+	size_t errnos_size;
 };
 
 static struct call_counts *countv[SUPPORTED_PERSONALITIES];
@@ -49,6 +59,7 @@ enum count_summary_columns {
 	CSC_CALLS,
 	CSC_ERRORS,
 	CSC_SC_NAME,
+	CSC_ERRNOS,
 
 	CSC_MAX,
 };
@@ -95,14 +106,57 @@ static const struct {
 	{ "syscall",      CSC_SC_NAME    },
 	{ "syscall_name", CSC_SC_NAME    },
 	{ "syscall-name", CSC_SC_NAME    },
+	{ "errnos",       CSC_ERRNOS     },
+	{ "errno",        CSC_ERRNOS     },
+	{ "error_names",  CSC_ERRNOS     },
+	{ "error-names",  CSC_ERRNOS     },
 	{ "none",         CSC_NONE       },
 	{ "nothing",      CSC_NONE       },
 };
 
+/*
+ * Add n occurrences of error to the histogram of cc, keeping the histogram
+ * sorted by count.  Syscalls usually fail with a handful of distinct errors,
+ * so a linear search is sufficient.
+ */
+static void
+count_errno(struct call_counts *cc, const unsigned int error,
+	    const uint64_t n)
+{
+	size_t i;
+
+	for (i = 0; i < cc->errnos_used; ++i) {
+		if (cc->errnos[i].error == error)
+			break;
+	}
+
+	if (i == cc->errnos_used) {
+		if (cc->errnos_used >= cc->errnos_size)
+			cc->errnos = xgrowarray(cc->errnos, &cc->errnos_size,
+						sizeof(*cc->errnos));
+		cc->errnos[cc->errnos_used++] =
+			(struct errno_count) { .error = error };
+	}
+
+	cc->errnos[i].count += n;
+
+	for (; i > 0 && cc->errnos[i - 1].count < cc->errnos[i].count; --i) {
+		const struct errno_count tmp = cc->errnos[i - 1];
+
+		cc->errnos[i - 1] = cc->errnos[i];
+		cc->errnos[i] = tmp;
+	}
+}
+
+/*
+ * Count a syscall of the current personality that took wts
+ * and failed with error unless it is 0.
+ */
 void
-count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
+count_syscall_time(const kernel_ulong_t scno, const int error,
+		   const struct timespec *wts)
 {
-	if (!scno_in_range(tcp->scno))
+	if (!scno_in_range(scno))
 		return;
 
 	if (!counts) {
@@ -111,12 +165,28 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 		for (size_t i = 0; i < nsyscalls; i++)
 			counts[i].time_min = max_ts;
 	}
-	struct call_counts *cc = &counts[tcp->scno];
+	struct call_counts *cc = &counts[scno];
 
 	cc->calls++;
-	if (syserror(tcp))
+	if (error) {
 		cc->errors++;
+		count_errno(cc, error, 1);
+	}
+
+	struct timespec ts;
+
+	ts_sub(&ts, wts, &overhead);
+
+	const struct timespec *ts_nonneg = ts_max(&ts, &zero_ts);
+
+	ts_add(&cc->time, &cc->time, ts_nonneg);
+	cc->time_min = *ts_min(&cc->time_min, ts_nonneg);
+	cc->time_max = *ts_max(&cc->time_max, ts_nonneg);
+}
 
+void
+count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
+{
 	struct timespec wts;
 	if (count_wallclock) {
 		/* wall clock time spent while in syscall */
@@ -126,13 +196,7 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 		ts_sub(&wts, &tcp->stime, &tcp->ltime);
 	}
 
-	ts_sub(&wts, &wts, &overhead);
-
-	const struct timespec *wts_nonneg = ts_max(&wts, &zero_ts);
-
-	ts_add(&cc->time, &cc->time, wts_nonneg);
-	cc->time_min = *ts_min(&cc->time_min, wts_nonneg);
-	cc->time_max = *ts_max(&cc->time_max, wts_nonneg);
+	count_syscall_time(tcp->scno, syserror(tcp) ? tcp->u_error : 0, &wts);
 }
 
 static int
@@ -211,6 +275,7 @@ set_sortby(const char *sortby)
 		[CSC_CALLS]      = count_cmp,
 		[CSC_ERRORS]     = error_cmp,
 		[CSC_SC_NAME]    = syscall_cmp,
+		[CSC_ERRNOS]     = error_cmp,
 	};
 
 	for (size_t i = 0; i < ARRAY_SIZE(column_aliases); ++i) {
@@ -295,6 +360,47 @@ num_chars(const char *fmt, ...)
 	return (unsigned int) MAX(ret, 0);
 }
 
+/*
+ * Print the errno histogram of cc as "ENOENT 119000, EACCES 900"
+ * to buf of the given size, return the length of the whole string.
+ * A NULL buf can be used to calculate the length.
+ */
+static size_t
+sprint_errnos(char *buf, const size_t size, const struct call_counts *cc)
+{
+	size_t len = 0;
+
+	for (size_t i = 0; i < cc->errnos_used; ++i) {
+		const struct errno_count *const ec = &cc->errnos[i];
+		const char *const name =
+			ec->error < nerrnos ? errnoent[ec->error] : NULL;
+		const char *const sep = i ? ", " : "";
+		char *const pos = buf ? buf + len : NULL;
+		const size_t left = buf ? size - len : 0;
+		const int rc = name
+			? snprintf(pos, left, "%s%s %" PRIu64,
+				   sep, name, ec->count)
+			: snprintf(pos, left, "%s%u %" PRIu64,
+				   sep, ec->error, ec->count);
+
+		len += MAX(rc, 0);
+	}
+
+	return len;
+}
+
+static char *
+format_errnos(const struct call_counts *cc)
+{
+	const size_t len = sprint_errnos(NULL, 0, cc);
+	char *const str = xmalloc(len + 1);
+
+	str[0] = '\0';
+	sprint_errnos(str, len + 1, cc);
+
+	return str;
+}
+
 static void
 call_summary_pers(FILE *outf)
 {
@@ -314,6 +420,18 @@ call_summary_pers(FILE *outf)
 
 	size_t sc_name_max = 0;
 
+	bool show_errnos = false;
+	char **errnos_strs = NULL;
+	char *errnos_cum_str = NULL;
+	struct call_counts errnos_cum = { .errors = 0 };
+	size_t errnos_max = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(columns) && columns[i]; ++i) {
+		if (columns[i] == CSC_ERRNOS)
+			show_errnos = true;
+	}
+	if (show_errnos)
+		errnos_strs = xcalloc(nsyscalls, sizeof(*errnos_strs));
 
 	/* sort, calculate statistics */
 	indices = xcalloc(sizeof(indices[0]), nsyscalls);
@@ -333,9 +451,25 @@ call_summary_pers(FILE *outf)
 		tv_avg_max = ts_max(tv_avg_max, &counts[i].time_avg);
 
 		sc_name_max = MAX(sc_name_max, strlen(sysent[i].sys_name));
+
+		if (show_errnos) {
+			for (size_t j = 0; j < counts[i].errnos_used; ++j)
+				count_errno(&errnos_cum,
+					    counts[i].errnos[j].error,
+					    counts[i].errnos[j].count);
+
+			errnos_strs[i] = format_errnos(&counts[i]);
+			errnos_max = MAX(errnos_max, strlen(errnos_strs[i]));
+		}
 	}
 	float_tv_cum = ts_float(&tv_cum);
 
+	if (show_errnos) {
+		errnos_cum_str = format_errnos(&errnos_cum);
+		errnos_max = MAX(errnos_max, strlen(errnos_cum_str));
+		free(errnos_cum.errnos);
+	}
+
 	if (sortfun)
 		qsort((void *) indices, nsyscalls, sizeof(indices[0]), sortfun);
 
@@ -358,6 +492,8 @@ call_summary_pers(FILE *outf)
 		[CSC_CALLS]      = { "calls",       9, "%1$*2$" PRIu64 },
 		[CSC_ERRORS]     = { "errors",      9, "%1$*2$.0" PRIu64 },
 		[CSC_SC_NAME]    = { "syscall",    16, "%1$-*2$s", "%1$s", CF_L },
+		[CSC_ERRNOS]     = { ARRSZ_PAIR("errnos") - 1,
+				     "%1$-*2$s", "%1$s", CF_L },
 	};
 
 	/* calculate column widths */
@@ -375,6 +511,7 @@ call_summary_pers(FILE *outf)
 		W_(CSC_CALLS,      num_chars("%" PRIu64, call_cum)),
 		W_(CSC_ERRORS,     num_chars("%" PRIu64, error_cum)),
 		W_(CSC_SC_NAME,    sc_name_max + 1),
+		W_(CSC_ERRNOS,     errnos_max),
 	};
 #undef W_
 
@@ -427,6 +564,7 @@ call_summary_pers(FILE *outf)
 		FC_(CSC_CALLS);
 		FC_(CSC_ERRORS);
 		FC_(CSC_SC_NAME);
+		FC_(CSC_ERRNOS);
 		}
 	}
 
@@ -460,6 +598,7 @@ call_summary_pers(FILE *outf)
 			PC_(CSC_CALLS,      cc->calls);
 			PC_(CSC_ERRORS,     cc->errors);
 			PC_(CSC_SC_NAME,    sysent[idx].sys_name);
+			PC_(CSC_ERRNOS,     errnos_strs[idx]);
 			}
 		}
 
@@ -467,6 +606,11 @@ call_summary_pers(FILE *outf)
 	}
 
 	free(indices);
+	if (errnos_strs) {
+		for (size_t i = 0; i < nsyscalls; ++i)
+			free(errnos_strs[i]);
+		free(errnos_strs);
+	}
 
 	/* footer */
 	for (size_t i = 0; i <= last_column; ++i) {
@@ -493,10 +637,13 @@ call_summary_pers(FILE *outf)
 		PC_(CSC_CALLS, call_cum);
 		PC_(CSC_ERRORS, error_cum);
 		PC_(CSC_SC_NAME, "total");
+		PC_(CSC_ERRNOS, errnos_cum_str);
 		}
 	}
 	fputc('\n', outf);
 
+	free(errnos_cum_str);
+
 #undef PC_
 #undef FC_
 }
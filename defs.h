@@ -244,6 +244,21 @@ struct inject_opts {
 	struct inject_data data;
 };
 
+/* A condition on an argument of the traced syscalls, see qualify_trace().  */
+struct arg_pred {
+	unsigned int arg;	/* index of the argument, starting from 0 */
+	bool mask;		/* some bits of val are set vs equal to val */
+	bool wide;		/* val does not fit in 32 bits */
+	kernel_ulong_t val;
+};
+
+# define MAX_ARG_PREDS	8
+
+struct arg_preds {
+	unsigned int count;
+	struct arg_pred pred[MAX_ARG_PREDS];
+};
+
 # define MAX_ERRNO_VALUE			4095
 
 /* Trace Control Block */
@@ -262,6 +277,13 @@ struct tcb {
 	int curcol;		/* Output column for this process */
 	FILE *outf;		/* Output file for this process */
 	struct staged_output_data *staged_output_data;
+	struct flight_ring *flight_ring; /* Recent output for --flight-recorder */
+	struct ptree_proc *ptree_proc;	/* Record for --process-tree */
+	struct timeline_thread *timeline; /* Thread lifetime for --timeline */
+	struct perf_tracee *perf_tracee; /* Events of --summary-backend=perf */
+	int mem_fd;		/* /proc/pid/mem, see process_read_mem() */
+	int tgid;		/* Thread group id for --summary-io and
+			   --seccomp-notify, 0 if unknown */
 
 	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
 	void *_priv_data;	/* Private data for syscall decoding functions */
@@ -274,6 +296,7 @@ struct tcb {
 	struct timespec stime;	/* System time usage as of last process wait */
 	struct timespec ltime;	/* System time usage as of last syscall entry */
 	struct timespec atime;	/* System time right after attach */
+	struct timespec attach_ts; /* When stopped on attach, until restarted */
 	struct timespec etime;	/* Syscall entry time (CLOCK_MONOTONIC) */
 	struct timespec delay_expiration_time; /* When does the delay end */
 
@@ -288,6 +311,8 @@ struct tcb {
 	/** Wait data storage for a delayed process. */
 	struct tcb_wait_data *delayed_wait_data;
 	struct list_item wait_list;
+	/** Next tcb in the same pid2tcb() bucket, or in the list of free tcbs. */
+	struct tcb *pid_hash_next;
 
 
 # ifdef HAVE_LINUX_KVM_H
@@ -335,6 +360,11 @@ struct tcb {
 # define TCB_SECCOMP_FILTER	0x8000	/* This process has a seccomp filter
 					 * attached.
 					 */
+# define TCB_RECHECK_PID	0x10000	/* The pid may have been reused since
+					 * the last --seccomp-notify
+					 * notification.
+					 */
+# define TCB_PROC_MEM_DENIED	0x20000	/* /proc/pid/mem cannot be used */
 
 /* qualifier flags */
 # define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -466,6 +496,15 @@ extern int Tflag_scale;
 extern int Tflag_width;
 extern bool iflag;
 extern bool count_wallclock;
+extern bool count_io;
+extern unsigned int slowest_count;
+extern struct timespec min_duration;
+extern unsigned int flight_recorder_size;
+extern enum process_tree_format {
+	PROCESS_TREE_NONE,
+	PROCESS_TREE_TEXT,
+	PROCESS_TREE_JSON,
+} process_tree_format;
 /* are we filtering traces based on paths? */
 extern struct path_set {
 	const char **paths_selected;
@@ -483,11 +522,19 @@ enum xflag_opts {
 extern unsigned xflag;
 extern bool followfork;
 extern bool output_separately;
+/* weight of the stacks in the --stack-summary report */
+enum stack_summary_weight {
+	STACK_SUMMARY_NONE,
+	STACK_SUMMARY_COUNT,
+	STACK_SUMMARY_TIME,
+};
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+extern enum stack_summary_weight stack_summary;
 # else
 #  define stack_trace_enabled 0
+#  define stack_summary 0
 # endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
@@ -509,6 +556,9 @@ extern void print_syscall_resume(struct tcb *tcp);
 
 extern int syscall_entering_decode(struct tcb *);
 extern int syscall_entering_trace(struct tcb *, unsigned int *);
+extern void syscall_trace_seccomp_notify(struct tcb *, unsigned int personality,
+					 kernel_ulong_t scno,
+					 const uint64_t args[6]);
 extern void syscall_entering_finish(struct tcb *, int);
 
 extern int syscall_exiting_decode(struct tcb *, struct timespec *);
@@ -516,8 +566,21 @@ extern int syscall_exiting_trace(struct tcb *, struct timespec *, int);
 extern void syscall_exiting_finish(struct tcb *);
 
 extern void count_syscall(struct tcb *, const struct timespec *);
+extern void count_syscall_time(kernel_ulong_t scno, int error,
+			       const struct timespec *);
 extern void call_summary(FILE *);
 
+extern bool perf_summary;
+extern void perf_summary_init(void);
+extern void perf_summary_attach(struct tcb *);
+extern void perf_summary_read(void);
+extern void perf_summary_drop(struct tcb *);
+extern void perf_summary_finish(void);
+
+extern void count_io_syscall(struct tcb *, const struct timespec *);
+extern void io_summary_forget_pid(int pid);
+extern void io_call_summary(FILE *);
+
 extern void clear_regs(struct tcb *tcp);
 extern int get_scno(struct tcb *);
 extern kernel_ulong_t get_rt_sigframe_addr(struct tcb *);
@@ -660,6 +723,8 @@ umovestr(struct tcb *, kernel_ulong_t addr, unsigned int len, char *laddr);
 
 /* Invalidate the cache used by umove* functions.  */
 extern void invalidate_umove_cache(void);
+/* Close /proc/pid/mem of the tracee used by umove* functions, if opened.  */
+extern void close_proc_mem(struct tcb *);
 
 extern int upeek(struct tcb *tcp, unsigned long, kernel_ulong_t *);
 extern int upoke(struct tcb *tcp, unsigned long, kernel_ulong_t);
@@ -671,6 +736,7 @@ extern long getrval2(struct tcb *);
 extern const char *signame(const int);
 extern const char *sprintsigname(const int);
 extern void pathtrace_select_set(const char *, struct path_set *);
+extern void pathtrace_clear_set(struct path_set *);
 extern bool pathtrace_match_set(struct tcb *, struct path_set *);
 
 static inline void
@@ -688,6 +754,7 @@ pathtrace_match(struct tcb *tcp)
 extern int getfdpath(struct tcb *, int, char *, unsigned);
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
+extern int get_proc_tgid(int pid);
 
 extern const char *xlookup(const struct xlat *, const uint64_t);
 extern const char *xlookup_le(const struct xlat *, uint64_t *);
@@ -736,6 +803,7 @@ extern int print_quoted_string_ex(const char *, unsigned int, unsigned int,
 				  const char *escape_chars);
 extern int print_quoted_string(const char *, unsigned int, unsigned int);
 extern int print_quoted_cstring(const char *, unsigned int);
+extern void fprint_json_string(FILE *, const char *, size_t);
 
 /* a refers to the lower numbered u_arg,
  * b refers to the higher numbered u_arg
@@ -1118,7 +1186,11 @@ extern void qualify_write(const char *);
 extern void qualify_fault(const char *);
 extern void qualify_inject(const char *);
 extern void qualify_kvm(const char *);
+extern void qualify_dump_on_error(const char *);
+extern char *requalify(const char *);
 extern unsigned int qual_flags(const unsigned int);
+extern const struct arg_preds **arg_preds_vec[SUPPORTED_PERSONALITIES];
+extern bool arg_preds_match(const struct tcb *);
 
 # define DECL_IOCTL(name)						\
 extern int								\
@@ -1253,6 +1325,8 @@ extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
+extern void unwind_tcb_summarize(struct tcb *, const struct timespec *ts);
+extern void unwind_summary_print(FILE *);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
@@ -1406,6 +1480,7 @@ extern void print_user_desc(struct tcb *, kernel_ulong_t addr,
  */
 extern struct tcb *printing_tcp;
 extern void printleader(struct tcb *);
+extern const struct timespec *get_event_ts(void);
 extern void line_ended(void);
 extern void tabto(void);
 extern void tprintf(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2));
@@ -1414,10 +1489,75 @@ extern void tprintf_comment(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2
 extern void tprints_comment(const char *str);
 
 /*
- * Staging output for status qualifier.
+ * Staging output for status qualifier, --slowest, and --min-duration options.
  */
 extern FILE *strace_open_memstream(struct tcb *tcp);
 extern void strace_close_memstream(struct tcb *tcp, bool publish);
+extern void strace_finish_staged_output(struct tcb *tcp, bool publish,
+					const struct timespec *end_ts);
+extern bool syscall_output_staged(void);
+extern size_t strace_staged_output_size(const struct tcb *);
+extern size_t slowest_output_size(void);
+extern void slowest_summary(FILE *);
+
+/*
+ * Flight recorder.
+ */
+extern void flight_recorder_add(struct tcb *, char *output);
+extern void flight_recorder_drop(struct tcb *);
+extern bool flight_recorder_is_trigger(struct tcb *);
+extern void flight_recorder_dump(const char *reason);
+extern size_t flight_recorder_output_size(void);
+
+/*
+ * Live statistics snapshot and control socket.
+ */
+extern void print_snapshot(FILE *);
+extern void control_open(const char *path);
+extern void control_process(void);
+extern void control_close(void);
+
+/* Membership of the cgroup traced with --cgroup.  */
+extern void cgroup_open(const char *path);
+extern bool cgroup_scan(bool (*attach)(int pid));
+extern bool cgroup_scan_due(void);
+extern int cgroup_wait(bool tracees);
+extern void cgroup_close(void);
+
+/* Merge of -ff output files.  */
+extern int merge_logs(const char *prefix);
+
+/*
+ * Process tree report.
+ */
+struct rusage;
+extern void process_tree_init(void);
+extern void process_tree_attach(struct tcb *);
+extern void process_tree_clone(struct tcb *, struct tcb *child_tcp,
+			       int child_pid, bool clone);
+extern void process_tree_execve(struct tcb *, kernel_ulong_t argv);
+extern void process_tree_exec(struct tcb *);
+extern void process_tree_switch(struct tcb *execve_thread, struct tcb *leader);
+extern void process_tree_exit(struct tcb *, int status, const struct rusage *);
+extern void process_tree_print(FILE *);
+
+/*
+ * Timeline in the trace event format.
+ */
+extern FILE *timeline_file;
+extern void timeline_init(FILE *);
+extern void timeline_attach(struct tcb *);
+extern void timeline_exec(struct tcb *);
+extern void timeline_syscall(struct tcb *, const struct timespec *duration,
+			     const char *output);
+extern void timeline_detach(struct tcb *);
+extern void timeline_close(void);
+
+/*
+ * Trace output written by a separate thread.
+ */
+extern FILE *output_thread_wrap(FILE *, const char *name);
+extern void output_thread_stop(void);
 
 static inline void
 printaddr_comment(const kernel_ulong_t addr)
@@ -12,6 +12,8 @@
 #include "defs.h"
 #include "xstring.h"
 
+#include "xlat/close_range_flags.h"
+
 SYS_FUNC(close)
 {
 	printfd(tcp, tcp->u_arg[0]);
@@ -19,6 +21,23 @@ SYS_FUNC(close)
 	return RVAL_DECODED;
 }
 
+SYS_FUNC(close_range)
+{
+	/* first */
+	printfd(tcp, tcp->u_arg[0]);
+	tprints(", ");
+
+	/* last */
+	printfd(tcp, tcp->u_arg[1]);
+	tprints(", ");
+
+	/* flags */
+	printflags(close_range_flags, (unsigned int) tcp->u_arg[2],
+		   "CLOSE_RANGE_???");
+
+	return RVAL_DECODED;
+}
+
 SYS_FUNC(dup)
 {
 	printfd(tcp, tcp->u_arg[0]);
@@ -16,4 +16,9 @@ void qualify_tokens(const char *str, struct number_set *set,
 		    string_to_uint_func func, const char *name);
 void qualify_syscall_tokens(const char *str, struct number_set *set);
 
+/* Non-fatal variants, return an error message to be freed by the caller. */
+char *parse_tokens(const char *str, struct number_set *set,
+		   string_to_uint_func func, const char *name);
+char *parse_syscall_tokens(const char *str, struct number_set *set);
+
 #endif /* !STRACE_FILTER_H */
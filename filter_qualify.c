@@ -10,6 +10,7 @@
 #include "nsig.h"
 #include "number_set.h"
 #include "filter.h"
+#include "filter_seccomp.h"
 #include "delay.h"
 #include "retval.h"
 #include "static_assert.h"
@@ -21,6 +22,11 @@ struct number_set *status_set;
 struct number_set *quiet_set;
 struct number_set *decode_fd_set;
 struct number_set *trace_set;
+struct number_set *dump_syscall_set;
+struct number_set *dump_errno_set;
+
+/* The argument conditions of -e trace=SET:PREDICATE..., per syscall.  */
+const struct arg_preds **arg_preds_vec[SUPPORTED_PERSONALITIES];
 
 bool quiet_set_updated = false;
 bool decode_fd_set_updated = false;
@@ -117,6 +123,15 @@ find_errno_by_name(const char *name)
 	return -1;
 }
 
+static int
+errnostr_to_uint(const char *str)
+{
+	if (*str >= '0' && *str <= '9')
+		return string_to_uint_upto(str, MAX_ERRNO_VALUE);
+
+	return find_errno_by_name(str);
+}
+
 static bool
 parse_delay_token(const char *input, struct inject_opts *fopts, bool isenter)
 {
@@ -354,12 +369,227 @@ qualify_decode_fd(const char *const str)
 		       "decode-fds");
 }
 
+/*
+ * Parse a PREDICATE of -e trace=SET:PREDICATE: argN=VALUE or argN&MASK,
+ * where N is the index of the argument from 0 to 5, as in seccomp_data;
+ * fd is an alias of arg0.  Most arguments are int, and the upper half of
+ * a register holding an int is not defined, so values that fit in 32 bits
+ * are compared with the lower half only.
+ */
+static bool
+parse_arg_pred(const char *const token, struct arg_pred *const pred)
+{
+	const char *val = STR_STRIP_PREFIX(token, "fd");
+
+	if (val != token) {
+		pred->arg = 0;
+	} else if ((val = STR_STRIP_PREFIX(token, "arg")) != token
+		   && *val >= '0' && *val <= '5') {
+		pred->arg = *val++ - '0';
+	} else {
+		return false;
+	}
+
+	if (*val == '=')
+		pred->mask = false;
+	else if (*val == '&')
+		pred->mask = true;
+	else
+		return false;
+	++val;
+
+	/* Negative values are allowed for things like AT_FDCWD.  */
+	char *end;
+	errno = 0;
+	const unsigned long long v = *val == '-'
+				     ? (unsigned long long) strtoll(val, &end, 0)
+				     : strtoull(val, &end, 0);
+	if (errno || end == val || *end)
+		return false;
+	pred->val = v;
+	/* Whether it does not fit in 32 bits, zero- or sign-extended.  */
+	pred->wide = v != (uint32_t) v && (long long) v != (int32_t) v;
+
+	return true;
+}
+
+/* Parse the colon separated predicates of -e trace=SET:PREDICATES.  */
+static struct arg_preds *
+parse_arg_preds(char *const str)
+{
+	struct arg_preds *const preds = xzalloc(sizeof(*preds));
+	char *saveptr = NULL;
+
+	for (char *token = strtok_r(str, ":", &saveptr); token;
+	     token = strtok_r(NULL, ":", &saveptr)) {
+		if (preds->count >= MAX_ARG_PREDS
+		    || !parse_arg_pred(token, &preds->pred[preds->count++])) {
+			free(preds);
+			return NULL;
+		}
+	}
+
+	if (!preds->count) {
+		free(preds);
+		return NULL;
+	}
+
+	return preds;
+}
+
+/* Every arg_preds referenced by arg_preds_vec, to be freed together.  */
+static struct arg_preds **all_arg_preds;
+static size_t all_arg_preds_count;
+static size_t all_arg_preds_size;
+
+/* Whether the last set given to -e trace has predicates.  */
+static bool trace_set_has_preds;
+
+static void
+clear_arg_preds(void)
+{
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		free(arg_preds_vec[p]);
+		arg_preds_vec[p] = NULL;
+	}
+
+	for (size_t i = 0; i < all_arg_preds_count; ++i)
+		free(all_arg_preds[i]);
+	all_arg_preds_count = 0;
+}
+
+/* Set the predicates of the syscalls from SET.  */
+static void
+set_arg_preds(const struct number_set *const set,
+	      struct arg_preds *const preds)
+{
+	if (all_arg_preds_count >= all_arg_preds_size)
+		all_arg_preds = xgrowarray(all_arg_preds, &all_arg_preds_size,
+					   sizeof(*all_arg_preds));
+	all_arg_preds[all_arg_preds_count++] = preds;
+
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (number_set_array_is_empty(set, p))
+			continue;
+
+		if (!arg_preds_vec[p]) {
+			arg_preds_vec[p] = xcalloc(nsyscall_vec[p],
+						   sizeof(*arg_preds_vec[p]));
+		}
+
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (is_number_in_set_array(i, set, p))
+				arg_preds_vec[p][i] = preds;
+		}
+	}
+}
+
+/*
+ * Every -e trace replaces the set of traced syscalls, except that a set
+ * with predicates is added to the preceding set with predicates,
+ * so that different syscalls can have different predicates.
+ */
 void
 qualify_trace(const char *const str)
 {
-	if (!trace_set)
-		trace_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
-	qualify_syscall_tokens(str, trace_set);
+	char *copy = xstrdup(str);
+	char *const colon = strchr(copy, ':');
+	struct arg_preds *preds = NULL;
+
+	if (colon) {
+		*colon = '\0';
+		preds = parse_arg_preds(colon + 1);
+		if (colon == copy || !preds)
+			error_msg_and_die("invalid trace argument '%s'", str);
+	}
+
+	struct number_set *set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+
+	qualify_syscall_tokens(copy, set);
+	free(copy);
+
+	if (!preds || !trace_set_has_preds)
+		clear_arg_preds();
+	if (preds)
+		set_arg_preds(set, preds);
+
+	if (preds && trace_set_has_preds) {
+		struct number_set *const merged =
+			alloc_number_set_array(SUPPORTED_PERSONALITIES);
+
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+				if (is_number_in_set_array(i, set, p) ||
+				    is_number_in_set_array(i, trace_set, p))
+					add_number_to_set_array(i, merged, p);
+			}
+		}
+		free_number_set_array(set, SUPPORTED_PERSONALITIES);
+		set = merged;
+	}
+
+	if (trace_set)
+		free_number_set_array(trace_set, SUPPORTED_PERSONALITIES);
+	trace_set = set;
+	trace_set_has_preds = preds;
+}
+
+/* Whether the arguments of the syscall match its predicates, if any.  */
+bool
+arg_preds_match(const struct tcb *const tcp)
+{
+	const struct arg_preds *const preds =
+		arg_preds_vec[current_personality] && scno_in_range(tcp->scno)
+		? arg_preds_vec[current_personality][tcp->scno] : NULL;
+
+	if (!preds)
+		return true;
+
+	for (unsigned int i = 0; i < preds->count; ++i) {
+		const struct arg_pred *const pred = &preds->pred[i];
+
+		/* The value cannot be equal to a 32-bit argument.  */
+		if (pred->wide && !pred->mask && current_klongsize <= 4)
+			return false;
+
+		const kernel_ulong_t width =
+			pred->wide ? max_kaddr() : UINT32_MAX;
+		const kernel_ulong_t arg = tcp->u_arg[pred->arg] & width;
+		const kernel_ulong_t val = pred->val & width;
+
+		if (pred->mask ? !(arg & val) : arg != val)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Parse [SYSCALL_SET:]ERRNO_SET specification of the syscall errors
+ * that trigger the flight recorder dump.
+ */
+void
+qualify_dump_on_error(const char *const str)
+{
+	const char *const colon = strrchr(str, ':');
+	const char *const errnos = colon ? colon + 1 : str;
+
+	if (!dump_syscall_set)
+		dump_syscall_set =
+			alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	if (!dump_errno_set)
+		dump_errno_set = alloc_number_set_array(1);
+
+	if (colon) {
+		char *syscalls = xstrndup(str, colon - str);
+
+		qualify_syscall_tokens(syscalls, dump_syscall_set);
+		free(syscalls);
+	} else {
+		qualify_syscall_tokens("all", dump_syscall_set);
+	}
+
+	qualify_tokens(errnos, dump_errno_set, errnostr_to_uint, "errno");
 }
 
 void
@@ -539,6 +769,104 @@ qualify(const char *str)
 	opt->qualify(str);
 }
 
+/* Qualifiers that can be changed while tracing is in progress. */
+static const struct requal_options {
+	const char *name;
+	struct number_set **set;
+	string_to_uint_func func;	/* NULL for syscall sets */
+	const char *description;
+} requal_options[] = {
+	{ "trace",	&trace_set,	NULL,			NULL },
+	{ "t",		&trace_set,	NULL,			NULL },
+	{ "abbrev",	&abbrev_set,	NULL,			NULL },
+	{ "a",		&abbrev_set,	NULL,			NULL },
+	{ "verbose",	&verbose_set,	NULL,			NULL },
+	{ "v",		&verbose_set,	NULL,			NULL },
+	{ "raw",	&raw_set,	NULL,			NULL },
+	{ "x",		&raw_set,	NULL,			NULL },
+	{ "status",	&status_set,	statusstr_to_uint,	"status" },
+	{ "read",	&read_set,	string_to_uint,		"descriptor" },
+	{ "reads",	&read_set,	string_to_uint,		"descriptor" },
+	{ "r",		&read_set,	string_to_uint,		"descriptor" },
+	{ "write",	&write_set,	string_to_uint,		"descriptor" },
+	{ "writes",	&write_set,	string_to_uint,		"descriptor" },
+	{ "w",		&write_set,	string_to_uint,		"descriptor" },
+};
+
+/*
+ * Change a qualifier specified as NAME=VALUE while tracing is in progress.
+ * The current set is replaced only if the new one has been parsed
+ * successfully, and it takes effect starting with the next syscall entering,
+ * when tcp->qual_flg is computed by qual_flags().
+ * Return NULL on success, otherwise a message explaining why the change
+ * has been refused that has to be freed by the caller.
+ */
+char *
+requalify(const char *str)
+{
+	const struct requal_options *opt = NULL;
+	const char *val = NULL;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(requal_options); ++i) {
+		const char *name = requal_options[i].name;
+		const size_t len = strlen(name);
+
+		val = str_strip_prefix_len(str, name, len);
+		if (val != str && *val == '=') {
+			opt = &requal_options[i];
+			++val;
+			break;
+		}
+	}
+
+	if (!opt)
+		return xasprintf("cannot change '%s' at runtime", str);
+
+	const unsigned int nmemb = opt->func ? 1 : SUPPORTED_PERSONALITIES;
+	struct number_set *set = alloc_number_set_array(nmemb);
+	char *err = opt->func
+		    ? parse_tokens(val, set, opt->func, opt->description)
+		    : parse_syscall_tokens(val, set);
+
+	if (!err && opt->set == &trace_set) {
+		/*
+		 * The filter is installed into the tracees only once,
+		 * syscalls it lets through without a stop cannot be traced.
+		 */
+		const char *name = seccomp_filter_missing_syscall(set);
+
+		if (name)
+			err = xasprintf("syscall %s does not stop the tracees"
+					" under the seccomp filter installed"
+					" by --seccomp-bpf, restart strace"
+					" to trace it", name);
+		/*
+		 * The predicates are dropped with the old set, but the filter
+		 * keeps letting through the syscalls they do not match.
+		 */
+		else if ((name = seccomp_filter_arg_checked_syscall(set)))
+			err = xasprintf("the arguments of syscall %s are checked"
+					" by the seccomp filter installed by"
+					" --seccomp-bpf, restart strace to trace"
+					" it regardless of them", name);
+	}
+
+	if (err) {
+		free_number_set_array(set, nmemb);
+		return err;
+	}
+
+	if (*opt->set)
+		free_number_set_array(*opt->set, nmemb);
+	*opt->set = set;
+	if (opt->set == &trace_set) {
+		clear_arg_preds();
+		trace_set_has_preds = false;
+	}
+
+	return NULL;
+}
+
 unsigned int
 qual_flags(const unsigned int scno)
 {
@@ -10,6 +10,7 @@
 #include "defs.h"
 
 #include "ptrace.h"
+#include <ctype.h>
 #include <signal.h>
 #include <sys/prctl.h>
 #include <sys/wait.h>
@@ -22,6 +23,12 @@
 
 bool seccomp_filtering;
 bool seccomp_before_sysentry;
+const char *seccomp_profile_path;
+
+/* Syscalls that stop the tracees under the seccomp filter being installed. */
+static struct number_set *filter_stop_set;
+/* Syscalls whose arguments are checked by the filter being installed.  */
+static struct number_set *filter_arg_check_set;
 
 #ifdef HAVE_LINUX_SECCOMP_H
 
@@ -74,9 +81,15 @@ static unsigned short linear_filter_generator(struct sock_filter *,
 					      bool *overflow);
 static unsigned short binary_match_filter_generator(struct sock_filter *,
 						    bool *overflow);
-static filter_generator_t filter_generators[] = {
-	linear_filter_generator,
-	binary_match_filter_generator,
+static unsigned short decision_tree_filter_generator(struct sock_filter *,
+						     bool *overflow);
+static const struct {
+	filter_generator_t gen;
+	const char *name;
+} filter_generators[] = {
+	{ linear_filter_generator,		"linear" },
+	{ binary_match_filter_generator,	"binary match" },
+	{ decision_tree_filter_generator,	"decision tree" },
 };
 
 /*
@@ -85,6 +98,15 @@ static filter_generator_t filter_generators[] = {
  */
 static struct sock_filter
 filters[ARRAY_SIZE(filter_generators)][2 * BPF_MAXINSNS];
+
+/*
+ * The checks of arg_preds_vec placed before the program made by any of
+ * filter_generators, they are given up if they take more than a half
+ * of the instruction budget.
+ */
+static struct sock_filter arg_filter[BPF_MAXINSNS / 2];
+/* Whether the selected program starts with arg_filter.  */
+static bool arg_filter_used;
 static struct sock_fprog bpf_prog = {
 	.len = USHRT_MAX,
 	.filter = NULL,
@@ -282,12 +304,18 @@ check_seccomp_order(void)
 }
 
 static bool
-traced_by_seccomp(unsigned int scno, unsigned int p)
+always_traced_by_seccomp(unsigned int scno, unsigned int p)
 {
 	unsigned int always_trace_flags =
 		TRACE_INDIRECT_SUBCALL | TRACE_SECCOMP_DEFAULT |
 		(stack_trace_enabled ? MEMORY_MAPPING_CHANGE : 0);
-	return sysent_vec[p][scno].sys_flags & always_trace_flags ||
+	return sysent_vec[p][scno].sys_flags & always_trace_flags;
+}
+
+static bool
+traced_by_seccomp(unsigned int scno, unsigned int p)
+{
+	return always_traced_by_seccomp(scno, p) ||
 		is_number_in_set_array(scno, trace_set, p);
 }
 
@@ -595,38 +623,789 @@ binary_match_filter_generator(struct sock_filter *filter, bool *overflow)
 	return pos;
 }
 
+/*
+ * The expected number of times each syscall is made by the tracees,
+ * for choosing the program that executes the fewest instructions.
+ */
+static uint64_t *syscall_weights[SUPPORTED_PERSONALITIES];
+
+/*
+ * A rough mix of the syscalls of common workloads, used unless a profile
+ * is given with --seccomp-profile.
+ */
+static const struct {
+	const char *name;
+	unsigned int weight;
+} default_syscall_profile[] = {
+	{ "read",		200 },
+	{ "write",		150 },
+	{ "futex",		120 },
+	{ "close",		80 },
+	{ "openat",		60 },
+	{ "fstat",		60 },
+	{ "epoll_wait",		60 },
+	{ "epoll_pwait",	60 },
+	{ "poll",		60 },
+	{ "recvmsg",		50 },
+	{ "ppoll",		40 },
+	{ "recvfrom",		40 },
+	{ "sendmsg",		40 },
+	{ "sendto",		40 },
+	{ "newfstatat",		40 },
+	{ "mmap",		40 },
+	{ "ioctl",		40 },
+	{ "rt_sigprocmask",	40 },
+	{ "lseek",		30 },
+	{ "fcntl",		30 },
+	{ "pread64",		30 },
+	{ "stat",		20 },
+	{ "statx",		20 },
+	{ "munmap",		20 },
+	{ "mprotect",		20 },
+	{ "writev",		20 },
+	{ "nanosleep",		20 },
+	{ "clock_nanosleep",	20 },
+	{ "lstat",		15 },
+	{ "pwrite64",		15 },
+	{ "brk",		10 },
+	{ "madvise",		10 },
+	{ "readv",		10 },
+	{ "getdents64",		10 },
+	{ "access",		10 },
+	{ "readlink",		10 },
+	{ "select",		10 },
+	{ "pselect6",		10 },
+	{ "rt_sigaction",	10 },
+	{ "getpid",		10 },
+	{ "gettid",		10 },
+	{ "sched_yield",	10 },
+	{ "faccessat",		5 },
+	{ "getrandom",		5 },
+	{ "wait4",		2 },
+	{ "clone",		2 },
+	{ "execve",		1 },
+	{ "exit_group",		1 },
+};
+
 static void
-check_seccomp_filter_properties(void)
+add_syscall_weight(const char *name, const unsigned int p,
+		   const uint64_t weight)
 {
-	int rc = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, NULL, 0, 0);
-	seccomp_filtering = rc < 0 && errno != EINVAL;
-	if (!seccomp_filtering) {
-		debug_func_perror_msg("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER)");
+	for (kernel_long_t scno = 0; (scno = scno_by_name(name, p, scno)) >= 0;
+	     ++scno)
+		syscall_weights[p][scno] += weight;
+}
+
+/* Find the word in the header of a table, return NULL if there is none.  */
+static const char *
+find_column_header(const char *line, const char *word)
+{
+	const size_t len = strlen(word);
+
+	for (const char *s = line; (s = strstr(s, word)); s += len) {
+		if ((s == line || s[-1] == ' ') &&
+		    (s[len] == ' ' || s[len] == '\0'))
+			return s;
+	}
+
+	return NULL;
+}
+
+/* Return the personality of the name in a summary title, if any.  */
+static unsigned int
+summary_personality(const char *s)
+{
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		const size_t len = strlen(personality_names[p]);
+
+		if (!strncmp(s, personality_names[p], len) &&
+		    !strcmp(s + len, " mode:"))
+			return p;
+	}
+
+	return -1U;
+}
+
+/*
+ * Add the numbers of calls from the tables of strace -c output in path
+ * to syscall_weights.  The columns may have been chosen with -U, so they
+ * are found by the positions of their headers: the calls column
+ * is right-aligned, the syscall column is left-aligned.
+ */
+static void
+load_seccomp_profile(const char *path)
+{
+	static const char title[] = "System call usage summary for ";
+	FILE *fp = fopen(path, "r");
+
+	if (!fp)
+		perror_msg_and_die("%s", path);
+
+	unsigned int p = 0;
+	size_t calls_end = 0, name_start = 0;
+	bool found = false;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &size, fp)) >= 0) {
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+
+		if (!strncmp(line, title, sizeof(title) - 1)) {
+			p = summary_personality(line + sizeof(title) - 1);
+			calls_end = 0;
+			continue;
+		}
+
+		const char *calls = find_column_header(line, "calls");
+		const char *name = find_column_header(line, "syscall");
+
+		if (calls && name) {
+			calls_end = calls - line + sizeof("calls") - 1;
+			name_start = name - line;
+			found = true;
+			continue;
+		}
+
+		if (!calls_end || p >= SUPPORTED_PERSONALITIES ||
+		    (size_t) len < calls_end || (size_t) len <= name_start ||
+		    line[name_start] == ' ' || line[name_start] == '-')
+			continue;
+
+		size_t i = calls_end;
+
+		while (i > 0 && isdigit((unsigned char) line[i - 1]))
+			--i;
+		if (i == calls_end)
+			continue;
+
+		const uint64_t count = strtoull(line + i, NULL, 10);
+
+		name = line + name_start;
+		line[name_start + strcspn(name, " ")] = '\0';
+		if (strcmp(name, "total"))
+			add_syscall_weight(name, p, count);
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (!found)
+		error_msg_and_die("%s: no strace -c summary found", path);
+}
+
+static void
+init_syscall_weights(void)
+{
+	if (syscall_weights[0])
 		return;
+
+	/* Every syscall is assumed to be made once at least.  */
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		syscall_weights[p] = xcalloc(nsyscall_vec[p],
+					     sizeof(*syscall_weights[p]));
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (sysent_vec[p][i].sys_name)
+				syscall_weights[p][i] = 1;
+		}
+	}
+
+	if (seccomp_profile_path) {
+		load_seccomp_profile(seccomp_profile_path);
+		return;
+	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(default_syscall_profile); ++i)
+		add_syscall_weight(default_syscall_profile[i].name, 0,
+				   default_syscall_profile[i].weight);
+}
+
+/* A run of consecutive syscall numbers with the same verdict.  */
+struct scno_run {
+	unsigned int lower;
+	bool traced;
+	uint64_t weight;
+};
+
+/*
+ * Emit the comparisons that find the run of nr among n > 1 runs.
+ * The runs are split where the weights of both sides are the closest,
+ * which keeps the expected number of comparisons close to the optimal.
+ */
+static unsigned short
+bpf_decision_tree(struct sock_filter *filter, const struct scno_run *runs,
+		  const unsigned int n, const unsigned int flag, bool *overflow)
+{
+	uint64_t total = 0, left = 0, best_diff = UINT64_MAX;
+	unsigned int split = 1, best_dist = UINT_MAX;
+
+	for (unsigned int i = 0; i < n; ++i)
+		total += runs[i].weight;
+
+	for (unsigned int i = 1; i < n; ++i) {
+		left += runs[i - 1].weight;
+
+		const uint64_t diff = 2 * left > total ? 2 * left - total
+						       : total - 2 * left;
+		/* Without weights to tell, the tree is balanced by size.  */
+		const unsigned int dist = 2 * i > n ? 2 * i - n : n - 2 * i;
+
+		if (diff < best_diff || (diff == best_diff && dist < best_dist)) {
+			best_diff = diff;
+			best_dist = dist;
+			split = i;
+		}
+	}
+
+	unsigned short pos = 1;
+	unsigned char jt, jf = 0;
+
+	if (split == 1)
+		jf = runs[0].traced ? JMP_PLACEHOLDER_TRACE
+				    : JMP_PLACEHOLDER_ALLOW;
+	else
+		pos += bpf_decision_tree(filter + pos, runs, split, flag,
+					 overflow);
+
+	if (split + 1 == n) {
+		jt = runs[split].traced ? JMP_PLACEHOLDER_TRACE
+					: JMP_PLACEHOLDER_ALLOW;
+	} else {
+		/* Offsets of the size of the placeholders are ambiguous.  */
+		if (pos - 1 >= JMP_PLACEHOLDER_ALLOW)
+			*overflow = true;
+		jt = pos - 1;
+		pos += bpf_decision_tree(filter + pos, runs + split, n - split,
+					 flag, overflow);
+	}
+
+	/* if (nr >= runs[split].lower) goto right; else goto left; */
+	SET_BPF_JUMP(filter, BPF_JGE | BPF_K, runs[split].lower | flag, jt, jf);
+
+	return pos;
+}
+
+static unsigned short
+decision_tree_filter_generator(struct sock_filter *filter, bool *overflow)
+{
+	/*
+	 * Generated program looks like:
+	 * if (arch == AUDIT_ARCH_A && nr >= flag) {
+	 *	if (nr >= 59) {
+	 *		if (nr >= 60)
+	 *			return SECCOMP_RET_ALLOW;
+	 *		return SECCOMP_RET_TRACE;
+	 *	}
+	 *	...
+	 * }
+	 * if (arch == AUDIT_ARCH_A) {
+	 *	...
+	 * }
+	 * return SECCOMP_RET_TRACE;
+	 *
+	 * where the syscalls with larger syscall_weights are found
+	 * with fewer comparisons.
+	 */
+	unsigned short pos = 0;
+
+	init_syscall_weights();
+
+# if SUPPORTED_PERSONALITIES > 1
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     offsetof(struct seccomp_data, arch));
+# endif
+
+	/* See linear_filter_generator for the order of personalities.  */
+	for (int p = SUPPORTED_PERSONALITIES - 1; p >= 0; --p) {
+		unsigned short start = pos, end;
+
+# if SUPPORTED_PERSONALITIES > 1
+		SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K,
+			     audit_arch_vec[p].arch, 0, JMP_PLACEHOLDER_NEXT);
+# endif
+		SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+			     offsetof(struct seccomp_data, nr));
+
+# if SUPPORTED_PERSONALITIES > 1
+		if (audit_arch_vec[p].flag) {
+			SET_BPF_JUMP(&filter[pos++], BPF_JGE | BPF_K,
+				     audit_arch_vec[p].flag, 2, 0);
+			SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+				     offsetof(struct seccomp_data, arch));
+			SET_BPF_JUMP(&filter[pos++], BPF_JA,
+				     JMP_PLACEHOLDER_NEXT, 0, 0);
+		}
+# endif
+
+		/* The syscalls past the end of the table are traced.  */
+		struct scno_run *runs = xcalloc(nsyscall_vec[p] + 1,
+						sizeof(*runs));
+		unsigned int n = 0;
+
+		for (unsigned int i = 0; i <= nsyscall_vec[p]; ++i) {
+			const bool traced = i == nsyscall_vec[p] ||
+					    traced_by_seccomp(i, p);
+
+			if (!n || runs[n - 1].traced != traced) {
+				runs[n].lower = i;
+				runs[n].traced = traced;
+				++n;
+			}
+			if (i < nsyscall_vec[p])
+				runs[n - 1].weight += syscall_weights[p][i];
+		}
+
+		/* A tree of so many runs cannot fit in the section.  */
+		if (n > UCHAR_MAX) {
+			free(runs);
+			*overflow = true;
+			return pos;
+		}
+
+		if (n > 1) {
+			pos += bpf_decision_tree(filter + pos, runs, n,
+						 audit_arch_vec[p].flag,
+						 overflow);
+		} else {
+			/* return RET_TRACE; */
+			SET_BPF_JUMP(&filter[pos++], BPF_JGE | BPF_K, 0,
+				     JMP_PLACEHOLDER_TRACE,
+				     JMP_PLACEHOLDER_TRACE);
+		}
+		free(runs);
+
+		end = pos;
+
+		SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K,
+			     SECCOMP_RET_ALLOW);
+		SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K,
+			     SECCOMP_RET_TRACE);
+
+		if (*overflow || pos - start > UCHAR_MAX) {
+			*overflow = true;
+			return pos;
+		}
+
+		for (unsigned int i = start; i < end; ++i) {
+			if (BPF_CLASS(filter[i].code) != BPF_JMP)
+				continue;
+			unsigned char jmp_next = pos - i - 1;
+			unsigned char jmp_trace = pos - i - 2;
+			unsigned char jmp_allow = pos - i - 3;
+			replace_jmp_placeholders(&filter[i].jt, jmp_next,
+						 jmp_trace, jmp_allow);
+			replace_jmp_placeholders(&filter[i].jf, jmp_next,
+						 jmp_trace, jmp_allow);
+			if (BPF_OP(filter[i].code) == BPF_JA)
+				filter[i].k = (unsigned int) jmp_next;
+		}
+	}
+
+# if SUPPORTED_PERSONALITIES > 1
+	SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K, SECCOMP_RET_TRACE);
+# endif
+
+	return pos;
+}
+
+/* Offset of the lower or the upper half of the argument in seccomp_data.  */
+static unsigned int
+arg_offset(const unsigned int arg, const bool upper)
+{
+	return offsetof(struct seccomp_data, args) + arg * sizeof(uint64_t)
+# ifdef WORDS_BIGENDIAN
+		+ (upper ? 0 : sizeof(uint32_t));
+# else
+		+ (upper ? sizeof(uint32_t) : 0);
+# endif
+}
+
+/*
+ * Emit the check of a predicate on the argument loaded from the given half,
+ * which jumps to next if the predicate holds and to allow if it does not.
+ * If the upper half is to be checked as well (last is false), the check of
+ * the lower half falls through to it instead where the result still depends
+ * on the upper half.
+ */
+static unsigned short
+bpf_arg_pred_cmp(struct sock_filter *filter, const struct arg_pred *pred,
+		 const uint32_t val, const bool upper, const bool last)
+{
+	SET_BPF_STMT(filter, BPF_LD | BPF_W | BPF_ABS,
+		     arg_offset(pred->arg, upper));
+	if (pred->mask) {
+		/* if (arg & val) goto next; */
+		SET_BPF_JUMP(filter + 1, BPF_JSET | BPF_K, val,
+			     JMP_PLACEHOLDER_NEXT,
+			     last ? JMP_PLACEHOLDER_ALLOW : 0);
+	} else {
+		/* if (arg != val) return RET_ALLOW; */
+		SET_BPF_JUMP(filter + 1, BPF_JEQ | BPF_K, val,
+			     last ? JMP_PLACEHOLDER_NEXT : 0,
+			     JMP_PLACEHOLDER_ALLOW);
+	}
+	return 2;
+}
+
+/*
+ * Generated program looks like:
+ * if (arch == AUDIT_ARCH_A && nr == 1) {
+ *	if (args[0] != 5)
+ *		return SECCOMP_RET_ALLOW;
+ *	return SECCOMP_RET_TRACE;
+ * }
+ * ...
+ * and is followed by the program of a filter generator.  The syscalls
+ * that stop the tracees regardless of -e trace are not checked here.
+ */
+/*
+ * Return the predicates of a syscall that are checked by arg_filter:
+ * the syscalls that stop the tracees regardless of -e trace are not.
+ */
+static const struct arg_preds *
+filter_arg_preds(const unsigned int nr, const unsigned int p)
+{
+	if (!arg_preds_vec[p] || !arg_preds_vec[p][nr] ||
+	    always_traced_by_seccomp(nr, p) ||
+	    !is_number_in_set_array(nr, trace_set, p))
+		return NULL;
+
+	return arg_preds_vec[p][nr];
+}
+
+static unsigned short
+arg_filter_generator(struct sock_filter *filter, bool *overflow)
+{
+	static const unsigned int klongsize[SUPPORTED_PERSONALITIES] = {
+		PERSONALITY0_KLONGSIZE,
+# if SUPPORTED_PERSONALITIES > 1
+		PERSONALITY1_KLONGSIZE,
+# endif
+# if SUPPORTED_PERSONALITIES > 2
+		PERSONALITY2_KLONGSIZE,
+# endif
+	};
+	/* The longest check of one syscall.  */
+	const unsigned short max_len = 4 + 4 * MAX_ARG_PREDS + 2;
+	unsigned short pos = 0;
+
+	for (int p = SUPPORTED_PERSONALITIES - 1; p >= 0; --p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			const struct arg_preds *const preds =
+				filter_arg_preds(i, p);
+
+			if (!preds)
+				continue;
+
+			if ((unsigned int) (pos + max_len) > ARRAY_SIZE(arg_filter)) {
+				*overflow = true;
+				return pos;
+			}
+
+			unsigned short start = pos;
+			/* Jumps in the sections to the next predicate.  */
+			unsigned short ends[MAX_ARG_PREDS];
+
+# if SUPPORTED_PERSONALITIES > 1
+			SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+				     offsetof(struct seccomp_data, arch));
+			SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K,
+				     audit_arch_vec[p].arch,
+				     0, JMP_PLACEHOLDER_NEXT);
+# endif
+			SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+				     offsetof(struct seccomp_data, nr));
+			SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K,
+				     i | audit_arch_vec[p].flag,
+				     0, JMP_PLACEHOLDER_NEXT);
+			const unsigned short body = pos;
+
+			for (unsigned int j = 0; j < preds->count; ++j) {
+				const struct arg_pred *pred = &preds->pred[j];
+				const uint64_t val = pred->val;
+				const bool wide = pred->wide && klongsize[p] > 4;
+
+				pos += bpf_arg_pred_cmp(&filter[pos], pred,
+							val, false, !wide);
+				if (wide)
+					pos += bpf_arg_pred_cmp(&filter[pos],
+								pred,
+								val >> 32,
+								true, true);
+				ends[j] = pos;
+			}
+
+			SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K,
+				     SECCOMP_RET_TRACE);
+			SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K,
+				     SECCOMP_RET_ALLOW);
+
+			/*
+			 * In the header, "next" is the next syscall section,
+			 * in the body, it is the next predicate.
+			 */
+			for (unsigned int k = start; k + 2 < pos; ++k) {
+				if (BPF_CLASS(filter[k].code) != BPF_JMP)
+					continue;
+
+				unsigned short next = pos;
+
+				if (k >= body) {
+					for (unsigned int j = 0;
+					     j < preds->count; ++j) {
+						if (ends[j] > k) {
+							next = ends[j];
+							break;
+						}
+					}
+				}
+
+				unsigned char jmp_next = next - k - 1;
+				unsigned char jmp_allow = pos - k - 2;
+
+				replace_jmp_placeholders(&filter[k].jt,
+							 jmp_next, 0,
+							 jmp_allow);
+				replace_jmp_placeholders(&filter[k].jf,
+							 jmp_next, 0,
+							 jmp_allow);
+			}
+		}
+	}
+
+	return pos;
+}
+
+/*
+ * Run the program on the seccomp_data of a syscall the way the kernel does,
+ * store its return value to *ret and return the number of instructions
+ * executed, or 0 if the program uses an instruction not supported here.
+ */
+static unsigned int
+bpf_run(const struct sock_filter *filter, const unsigned short len,
+	const struct seccomp_data *data, uint32_t *ret)
+{
+	uint32_t a = 0, x = 0;
+	unsigned int steps = 0;
+
+	for (unsigned int pc = 0; pc < len; ++pc) {
+		const struct sock_filter *insn = &filter[pc];
+
+		++steps;
+		switch (insn->code) {
+		case BPF_LD | BPF_W | BPF_ABS:
+			if (insn->k > sizeof(*data) - sizeof(a))
+				return 0;
+			memcpy(&a, (const char *) data + insn->k, sizeof(a));
+			break;
+		case BPF_LD | BPF_W | BPF_IMM:
+			a = insn->k;
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			a &= insn->k;
+			break;
+		case BPF_ALU | BPF_RSH | BPF_K:
+			a = insn->k < 32 ? a >> insn->k : 0;
+			break;
+		case BPF_ALU | BPF_LSH | BPF_X:
+			a = x < 32 ? a << x : 0;
+			break;
+		case BPF_MISC | BPF_TAX:
+			x = a;
+			break;
+		case BPF_MISC | BPF_TXA:
+			a = x;
+			break;
+		case BPF_JMP | BPF_JA:
+			pc += insn->k;
+			break;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+			pc += a == insn->k ? insn->jt : insn->jf;
+			break;
+		case BPF_JMP | BPF_JGE | BPF_K:
+			pc += a >= insn->k ? insn->jt : insn->jf;
+			break;
+		case BPF_JMP | BPF_JSET | BPF_K:
+			pc += a & insn->k ? insn->jt : insn->jf;
+			break;
+		case BPF_RET | BPF_K:
+			*ret = insn->k;
+			return steps;
+		default:
+			return 0;
+		}
+	}
+
+	/* Fell off the end of the program.  */
+	return 0;
+}
+
+/*
+ * Run the program on every syscall and store the average number
+ * of instructions it executes per syscall, weighted by syscall_weights,
+ * in hundredths, to *cost.  With check_verdicts, the program is also
+ * checked to stop exactly the syscalls that traced_by_seccomp.
+ * Return false if the program does not work as intended.
+ */
+static bool
+bpf_prog_cost(const struct sock_filter *filter, const unsigned short len,
+	      const bool check_verdicts, uint64_t *cost)
+{
+	uint64_t steps = 0, total = 0;
+
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			const uint64_t weight = syscall_weights[p][i];
+
+			if (!weight)
+				continue;
+
+			const struct seccomp_data data = {
+				.nr = i | audit_arch_vec[p].flag,
+				.arch = audit_arch_vec[p].arch,
+			};
+			uint32_t ret;
+			const unsigned int n = bpf_run(filter, len, &data, &ret);
+
+			if (!n)
+				return false;
+			if (check_verdicts &&
+			    (ret == SECCOMP_RET_TRACE) != traced_by_seccomp(i, p))
+				return false;
+
+			steps += weight * n;
+			total += weight;
+		}
 	}
 
+	*cost = total ? steps * 100 / total : 0;
+	return true;
+}
+
+/*
+ * Generate the programs with the first arg_filter_len insns of arg_filter
+ * and pick the one that executes the fewest instructions on average.
+ */
+static bool
+generate_seccomp_program_with(const unsigned short arg_filter_len)
+{
+	unsigned short min_len = USHRT_MAX;
+	uint64_t min_cost = UINT64_MAX;
+	const char *name = NULL;
+
+	bpf_prog.len = USHRT_MAX;
+	bpf_prog.filter = NULL;
+	init_syscall_weights();
+
 	for (unsigned int i = 0; i < ARRAY_SIZE(filter_generators); ++i) {
 		bool overflow = false;
-		unsigned short len = filter_generators[i](filters[i],
-							  &overflow);
-		if (len < bpf_prog.len && !overflow) {
+		uint64_t cost;
+
+		memcpy(filters[i], arg_filter,
+		       arg_filter_len * sizeof(arg_filter[0]));
+
+		unsigned short len = arg_filter_len +
+			filter_generators[i].gen(filters[i] + arg_filter_len,
+						 &overflow);
+		if (overflow) {
+			debug_msg("seccomp filter generator %s: jump offset"
+				  " overflow", filter_generators[i].name);
+			continue;
+		}
+		if (len < min_len)
+			min_len = len;
+		if (len > BPF_MAXINSNS) {
+			debug_msg("seccomp filter generator %s: %u instructions",
+				  filter_generators[i].name, len);
+			continue;
+		}
+		if (!bpf_prog_cost(filters[i], len, !arg_filter_len, &cost)) {
+			/* Cannot happen.  */
+			error_msg("seccomp filter generator %s: invalid"
+				  " program", filter_generators[i].name);
+			continue;
+		}
+		debug_msg("seccomp filter generator %s: %u instructions,"
+			  " %" PRIu64 ".%02u executed per syscall on average",
+			  filter_generators[i].name, len, cost / 100,
+			  (unsigned int) (cost % 100));
+		if (cost < min_cost ||
+		    (cost == min_cost && len < bpf_prog.len)) {
+			min_cost = cost;
 			bpf_prog.len = len;
 			bpf_prog.filter = filters[i];
+			name = filter_generators[i].name;
 		}
 	}
-	if (bpf_prog.len == USHRT_MAX) {
+	if (name) {
+		debug_msg("seccomp filter generator %s selected", name);
+		return true;
+	}
+	if (min_len == USHRT_MAX) {
 		debug_msg("seccomp filter disabled due to jump offset "
 			  "overflow");
-		seccomp_filtering = false;
-	} else if (bpf_prog.len > BPF_MAXINSNS) {
-		debug_msg("seccomp filter disabled due to BPF program "
-			  "being oversized (%u > %d)", bpf_prog.len,
-			  BPF_MAXINSNS);
-		seccomp_filtering = false;
+		return false;
+	}
+	debug_msg("seccomp filter disabled due to BPF program "
+		  "being oversized (%u > %d)", min_len, BPF_MAXINSNS);
+	return false;
+}
+
+/*
+ * Pick the fastest of the generated BPF programs, if any is usable.
+ * The arguments of the syscalls are checked by the program if it fits,
+ * otherwise only by strace after the stop.
+ */
+static bool
+generate_seccomp_program(void)
+{
+	bool overflow = false;
+	unsigned short len = arg_filter_generator(arg_filter, &overflow);
+
+	if (overflow) {
+		debug_msg("seccomp filter does not check syscall arguments"
+			  " as there are too many syscalls to check");
+	} else if (len) {
+		arg_filter_used = generate_seccomp_program_with(len);
+		if (arg_filter_used)
+			return true;
+		debug_msg("seccomp filter does not check syscall arguments"
+			  " as the program would be too large");
 	}
 
+	return generate_seccomp_program_with(0);
+}
+
+static void
+check_seccomp_filter_properties(void)
+{
+	int rc = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, NULL, 0, 0);
+	seccomp_filtering = rc < 0 && errno != EINVAL;
+	if (!seccomp_filtering) {
+		debug_func_perror_msg("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER)");
+		return;
+	}
+
+	seccomp_filtering = generate_seccomp_program();
+
 	if (seccomp_filtering)
 		check_seccomp_order();
+
+	if (!seccomp_filtering)
+		return;
+
+	filter_stop_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	filter_arg_check_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (traced_by_seccomp(i, p))
+				add_number_to_set_array(i, filter_stop_set, p);
+			if (arg_filter_used && filter_arg_preds(i, p))
+				add_number_to_set_array(i, filter_arg_check_set,
+							p);
+		}
+	}
 }
 
 static void
@@ -644,6 +1423,19 @@ dump_seccomp_bpf(void)
 				error_msg("STMT(BPF_LDWABS, data->nr)");
 				break;
 			default:
+				if (filter[i].k >=
+				    offsetof(struct seccomp_data, args)) {
+					const unsigned int arg =
+						(filter[i].k - offsetof(struct
+							seccomp_data, args))
+						/ sizeof(uint64_t);
+					error_msg("STMT(BPF_LDWABS,"
+						  " data->args[%u].%s)", arg,
+						  filter[i].k ==
+						  arg_offset(arg, true)
+						  ? "hi" : "lo");
+					break;
+				}
 				error_msg("STMT(BPF_LDWABS, 0x%x)",
 					  filter[i].k);
 			}
@@ -659,6 +1451,11 @@ dump_seccomp_bpf(void)
 			case SECCOMP_RET_ALLOW:
 				error_msg("STMT(BPF_RET, SECCOMP_RET_ALLOW)");
 				break;
+# ifdef SECCOMP_RET_USER_NOTIF
+			case SECCOMP_RET_USER_NOTIF:
+				error_msg("STMT(BPF_RET, SECCOMP_RET_USER_NOTIF)");
+				break;
+# endif
 			default:
 				error_msg("STMT(BPF_RET, 0x%x)", filter[i].k);
 			}
@@ -716,6 +1513,142 @@ init_seccomp_filter(void)
 		perror_func_msg_and_die("prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER)");
 }
 
+# if defined SECCOMP_FILTER_FLAG_NEW_LISTENER && defined __NR_futex
+
+#  define XLAT_MACROS_ONLY
+#   include "xlat/futexops.h"
+#  undef XLAT_MACROS_ONLY
+
+/*
+ * Emit the check that lets FUTEX_WAKE on wake_addr through:
+ *
+ * if (arch == PERSONALITY0_AUDIT_ARCH && nr == __NR_futex
+ *     && args[1] == FUTEX_WAKE && args[0] == wake_addr)
+ *	return SECCOMP_RET_ALLOW;
+ */
+static unsigned short
+futex_wake_filter(struct sock_filter *filter, const void *const wake_addr)
+{
+	const uint64_t addr = (uintptr_t) wake_addr;
+	unsigned short pos = 0;
+
+#  if SUPPORTED_PERSONALITIES > 1
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     offsetof(struct seccomp_data, arch));
+	SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K,
+		     audit_arch_vec[0].arch, 0, 9);
+#  endif
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     offsetof(struct seccomp_data, nr));
+	SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K, __NR_futex, 0, 7);
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     arg_offset(1, false));
+	SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K, FUTEX_WAKE, 0, 5);
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     arg_offset(0, false));
+	SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K, (uint32_t) addr, 0, 3);
+	SET_BPF_STMT(&filter[pos++], BPF_LD | BPF_W | BPF_ABS,
+		     arg_offset(0, true));
+	SET_BPF_JUMP(&filter[pos++], BPF_JEQ | BPF_K, addr >> 32, 0, 1);
+	SET_BPF_STMT(&filter[pos++], BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+	return pos;
+}
+
+/*
+ * The program for --seccomp-notify is the one for --seccomp-bpf
+ * with SECCOMP_RET_USER_NOTIF in place of SECCOMP_RET_TRACE,
+ * preceded by the check that lets the child wake strace with FUTEX_WAKE
+ * on wake_addr once it has installed the filter, see seccomp_notify.c.
+ */
+bool
+check_seccomp_notify_filter(const void *const wake_addr)
+{
+	if (!generate_seccomp_program())
+		return false;
+
+	for (unsigned int i = 0; i < bpf_prog.len; ++i) {
+		if (bpf_prog.filter[i].code == (BPF_RET | BPF_K)
+		    && bpf_prog.filter[i].k == SECCOMP_RET_TRACE)
+			bpf_prog.filter[i].k = SECCOMP_RET_USER_NOTIF;
+	}
+
+	struct sock_filter wake_filter[16];
+	const unsigned short wake_len =
+		futex_wake_filter(wake_filter, wake_addr);
+
+	if (bpf_prog.len + wake_len > BPF_MAXINSNS) {
+		debug_msg("seccomp filter for --seccomp-notify: %u"
+			  " instructions", bpf_prog.len + wake_len);
+		return false;
+	}
+
+	/* Every filters[] has room for 2 * BPF_MAXINSNS instructions.  */
+	memmove(bpf_prog.filter + wake_len, bpf_prog.filter,
+		bpf_prog.len * sizeof(bpf_prog.filter[0]));
+	memcpy(bpf_prog.filter, wake_filter,
+	       wake_len * sizeof(bpf_prog.filter[0]));
+	bpf_prog.len += wake_len;
+
+	return true;
+}
+
+/* Return the personality of a syscall from its seccomp_data.  */
+unsigned int
+seccomp_data_personality(const unsigned int arch, const unsigned int nr)
+{
+#  if SUPPORTED_PERSONALITIES > 1
+	/* In the order of the filter, see linear_filter_generator.  */
+	for (unsigned int p = SUPPORTED_PERSONALITIES - 1; p > 0; --p) {
+		if (arch == audit_arch_vec[p].arch
+		    && (nr & audit_arch_vec[p].flag) == audit_arch_vec[p].flag)
+			return p;
+	}
+#  endif
+	return 0;
+}
+
+/* Install the --seccomp-notify filter, return its listener fd.  */
+int
+init_seccomp_notify_filter(void)
+{
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+		perror_func_msg_and_die("prctl(PR_SET_NO_NEW_PRIVS)");
+
+	if (debug_flag)
+		dump_seccomp_bpf();
+
+	int fd = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+			 SECCOMP_FILTER_FLAG_NEW_LISTENER, &bpf_prog);
+	if (fd < 0)
+		perror_func_msg_and_die("seccomp(SECCOMP_SET_MODE_FILTER"
+					", SECCOMP_FILTER_FLAG_NEW_LISTENER)");
+
+	return fd;
+}
+
+# else /* !SECCOMP_FILTER_FLAG_NEW_LISTENER || !__NR_futex */
+
+bool
+check_seccomp_notify_filter(const void *const wake_addr)
+{
+	return false;
+}
+
+int
+init_seccomp_notify_filter(void)
+{
+	return -1;
+}
+
+unsigned int
+seccomp_data_personality(const unsigned int arch, const unsigned int nr)
+{
+	return 0;
+}
+
+# endif
+
 int
 seccomp_filter_restart_operator(const struct tcb *tcp)
 {
@@ -735,6 +1668,24 @@ check_seccomp_filter_properties(void)
 	seccomp_filtering = false;
 }
 
+bool
+check_seccomp_notify_filter(const void *const wake_addr)
+{
+	return false;
+}
+
+int
+init_seccomp_notify_filter(void)
+{
+	return -1;
+}
+
+unsigned int
+seccomp_data_personality(const unsigned int arch, const unsigned int nr)
+{
+	return 0;
+}
+
 void
 init_seccomp_filter(void)
 {
@@ -766,3 +1717,48 @@ check_seccomp_filter(void)
 	if (!seccomp_filtering)
 		error_msg("seccomp filter is requested but unavailable");
 }
+
+/*
+ * Return the name of a syscall from SET that would not stop the tracees
+ * under the installed seccomp filter, or NULL if there is no such syscall.
+ */
+const char *
+seccomp_filter_missing_syscall(const struct number_set *const set)
+{
+	if (!seccomp_filtering || !filter_stop_set)
+		return NULL;
+
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (sysent_vec[p][i].sys_name
+			    && is_number_in_set_array(i, set, p)
+			    && !is_number_in_set_array(i, filter_stop_set, p))
+				return sysent_vec[p][i].sys_name;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the name of a syscall from SET whose arguments are checked
+ * by the installed seccomp filter, or NULL if there is no such syscall.
+ */
+const char *
+seccomp_filter_arg_checked_syscall(const struct number_set *const set)
+{
+	if (!seccomp_filtering || !filter_arg_check_set)
+		return NULL;
+
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (sysent_vec[p][i].sys_name
+			    && is_number_in_set_array(i, set, p)
+			    && is_number_in_set_array(i, filter_arg_check_set,
+						      p))
+				return sysent_vec[p][i].sys_name;
+		}
+	}
+
+	return NULL;
+}
@@ -13,9 +13,28 @@
 
 extern bool seccomp_filtering;
 extern bool seccomp_before_sysentry;
+extern const char *seccomp_profile_path;
 
 extern void check_seccomp_filter(void);
 extern void init_seccomp_filter(void);
 extern int seccomp_filter_restart_operator(const struct tcb *);
 
+extern bool check_seccomp_notify_filter(const void *wake_addr);
+extern int init_seccomp_notify_filter(void);
+extern unsigned int seccomp_data_personality(unsigned int arch,
+					     unsigned int nr);
+
+extern bool seccomp_notify;
+extern void seccomp_notify_prepare(void);
+extern void seccomp_notify_install(void);
+extern int seccomp_notify_listen(int pid);
+extern int seccomp_notify_next(int fd, struct tcb *(*get_tcb)(int pid),
+			       void (*drop_tcb)(struct tcb *),
+			       void (*forget_group)(int tgid, bool exited));
+extern bool seccomp_notify_id_valid(void);
+
+struct number_set;
+extern const char *seccomp_filter_missing_syscall(const struct number_set *);
+extern const char *seccomp_filter_arg_checked_syscall(const struct number_set *);
+
 #endif /* !STRACE_SECCOMP_FILTER_H */
@@ -0,0 +1,155 @@
+/*
+ * Flight recorder (--flight-recorder option): the last N lines of syscall
+ * output of every tracee are kept in memory and written to the log
+ * only when a trigger fires.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "list.h"
+#include "number_set.h"
+
+struct flight_entry {
+	uint64_t seq;		/* global order of recording */
+	char *output;
+};
+
+/* Per-tcb ring of the most recent syscall output */
+struct flight_ring {
+	struct list_item list;
+	FILE *outf;		/* real output file of the tcb */
+	size_t next;		/* where the next entry is going to be stored */
+	size_t used;
+	struct flight_entry entries[];
+};
+
+static EMPTY_LIST(rings);
+static uint64_t flight_seq;
+static size_t flight_bytes;	/* total size of the recorded output */
+
+void
+flight_recorder_add(struct tcb *tcp, char *output)
+{
+	struct flight_ring *r = tcp->flight_ring;
+
+	if (!r) {
+		r = xzalloc(sizeof(*r) +
+			    flight_recorder_size * sizeof(r->entries[0]));
+		list_append(&rings, &r->list);
+		tcp->flight_ring = r;
+	}
+
+	struct flight_entry *const e = &r->entries[r->next];
+
+	if (e->output)
+		flight_bytes -= strlen(e->output);
+	free(e->output);
+	e->seq = flight_seq++;
+	e->output = output;
+	flight_bytes += strlen(output);
+
+	r->outf = tcp->outf;
+	r->next = (r->next + 1) % flight_recorder_size;
+	if (r->used < flight_recorder_size)
+		r->used++;
+}
+
+static void
+flight_ring_clear(struct flight_ring *r)
+{
+	for (size_t i = 0; i < flight_recorder_size; ++i) {
+		if (r->entries[i].output)
+			flight_bytes -= strlen(r->entries[i].output);
+		free(r->entries[i].output);
+		r->entries[i].output = NULL;
+	}
+
+	r->next = r->used = 0;
+}
+
+void
+flight_recorder_drop(struct tcb *tcp)
+{
+	struct flight_ring *r = tcp->flight_ring;
+
+	if (!r)
+		return;
+
+	flight_ring_clear(r);
+	list_remove(&r->list);
+	free(r);
+	tcp->flight_ring = NULL;
+}
+
+size_t
+flight_recorder_output_size(void)
+{
+	return flight_bytes;
+}
+
+bool
+flight_recorder_is_trigger(struct tcb *tcp)
+{
+	return syserror(tcp)
+	       && is_number_in_set(tcp->u_error, dump_errno_set)
+	       && is_number_in_set_array(tcp->scno, dump_syscall_set,
+					 current_personality);
+}
+
+struct flight_ref {
+	const struct flight_entry *entry;
+	FILE *outf;
+};
+
+static int
+flight_ref_cmp(const void *a, const void *b)
+{
+	const uint64_t sa = ((const struct flight_ref *) a)->entry->seq;
+	const uint64_t sb = ((const struct flight_ref *) b)->entry->seq;
+
+	return (sa > sb) - (sa < sb);
+}
+
+/*
+ * Write the contents of all rings in the order the syscalls have been
+ * recorded, and empty the rings.
+ */
+void
+flight_recorder_dump(const char *reason)
+{
+	struct flight_ring *r;
+	size_t total = 0;
+
+	list_foreach(r, &rings, list)
+		total += r->used;
+
+	debug_msg("flight recorder dump on %s: %zu lines", reason, total);
+
+	if (!total)
+		return;
+
+	struct flight_ref *refs = xcalloc(total, sizeof(*refs));
+	size_t n = 0;
+
+	list_foreach(r, &rings, list) {
+		for (size_t i = 0; i < r->used; ++i) {
+			refs[n].entry = &r->entries[i];
+			refs[n].outf = r->outf;
+			++n;
+		}
+	}
+
+	qsort(refs, n, sizeof(*refs), flight_ref_cmp);
+
+	for (size_t i = 0; i < n; ++i)
+		fputs_unlocked(refs[i].entry->output, refs[i].outf);
+
+	free(refs);
+
+	list_foreach(r, &rings, list)
+		flight_ring_clear(r);
+}
@@ -0,0 +1,478 @@
+/*
+ * Per file descriptor I/O accounting (--summary-io).
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include "msghdr.h"
+#include "syscall.h"
+
+/*
+ * Per (tgid, fd, path) I/O stats structure.  The descriptors are shared
+ * by the threads of a process, so the stats are kept per process.
+ */
+struct io_counts {
+	int pid;		/* thread group id */
+	int fd;
+	bool closed;		/* fd has been closed since the last lookup */
+	unsigned int gen;	/* io_proc.gen at the time of the lookup */
+	char *path;
+	struct timespec time;	/* wall clock time spent in syscalls */
+	uint64_t calls, errors;
+	uint64_t bytes_read, bytes_written;
+};
+
+static struct io_counts *rows;
+static size_t nrows;
+static size_t rows_size;
+
+/* The calls are counted once in the total, transfers between fds too.  */
+static struct io_counts total;
+
+/*
+ * The generation of the descriptor table of a process, it is bumped
+ * when any of its fds may have been replaced without a close or dup2
+ * seen by strace: on execve (close-on-exec), close_range, receiving
+ * of fds over a socket, and exit of the process.
+ * The rows of older generations are resolved again on their next use.
+ */
+struct io_proc {
+	int tgid;
+	unsigned int gen;
+};
+
+static struct io_proc *procs;
+static size_t procs_size;
+static size_t procs_used;
+
+/*
+ * Open addressing hash table that maps (pid, fd) to the index
+ * of the most recent row for this pair (plus one, zero means unused).
+ * Entries are never removed, a closed fd is marked in its row instead.
+ */
+static uint32_t *fd_hash;
+static size_t fd_hash_size;
+static size_t fd_hash_used;
+
+/* Fibonacci hashing, the table size is a power of 2 */
+static size_t
+hash_slot(const uint64_t key, const size_t size)
+{
+	return (key * 0x9e3779b97f4a7c15ULL) >> 32 & (size - 1);
+}
+
+static size_t
+fd_hash_slot(const int pid, const int fd)
+{
+	return hash_slot(((uint64_t) (unsigned int) pid << 32)
+			 | (unsigned int) fd, fd_hash_size);
+}
+
+static uint32_t *
+fd_hash_lookup(const int pid, const int fd)
+{
+	for (size_t i = fd_hash_slot(pid, fd);; i = (i + 1) & (fd_hash_size - 1)) {
+		uint32_t *const slot = &fd_hash[i];
+
+		if (!*slot)
+			return slot;
+		if (rows[*slot - 1].pid == pid && rows[*slot - 1].fd == fd)
+			return slot;
+	}
+}
+
+static void
+fd_hash_grow(void)
+{
+	uint32_t *const old_hash = fd_hash;
+	const size_t old_size = fd_hash_size;
+
+	fd_hash_size = old_size ? old_size * 2 : 256;
+	fd_hash = xcalloc(fd_hash_size, sizeof(*fd_hash));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old_hash[i]) {
+			const struct io_counts *const r = &rows[old_hash[i] - 1];
+			*fd_hash_lookup(r->pid, r->fd) = old_hash[i];
+		}
+	}
+
+	free(old_hash);
+}
+
+static struct io_proc *
+proc_lookup(const int tgid)
+{
+	for (size_t i = hash_slot((unsigned int) tgid, procs_size);;
+	     i = (i + 1) & (procs_size - 1)) {
+		struct io_proc *const p = &procs[i];
+
+		if (!p->tgid || p->tgid == tgid)
+			return p;
+	}
+}
+
+static void
+procs_grow(void)
+{
+	struct io_proc *const old_procs = procs;
+	const size_t old_size = procs_size;
+
+	procs_size = old_size ? old_size * 2 : 64;
+	procs = xcalloc(procs_size, sizeof(*procs));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old_procs[i].tgid)
+			*proc_lookup(old_procs[i].tgid) = old_procs[i];
+	}
+
+	free(old_procs);
+}
+
+static struct io_proc *
+get_io_proc(const int tgid)
+{
+	if (procs_used * 2 >= procs_size)
+		procs_grow();
+
+	struct io_proc *const p = proc_lookup(tgid);
+
+	if (!p->tgid) {
+		p->tgid = tgid;
+		procs_used++;
+	}
+
+	return p;
+}
+
+static int
+get_tgid(struct tcb *tcp)
+{
+	if (!tcp->tgid) {
+		const int tgid = get_proc_tgid(tcp->pid);
+
+		tcp->tgid = tgid > 0 ? tgid : tcp->pid;
+	}
+
+	return tcp->tgid;
+}
+
+/*
+ * Resolve fd to a string describing it: the path it refers to,
+ * or protocol details for sockets if they are available.
+ */
+static char *
+resolve_fd(struct tcb *tcp, const int fd)
+{
+	char path[PATH_MAX + 1];
+
+	if (getfdpath(tcp, fd, path, sizeof(path)) < 0)
+		return xstrdup("?");
+
+	const char *str = STR_STRIP_PREFIX(path, "socket:[");
+	if (str != path) {
+		const unsigned long inode = strtoul(str, NULL, 10);
+		const char *details =
+			inode ? get_sockaddr_by_inode(tcp, fd, inode) : NULL;
+
+		if (details)
+			return xstrdup(details);
+	}
+
+	return xstrdup(path);
+}
+
+static struct io_counts *
+get_io_counts(struct tcb *tcp, const int fd)
+{
+	if (fd_hash_used * 2 >= fd_hash_size)
+		fd_hash_grow();
+
+	const int tgid = get_tgid(tcp);
+	const unsigned int gen = get_io_proc(tgid)->gen;
+	uint32_t *const slot = fd_hash_lookup(tgid, fd);
+
+	if (*slot && !rows[*slot - 1].closed && rows[*slot - 1].gen == gen)
+		return &rows[*slot - 1];
+
+	char *path = resolve_fd(tcp, fd);
+
+	if (*slot) {
+		struct io_counts *const r = &rows[*slot - 1];
+
+		/* The same file is reopened with the same fd.  */
+		if (!strcmp(r->path, path)) {
+			free(path);
+			r->closed = false;
+			r->gen = gen;
+			return r;
+		}
+	} else {
+		fd_hash_used++;
+	}
+
+	if (nrows >= rows_size)
+		rows = xgrowarray(rows, &rows_size, sizeof(*rows));
+
+	struct io_counts *const r = &rows[nrows++];
+	memset(r, 0, sizeof(*r));
+	r->pid = tgid;
+	r->fd = fd;
+	r->gen = gen;
+	r->path = path;
+	*slot = nrows;
+
+	return r;
+}
+
+static void
+forget_fd(struct tcb *tcp, const int fd)
+{
+	if (!fd_hash_size || fd < 0)
+		return;
+
+	const uint32_t *const slot = fd_hash_lookup(get_tgid(tcp), fd);
+
+	if (*slot)
+		rows[*slot - 1].closed = true;
+}
+
+static void
+forget_fds(struct tcb *tcp)
+{
+	if (procs_size)
+		get_io_proc(get_tgid(tcp))->gen++;
+}
+
+/* The process is gone, its pid may be reused by another process.  */
+void
+io_summary_forget_pid(const int pid)
+{
+	if (!procs_size)
+		return;
+
+	struct io_proc *const p = proc_lookup(pid);
+
+	if (p->tgid)
+		p->gen++;
+}
+
+static bool
+account_io(struct io_counts *r, struct tcb *tcp,
+	   const kernel_ulong_t fd_arg, const struct timespec *wts,
+	   const bool reading, const bool bytes)
+{
+	const int fd = fd_arg;
+
+	if (fd < 0)
+		return false;
+
+	if (!r)
+		r = get_io_counts(tcp, fd);
+
+	r->calls++;
+	ts_add(&r->time, &r->time, wts);
+
+	if (syserror(tcp)) {
+		r->errors++;
+		return true;
+	}
+
+	if (!bytes || tcp->u_rval <= 0)
+		return true;
+
+	if (reading)
+		r->bytes_read += tcp->u_rval;
+	else
+		r->bytes_written += tcp->u_rval;
+
+	return true;
+}
+
+/* I/O on a single fd.  */
+static void
+account_fd(struct tcb *tcp, const kernel_ulong_t fd,
+	   const struct timespec *wts, const bool reading, const bool bytes)
+{
+	if (account_io(NULL, tcp, fd, wts, reading, bytes))
+		account_io(&total, tcp, fd, wts, reading, bytes);
+}
+
+/*
+ * A transfer from in_fd to out_fd, it is accounted for both of them,
+ * but the total counts the call once and its bytes as written only.
+ */
+static void
+account_transfer(struct tcb *tcp, const kernel_ulong_t in_fd,
+		 const kernel_ulong_t out_fd, const struct timespec *wts)
+{
+	const bool in = account_io(NULL, tcp, in_fd, wts, true, true);
+	const bool out = account_io(NULL, tcp, out_fd, wts, false, true);
+
+	if (in || out)
+		account_io(&total, tcp, 0, wts, false, true);
+}
+
+/* Have any fds been received with SCM_RIGHTS?  */
+static bool
+received_control(struct tcb *tcp, const kernel_ulong_t addr)
+{
+	struct msghdr msg;
+
+	return !syserror(tcp) && fetch_struct_msghdr(tcp, addr, &msg)
+	       && msg.msg_controllen;
+}
+
+void
+count_io_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
+{
+	struct timespec wts;
+	const kernel_ulong_t *const args = tcp->u_arg;
+
+	ts_sub(&wts, syscall_exiting_ts, &tcp->etime);
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_read:
+	case SEN_pread:
+	case SEN_readv:
+	case SEN_preadv:
+	case SEN_preadv2:
+	case SEN_recv:
+	case SEN_recvfrom:
+		account_fd(tcp, args[0], &wts, true, true);
+		break;
+	case SEN_recvmsg:
+		account_fd(tcp, args[0], &wts, true, true);
+		if (received_control(tcp, args[1]))
+			forget_fds(tcp);
+		break;
+	case SEN_recvmmsg:
+	case SEN_recvmmsg_time32:
+	case SEN_recvmmsg_time64:
+		/* The return value is the number of messages.  */
+		account_fd(tcp, args[0], &wts, true, false);
+		/* The control data of every message is not worth reading.  */
+		if (!syserror(tcp) && tcp->u_rval > 0)
+			forget_fds(tcp);
+		break;
+	case SEN_write:
+	case SEN_pwrite:
+	case SEN_writev:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_vmsplice:
+	case SEN_send:
+	case SEN_sendto:
+	case SEN_sendmsg:
+		account_fd(tcp, args[0], &wts, false, true);
+		break;
+	case SEN_sendmmsg:
+		account_fd(tcp, args[0], &wts, false, false);
+		break;
+	case SEN_sendfile:
+	case SEN_sendfile64:
+		/* sendfile(out_fd, in_fd, ...) */
+		account_transfer(tcp, args[1], args[0], &wts);
+		break;
+	case SEN_tee:
+		/* tee(fd_in, fd_out, ...) */
+		account_transfer(tcp, args[0], args[1], &wts);
+		break;
+	case SEN_splice:
+	case SEN_copy_file_range:
+		/* splice(fd_in, off_in, fd_out, ...) */
+		account_transfer(tcp, args[0], args[2], &wts);
+		break;
+	case SEN_close:
+		if (!syserror(tcp))
+			forget_fd(tcp, args[0]);
+		break;
+	case SEN_dup2:
+	case SEN_dup3:
+		if (!syserror(tcp))
+			forget_fd(tcp, args[1]);
+		break;
+	/* A new fd replaces the one that has been closed unnoticed.  */
+	case SEN_dup:
+	case SEN_pidfd_getfd:
+		if (!syserror(tcp))
+			forget_fd(tcp, tcp->u_rval);
+		break;
+	case SEN_fcntl:
+	case SEN_fcntl64:
+		if (!syserror(tcp) && (args[1] == F_DUPFD
+				       || args[1] == F_DUPFD_CLOEXEC))
+			forget_fd(tcp, tcp->u_rval);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_close_range:
+		if (!syserror(tcp))
+			forget_fds(tcp);
+		break;
+	}
+}
+
+static int
+io_counts_cmp(const void *a, const void *b)
+{
+	const struct io_counts *const ra = *(const struct io_counts **) a;
+	const struct io_counts *const rb = *(const struct io_counts **) b;
+	const int rc = ts_cmp(&ra->time, &rb->time);
+
+	if (rc)
+		return -rc;
+
+	const uint64_t ba = ra->bytes_read + ra->bytes_written;
+	const uint64_t bb = rb->bytes_read + rb->bytes_written;
+
+	return (ba < bb) ? 1 : (ba > bb) ? -1 : 0;
+}
+
+void
+io_call_summary(FILE *outf)
+{
+	if (!nrows)
+		return;
+
+	struct io_counts **sorted = xcalloc(nrows, sizeof(*sorted));
+
+	for (size_t i = 0; i < nrows; ++i)
+		sorted[i] = &rows[i];
+
+	qsort(sorted, nrows, sizeof(*sorted), io_counts_cmp);
+
+	static const char dashes[] = "------------";
+
+	fprintf(outf, "%11s %9s %9s %12s %12s %7s %5s %s\n",
+		"seconds", "calls", "errors", "read", "written",
+		"pid", "fd", "path");
+	fprintf(outf, "%.11s %.9s %.9s %.12s %.12s %.7s %.5s %.16s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		"----------------");
+
+	for (size_t i = 0; i < nrows; ++i) {
+		const struct io_counts *const r = sorted[i];
+
+		fprintf(outf, "%11.6f %9" PRIu64 " %9" PRIu64
+			" %12" PRIu64 " %12" PRIu64 " %7d %5d %s\n",
+			ts_float(&r->time), r->calls, r->errors,
+			r->bytes_read, r->bytes_written,
+			r->pid, r->fd, r->path);
+	}
+
+	fprintf(outf, "%.11s %.9s %.9s %.12s %.12s %.7s %.5s %.16s\n",
+		dashes, dashes, dashes, dashes, dashes, dashes, dashes,
+		"----------------");
+	fprintf(outf, "%11.6f %9" PRIu64 " %9" PRIu64
+		" %12" PRIu64 " %12" PRIu64 " %7s %5s %s\n",
+		ts_float(&total.time), total.calls, total.errors,
+		total.bytes_read, total.bytes_written, "", "", "total");
+
+	free(sorted);
+}
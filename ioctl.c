@@ -36,29 +36,62 @@
 	/* end of _IOC_SIZE definition */
 #endif
 
-static int
-compare(const void *a, const void *b)
+/*
+ * Open addressing hash table of the current personality's ioctlent,
+ * built on first use, that maps an ioctl code to the position of the first
+ * entry with this code (plus one, zero means unused).
+ */
+struct ioctl_hash {
+	uint32_t *slots;
+	uint32_t mask;
+};
+
+static struct ioctl_hash ioctl_hashes[SUPPORTED_PERSONALITIES];
+
+static uint32_t
+ioctl_hash_slot(const struct ioctl_hash *const h, const unsigned int code)
 {
-	const unsigned int code1 = (const uintptr_t) a;
-	const unsigned int code2 = ((struct_ioctlent *) b)->code;
-	return (code1 > code2) ? 1 : (code1 < code2) ? -1 : 0;
+	/* Fibonacci hashing, the table size is a power of 2.  */
+	for (uint32_t i = (code * 0x9e3779b97f4a7c15ULL) >> 32 & h->mask;;
+	     i = (i + 1) & h->mask) {
+		if (!h->slots[i] || ioctlent[h->slots[i] - 1].code == code)
+			return i;
+	}
+}
+
+static const struct ioctl_hash *
+get_ioctl_hash(void)
+{
+	struct ioctl_hash *const h = &ioctl_hashes[current_personality];
+
+	if (h->slots)
+		return h;
+
+	uint32_t size = 64;
+
+	while (size < nioctlents * 2)
+		size *= 2;
+
+	h->slots = xcalloc(size, sizeof(*h->slots));
+	h->mask = size - 1;
+
+	/* ioctlent is sorted by code, the first entry of each code is kept.  */
+	for (unsigned int i = 0; i < nioctlents; ++i) {
+		if (i && ioctlent[i - 1].code == ioctlent[i].code)
+			continue;
+		h->slots[ioctl_hash_slot(h, ioctlent[i].code)] = i + 1;
+	}
+
+	return h;
 }
 
 static const struct_ioctlent *
 ioctl_lookup(const unsigned int code)
 {
-	struct_ioctlent *iop;
-
-	iop = bsearch((const void *) (const uintptr_t) code, ioctlent,
-			nioctlents, sizeof(ioctlent[0]), compare);
-	while (iop > ioctlent) {
-		iop--;
-		if (iop->code != code) {
-			iop++;
-			break;
-		}
-	}
-	return iop;
+	const struct ioctl_hash *const h = get_ioctl_hash();
+	const uint32_t pos = h->slots[ioctl_hash_slot(h, code)];
+
+	return pos ? &ioctlent[pos - 1] : NULL;
 }
 
 static const struct_ioctlent *
@@ -0,0 +1,468 @@
+/*
+ * Merge of strace -ff -tt[t] output (--merge option): the STRACE_LOG.PID
+ * files are read line by line and merged using a heap keyed by the time
+ * stamps, each line is prefixed with the PID, as strace-log-merge does.
+ *
+ * Every file is expected to be in the time stamp order, which is the case
+ * for the output of a single strace -ff invocation.  When there are more
+ * files than can be open at once, they are merged in batches into temporary
+ * files first.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#define MERGE_KEY_MAX 64
+#define MERGE_FD_RESERVE 8
+
+static const char unfinished_sfx[] = " <unfinished ...>";
+
+struct merge_source {
+	char *path;
+	char *pid;	/* NULL for a temporary file with prefixed lines */
+};
+
+struct merge_input {
+	FILE *fp;
+	const struct merge_source *src;
+	char *line;
+	size_t line_size;
+	const char *text;	/* the line without the PID prefix */
+	char pid[sizeof(int) * 3 * 2];
+	char key[MERGE_KEY_MAX];	/* time stamp digits, leading zeros
+					   stripped */
+	size_t key_len;
+};
+
+struct merge_output {
+	FILE *fp;
+	int pid_width;
+	bool join;	/* whether unfinished lines are joined */
+	char *pending;	/* unfinished line not printed yet */
+	size_t pending_size;
+	size_t pending_len;	/* without the " <unfinished ...>" suffix */
+	char pending_pid[sizeof(int) * 3 * 2];
+	uint64_t lines;
+};
+
+/*
+ * Parse the time stamp at the beginning of the text, that is,
+ * [HH:][MM:][SS.]DIGITS followed by a space, as strace-log-merge does,
+ * and store its digits as the key.
+ */
+static bool
+parse_key(struct merge_input *in)
+{
+	const char *p = in->text;
+	char digits[MERGE_KEY_MAX * 2];
+	size_t n = 0;
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (isdigit((unsigned char) p[0]) &&
+		    isdigit((unsigned char) p[1]) && p[2] == ':') {
+			digits[n++] = p[0];
+			digits[n++] = p[1];
+			p += 3;
+		}
+	}
+
+	for (unsigned int i = 0; i < 2; ++i) {
+		const char *const start = p;
+
+		while (isdigit((unsigned char) *p)) {
+			if (n < sizeof(digits))
+				digits[n++] = *p;
+			++p;
+		}
+		if (p == start)
+			return false;
+		if (*p == ' ')
+			break;
+		if (i || *p != '.')
+			return false;
+		++p;
+	}
+
+	size_t skip = 0;
+
+	while (skip + 1 < n && digits[skip] == '0')
+		++skip;
+
+	in->key_len = MIN(n - skip, sizeof(in->key));
+	memcpy(in->key, digits + skip, in->key_len);
+
+	return true;
+}
+
+/* Read the next line with a time stamp, return false at the end.  */
+static bool
+read_line(struct merge_input *in)
+{
+	ssize_t len;
+
+	while ((len = getline(&in->line, &in->line_size, in->fp)) >= 0) {
+		if (len && in->line[len - 1] == '\n')
+			in->line[--len] = '\0';
+
+		in->text = in->line;
+
+		if (in->src->pid) {
+			strcpy(in->pid, in->src->pid);
+		} else {
+			/* A temporary file, the line starts with the PID.  */
+			const size_t pid_len = strcspn(in->line, " ");
+
+			if (pid_len >= sizeof(in->pid))
+				continue;
+			memcpy(in->pid, in->line, pid_len);
+			in->pid[pid_len] = '\0';
+			in->text += pid_len + strspn(in->line + pid_len, " ");
+		}
+
+		if (parse_key(in))
+			return true;
+	}
+
+	if (ferror(in->fp))
+		perror_msg_and_die("%s", in->src->path);
+
+	return false;
+}
+
+/* Whether the line of input a is to be printed before that of b.  */
+static bool
+input_less(const struct merge_input *a, const struct merge_input *b)
+{
+	if (a->key_len != b->key_len)
+		return a->key_len < b->key_len;
+
+	const int rc = memcmp(a->key, b->key, a->key_len);
+
+	/* Ties are resolved in the order of the files.  */
+	return rc ? rc < 0 : a < b;
+}
+
+static void
+sift_down(struct merge_input **heap, size_t n, size_t i)
+{
+	for (;;) {
+		size_t min = i;
+		const size_t l = 2 * i + 1;
+		const size_t r = l + 1;
+
+		if (l < n && input_less(heap[l], heap[min]))
+			min = l;
+		if (r < n && input_less(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		struct merge_input *const tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+static void
+print_line(struct merge_output *out, const char *pid, const char *text)
+{
+	if (fprintf(out->fp, "%-*s %s\n", out->pid_width, pid, text) < 0)
+		perror_msg_and_die("write");
+	out->lines++;
+}
+
+static void
+flush_pending(struct merge_output *out)
+{
+	if (out->pending && *out->pending_pid) {
+		print_line(out, out->pending_pid, out->pending);
+		*out->pending_pid = '\0';
+	}
+}
+
+/*
+ * Return the part of the text after "<... SYSCALL resumed>"
+ * if the text is the resumption of the unfinished pending line.
+ */
+static const char *
+get_resumed_tail(const struct merge_output *out, const char *pid,
+		 const char *text)
+{
+	if (!*out->pending_pid || strcmp(pid, out->pending_pid))
+		return NULL;
+
+	/* Skip the time stamp.  */
+	text = strchr(text, ' ');
+	if (!text || strncmp(text + 1, "<... ", 5))
+		return NULL;
+
+	const char *const end = strstr(text, " resumed>");
+
+	return end ? end + sizeof(" resumed>") - 1 : NULL;
+}
+
+/*
+ * Print a line.  A line ending with " <unfinished ...>" is held back
+ * and joined with the next line if the latter is the resumption
+ * of the same syscall by the same process, as strace -f prints it when
+ * no other process intervenes.
+ */
+static void
+emit_line(struct merge_output *out, const char *pid, const char *text)
+{
+	if (!out->join) {
+		print_line(out, pid, text);
+		return;
+	}
+
+	const char *tail = get_resumed_tail(out, pid, text);
+
+	if (tail) {
+		if (fprintf(out->fp, "%-*s %.*s%s\n", out->pid_width,
+			    out->pending_pid, (int) out->pending_len,
+			    out->pending, tail) < 0)
+			perror_msg_and_die("write");
+		out->lines++;
+		*out->pending_pid = '\0';
+		return;
+	}
+
+	flush_pending(out);
+
+	const size_t len = strlen(text);
+
+	if (len >= sizeof(unfinished_sfx) - 1 &&
+	    !strcmp(text + len - (sizeof(unfinished_sfx) - 1),
+		    unfinished_sfx)) {
+		if (len + 1 > out->pending_size) {
+			out->pending_size = len + 1;
+			out->pending = xreallocarray(out->pending,
+						     out->pending_size, 1);
+		}
+		memcpy(out->pending, text, len + 1);
+		out->pending_len = len - (sizeof(unfinished_sfx) - 1);
+		strcpy(out->pending_pid, pid);
+		return;
+	}
+
+	print_line(out, pid, text);
+}
+
+static void
+merge_sources(const struct merge_source *srcs, size_t n,
+	      struct merge_output *out)
+{
+	struct merge_input *inputs = xcalloc(n, sizeof(*inputs));
+	struct merge_input **heap = xcalloc(n, sizeof(*heap));
+	size_t heap_size = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		inputs[i].src = &srcs[i];
+		inputs[i].fp = fopen(srcs[i].path, "r");
+		if (!inputs[i].fp)
+			perror_msg_and_die("%s", srcs[i].path);
+		if (read_line(&inputs[i]))
+			heap[heap_size++] = &inputs[i];
+	}
+
+	for (size_t i = heap_size / 2; i > 0; --i)
+		sift_down(heap, heap_size, i - 1);
+
+	while (heap_size) {
+		struct merge_input *const in = heap[0];
+
+		emit_line(out, in->pid, in->text);
+		if (!read_line(in))
+			heap[0] = heap[--heap_size];
+		sift_down(heap, heap_size, 0);
+	}
+
+	flush_pending(out);
+
+	for (size_t i = 0; i < n; ++i) {
+		fclose(inputs[i].fp);
+		free(inputs[i].line);
+	}
+	free(heap);
+	free(inputs);
+}
+
+/* Merge the sources into a temporary file and return it as a source.  */
+static struct merge_source
+merge_to_temp(const struct merge_source *srcs, size_t n, int pid_width)
+{
+	const char *const tmpdir = getenv("TMPDIR");
+	char *path = xasprintf("%s/strace-merge.XXXXXX",
+			       tmpdir && *tmpdir ? tmpdir : "/tmp");
+	const int fd = mkstemp(path);
+
+	if (fd < 0)
+		perror_msg_and_die("mkstemp: %s", path);
+
+	struct merge_output out = {
+		.fp = fdopen(fd, "w"),
+		.pid_width = pid_width,
+	};
+
+	if (!out.fp)
+		perror_msg_and_die("fdopen: %s", path);
+
+	merge_sources(srcs, n, &out);
+
+	if (fclose(out.fp))
+		perror_msg_and_die("%s", path);
+
+	return (struct merge_source) { .path = path };
+}
+
+static void
+free_sources(struct merge_source *srcs, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		/* Temporary files have no PID.  */
+		if (!srcs[i].pid)
+			unlink(srcs[i].path);
+		free(srcs[i].path);
+		free(srcs[i].pid);
+	}
+	free(srcs);
+}
+
+static int
+source_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct merge_source *) a)->path,
+		      ((const struct merge_source *) b)->path);
+}
+
+/*
+ * Find the STRACE_LOG.PID files, where PID is a positive number,
+ * in the order of their names.
+ */
+static struct merge_source *
+find_sources(const char *prefix, size_t *np)
+{
+	const char *const slash = strrchr(prefix, '/');
+	char *const dir = slash ? xstrndup(prefix, slash - prefix + 1)
+				: xstrdup("./");
+	const char *const base = slash ? slash + 1 : prefix;
+	const size_t base_len = strlen(base);
+	DIR *const d = opendir(dir);
+	struct merge_source *srcs = NULL;
+	size_t n = 0, size = 0;
+	const struct dirent *de;
+
+	if (!d) {
+		free(dir);
+		*np = 0;
+		return NULL;
+	}
+
+	while ((de = readdir(d))) {
+		const char *const sfx = de->d_name + base_len + 1;
+
+		if (strncmp(de->d_name, base, base_len) ||
+		    de->d_name[base_len] != '.' || !*sfx ||
+		    sfx[strspn(sfx, "0123456789")] ||
+		    !sfx[strspn(sfx, "0")])
+			continue;
+
+		char *const path = xasprintf("%s%s", slash ? dir : "",
+					     de->d_name);
+		struct stat st;
+
+		if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+
+		if (n >= size)
+			srcs = xgrowarray(srcs, &size, sizeof(*srcs));
+		srcs[n].path = path;
+		srcs[n].pid = xstrdup(sfx);
+		++n;
+	}
+
+	closedir(d);
+	free(dir);
+
+	qsort(srcs, n, sizeof(*srcs), source_cmp);
+	*np = n;
+
+	return srcs;
+}
+
+/* The number of files that can be merged at once.  */
+static size_t
+get_merge_width(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY ||
+	    rl.rlim_cur > 1024 * 1024)
+		return 1024 * 1024;
+
+	return rl.rlim_cur > MERGE_FD_RESERVE + 3
+	       ? rl.rlim_cur - MERGE_FD_RESERVE : 3;
+}
+
+int
+merge_logs(const char *prefix)
+{
+	size_t n;
+	struct merge_source *srcs = find_sources(prefix, &n);
+	int pid_width = 0;
+
+	for (size_t i = 0; i < n; ++i)
+		pid_width = MAX(pid_width, (int) strlen(srcs[i].pid));
+
+	const size_t width = get_merge_width();
+
+	/* One descriptor is needed for the output of each batch.  */
+	while (n > width) {
+		const size_t batch = width - 1;
+		const size_t nbatches = (n + batch - 1) / batch;
+		struct merge_source *merged =
+			xcalloc(nbatches, sizeof(*merged));
+
+		debug_msg("merging %zu files in %zu batches", n, nbatches);
+
+		for (size_t i = 0; i < nbatches; ++i)
+			merged[i] = merge_to_temp(srcs + i * batch,
+						  MIN(batch, n - i * batch),
+						  pid_width);
+
+		free_sources(srcs, n);
+		srcs = merged;
+		n = nbatches;
+	}
+
+	struct merge_output out = {
+		.fp = stdout,
+		.pid_width = pid_width,
+		.join = true,
+	};
+
+	merge_sources(srcs, n, &out);
+	free_sources(srcs, n);
+	free(out.pending);
+
+	if (fflush(stdout))
+		perror_msg_and_die("write");
+
+	if (!out.lines) {
+		error_msg("%s: strace output not found", prefix);
+		return 1;
+	}
+
+	return 0;
+}
@@ -89,5 +89,7 @@ extern struct number_set *status_set;
 extern struct number_set *quiet_set;
 extern struct number_set *decode_fd_set;
 extern struct number_set *trace_set;
+extern struct number_set *dump_syscall_set;
+extern struct number_set *dump_errno_set;
 
 #endif /* !STRACE_NUMBER_SET_H */
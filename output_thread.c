@@ -0,0 +1,362 @@
+/*
+ * Output thread (--output-thread option): the text of the trace is still
+ * decoded by the tracer, but whatever it flushes to an output stream is
+ * queued in memory and written by a separate thread, so the tracees
+ * do not stay stopped while the tracer waits for a slow terminal, pipe,
+ * or disk.  The writes of all streams are kept in a single queue, which
+ * preserves their order.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#if defined HAVE_FOPENCOOKIE && defined HAVE_PTHREAD
+
+# include <pthread.h>
+# include <signal.h>
+
+/*
+ * The tracer waits for the output thread when it is this many bytes behind,
+ * so the memory use stays bounded when the output cannot keep up.
+ */
+# define OUTPUT_QUEUE_MAX	(64 * 1024 * 1024)
+
+struct output_stream {
+	FILE *fp;		/* the real stream */
+	char *name;		/* for error messages, NULL for stderr */
+	bool failed;		/* an error has been reported already */
+};
+
+/*
+ * An error of the output thread, it is reported by the tracer, since
+ * the output thread cannot print an error message: that flushes the streams,
+ * which would wait for the output thread.
+ */
+struct output_error {
+	struct output_error *next;
+	char *name;
+	int err;
+};
+
+struct output_chunk {
+	struct output_chunk *next;
+	struct output_stream *stream;
+	size_t len;
+	bool close;		/* close the stream instead of writing */
+	char data[];
+};
+
+enum output_thread_state {
+	OUTPUT_THREAD_IDLE,	/* not started yet */
+	OUTPUT_THREAD_RUNNING,
+	OUTPUT_THREAD_STOPPED,	/* streams are written directly */
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_nonempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_drained = PTHREAD_COND_INITIALIZER;
+static struct output_chunk *queue_head;
+static struct output_chunk **queue_tail = &queue_head;
+static size_t queued_bytes;
+static bool stop_requested;
+static struct output_error *errors_head;
+static struct output_error **errors_tail = &errors_head;
+
+static pthread_t output_thread;
+static pid_t output_thread_owner;
+static enum output_thread_state state;
+
+/*
+ * Return the errno of the write if it is the first error of the stream
+ * to report, otherwise 0.
+ */
+static int
+write_stream(struct output_stream *s, const char *buf, size_t len)
+{
+	if (s->failed)
+		return 0;
+
+	if (len ? fwrite(buf, 1, len, s->fp) != len : fflush(s->fp) != 0) {
+		s->failed = true;
+		if (s->name)
+			return errno;
+	}
+
+	return 0;
+}
+
+/* Called by the tracer.  */
+static void
+report_error(const char *name, const int err)
+{
+	if (!err)
+		return;
+
+	errno = err;
+	perror_msg("%s", name);
+}
+
+/*
+ * Called by the output thread, which cannot die of the lack of memory:
+ * the error is dropped instead.
+ */
+static void
+queue_error(const char *name, const int err)
+{
+	if (!err)
+		return;
+
+	struct output_error *const e = malloc(sizeof(*e));
+
+	if (!e)
+		return;
+	e->next = NULL;
+	e->name = strdup(name);
+	e->err = err;
+	if (!e->name) {
+		free(e);
+		return;
+	}
+
+	pthread_mutex_lock(&queue_lock);
+	*errors_tail = e;
+	errors_tail = &e->next;
+	pthread_mutex_unlock(&queue_lock);
+}
+
+/* Close and free the stream, an error is passed to report.  */
+static void
+close_stream(struct output_stream *s,
+	     void (*report)(const char *name, int err))
+{
+	int err = write_stream(s, NULL, 0);
+
+	if (s->fp != stderr && fclose(s->fp) && s->name && !s->failed)
+		err = errno;
+	report(s->name, err);
+
+	free(s->name);
+	free(s);
+}
+
+/* Report the errors queued by the output thread.  */
+static void
+report_queued_errors(void)
+{
+	pthread_mutex_lock(&queue_lock);
+	struct output_error *e = errors_head;
+	errors_head = NULL;
+	errors_tail = &errors_head;
+	pthread_mutex_unlock(&queue_lock);
+
+	while (e) {
+		struct output_error *const next = e->next;
+
+		report_error(e->name, e->err);
+		free(e->name);
+		free(e);
+		e = next;
+	}
+}
+
+/* Write a batch of chunks, flushing every stream once it is done with.  */
+static void
+write_chunks(struct output_chunk *c)
+{
+	while (c) {
+		struct output_chunk *const next = c->next;
+		struct output_stream *const s = c->stream;
+
+		if (c->close) {
+			close_stream(s, queue_error);
+		} else {
+			queue_error(s->name, write_stream(s, c->data, c->len));
+			if (!next || next->stream != s)
+				queue_error(s->name, write_stream(s, NULL, 0));
+		}
+
+		free(c);
+		c = next;
+	}
+}
+
+static void *
+output_thread_main(void *arg)
+{
+	pthread_mutex_lock(&queue_lock);
+
+	for (;;) {
+		while (!queue_head && !stop_requested)
+			pthread_cond_wait(&queue_nonempty, &queue_lock);
+		if (!queue_head)
+			break;
+
+		struct output_chunk *const batch = queue_head;
+		const size_t batch_bytes = queued_bytes;
+
+		queue_head = NULL;
+		queue_tail = &queue_head;
+		pthread_mutex_unlock(&queue_lock);
+
+		write_chunks(batch);
+
+		pthread_mutex_lock(&queue_lock);
+		queued_bytes -= batch_bytes;
+		pthread_cond_signal(&queue_drained);
+	}
+
+	pthread_mutex_unlock(&queue_lock);
+
+	return NULL;
+}
+
+static bool
+start_output_thread(void)
+{
+	sigset_t all, old;
+	int rc;
+
+	/* The signals are left to the tracer.  */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&output_thread, NULL, output_thread_main, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (rc) {
+		errno = rc;
+		perror_msg("pthread_create");
+		state = OUTPUT_THREAD_STOPPED;
+		return false;
+	}
+
+	output_thread_owner = getpid();
+	state = OUTPUT_THREAD_RUNNING;
+	atexit(output_thread_stop);
+
+	return true;
+}
+
+static void
+enqueue(struct output_chunk *c)
+{
+	c->next = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	while (queued_bytes > OUTPUT_QUEUE_MAX)
+		pthread_cond_wait(&queue_drained, &queue_lock);
+	*queue_tail = c;
+	queue_tail = &c->next;
+	queued_bytes += c->len;
+	pthread_cond_signal(&queue_nonempty);
+	pthread_mutex_unlock(&queue_lock);
+
+	report_queued_errors();
+}
+
+static ssize_t
+cookie_write(void *cookie, const char *buf, size_t size)
+{
+	struct output_stream *const s = cookie;
+
+	/*
+	 * The thread is started on the first write rather than on wrapping,
+	 * after the tracee has been forked off and strace has daemonized.
+	 */
+	if (state == OUTPUT_THREAD_IDLE)
+		start_output_thread();
+
+	if (state != OUTPUT_THREAD_RUNNING) {
+		report_error(s->name, write_stream(s, buf, size));
+		report_error(s->name, write_stream(s, NULL, 0));
+		return size;
+	}
+
+	struct output_chunk *const c = xmalloc(sizeof(*c) + size);
+
+	c->stream = s;
+	c->len = size;
+	c->close = false;
+	memcpy(c->data, buf, size);
+	enqueue(c);
+
+	return size;
+}
+
+static int
+cookie_close(void *cookie)
+{
+	struct output_stream *const s = cookie;
+
+	if (state != OUTPUT_THREAD_RUNNING) {
+		close_stream(s, report_error);
+		return 0;
+	}
+
+	struct output_chunk *const c = xmalloc(sizeof(*c));
+
+	c->stream = s;
+	c->len = 0;
+	c->close = true;
+	enqueue(c);
+
+	return 0;
+}
+
+FILE *
+output_thread_wrap(FILE *fp, const char *name)
+{
+	static const cookie_io_functions_t funcs = {
+		.write = cookie_write,
+		.close = cookie_close,
+	};
+	struct output_stream *const s = xzalloc(sizeof(*s));
+
+	s->fp = fp;
+	s->name = fp == stderr ? NULL : xstrdup(name);
+
+	FILE *const wrapped = fopencookie(s, "w", funcs);
+
+	if (!wrapped)
+		perror_msg_and_die("fopencookie");
+
+	return wrapped;
+}
+
+/* Write out everything queued so far and wait for the thread to finish.  */
+void
+output_thread_stop(void)
+{
+	if (state != OUTPUT_THREAD_RUNNING || output_thread_owner != getpid())
+		return;
+
+	fflush(NULL);
+
+	pthread_mutex_lock(&queue_lock);
+	stop_requested = true;
+	pthread_cond_signal(&queue_nonempty);
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_join(output_thread, NULL);
+	state = OUTPUT_THREAD_STOPPED;
+
+	report_queued_errors();
+}
+
+#else /* !(HAVE_FOPENCOOKIE && HAVE_PTHREAD) */
+
+FILE *
+output_thread_wrap(FILE *fp, const char *name)
+{
+	return fp;
+}
+
+void
+output_thread_stop(void)
+{
+}
+
+#endif
@@ -58,8 +58,7 @@ fdmatch(struct tcb *tcp, int fd, struct path_set *set)
 }
 
 /*
- * Add a path to the set we're tracing.
- * Specifying NULL will delete all paths.
+ * Add a copy of a path to the set we're tracing.
  */
 static void
 storepath(const char *path, struct path_set *set)
@@ -72,7 +71,18 @@ storepath(const char *path, struct path_set *set)
 			xgrowarray(set->paths_selected, &set->size,
 				   sizeof(set->paths_selected[0]));
 
-	set->paths_selected[set->num_selected++] = path;
+	set->paths_selected[set->num_selected++] = xstrdup(path);
+}
+
+/*
+ * Delete all paths from the set we're tracing.
+ */
+void
+pathtrace_clear_set(struct path_set *set)
+{
+	for (size_t i = 0; i < set->num_selected; ++i)
+		free((char *) set->paths_selected[i]);
+	set->num_selected = 0;
 }
 
 /*
@@ -100,7 +110,7 @@ getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
 
 /*
  * Add a path to the set we're tracing.  Also add the canonicalized
- * version of the path.  Specifying NULL will delete all paths.
+ * version of the path.
  */
 void
 pathtrace_select_set(const char *path, struct path_set *set)
@@ -136,6 +146,7 @@ pathtrace_select_set(const char *path, struct path_set *set)
 		free(rpath_quoted);
 	}
 	storepath(rpath, set);
+	free(rpath);
 }
 
 static bool
@@ -0,0 +1,526 @@
+/*
+ * Perf backend of -c (--summary-backend=perf option): the syscalls are
+ * counted from the raw_syscalls:sys_enter and raw_syscalls:sys_exit
+ * tracepoints, sampled with perf_event_open into a ring buffer that
+ * strace reads, so the tracees do not stop on syscalls at all.
+ * ptrace is still used to follow forks and to learn about exits.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+bool perf_summary;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+
+# include <fcntl.h>
+# include <signal.h>
+# include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <linux/perf_event.h>
+
+# include "negated_errno.h"
+# include "number_set.h"
+# include "scno.h"
+# include "xstring.h"
+
+# ifndef PERF_FLAG_FD_CLOEXEC
+#  define PERF_FLAG_FD_CLOEXEC (1UL << 3)
+# endif
+
+/*
+ * Data pages of a ring buffer, fewer are used if they cannot be locked.
+ * The buffer is read when it gets half full.
+ */
+# define RING_PAGES	128
+
+/* A field of a tracepoint record, from its format file in tracefs.  */
+struct tp_field {
+	unsigned int offset;
+	unsigned int size;
+};
+
+struct tracepoint {
+	const char *name;
+	const char *field;	/* "args" for sys_enter, "ret" for sys_exit */
+	unsigned int id;
+	struct tp_field nr, value;
+};
+
+static struct tracepoint tracepoints[] = {
+	{ .name = "sys_enter", .field = "args" },
+	{ .name = "sys_exit", .field = "ret" },
+};
+
+static const char *const tracefs_dirs[] = {
+	"/sys/kernel/tracing",
+	"/sys/kernel/debug/tracing",
+};
+
+/*
+ * The events of a tracee with their ring buffer, and the syscall
+ * it has entered, by the time of entering in ns.  The kernel does not
+ * allow to mmap inherited per-task events, nor to share a buffer
+ * between the events of different tasks, so every tracee, including
+ * the children strace follows, gets its own events and buffer.
+ */
+struct perf_tracee {
+	int fds[ARRAY_SIZE(tracepoints)];
+	void *map;
+	size_t size;
+
+	uint64_t time;
+	kernel_ulong_t scno;
+	unsigned int pers;
+};
+
+static uint64_t sample_regs_user;
+static struct perf_tracee **tracees;
+static size_t tracees_used, tracees_size;
+static uint64_t lost;
+
+static FILE *
+open_format(const struct tracepoint *tp)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(tracefs_dirs); ++i) {
+		char path[PATH_MAX];
+
+		xsprintf(path, "%s/events/raw_syscalls/%s/format",
+			 tracefs_dirs[i], tp->name);
+
+		FILE *fp = fopen(path, "r");
+
+		if (fp)
+			return fp;
+	}
+
+	return NULL;
+}
+
+/*
+ * Parse a "field:long id;	offset:8;	size:8;	signed:1;" line
+ * of the format file, the name of the field is the last word
+ * before the semicolon, possibly followed by the size of an array.
+ */
+static bool
+parse_field(const char *line, const char *name, struct tp_field *f)
+{
+	const char *end = strchr(line, ';');
+	const size_t len = strlen(name);
+
+	if (!end || !strstr(line, "field:"))
+		return false;
+
+	const char *bracket = memchr(line, '[', end - line);
+
+	if (bracket)
+		end = bracket;
+	if ((size_t) (end - line) < len + 1 || end[-len - 1] != ' ' ||
+	    strncmp(end - len, name, len))
+		return false;
+
+	const char *offset = strstr(end, "offset:");
+
+	return offset && sscanf(offset, "offset:%u;%*[ \t]size:%u",
+				&f->offset, &f->size) == 2;
+}
+
+static bool
+read_tracepoint(struct tracepoint *tp)
+{
+	FILE *fp = open_format(tp);
+
+	if (!fp)
+		return false;
+
+	char line[256];
+	bool has_id = false, has_nr = false, has_value = false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		const char *s = line + strspn(line, " \t");
+
+		if (sscanf(s, "ID: %u", &tp->id) == 1)
+			has_id = true;
+		else if (parse_field(s, "id", &tp->nr))
+			has_nr = true;
+		else if (parse_field(s, tp->field, &tp->value))
+			has_value = true;
+	}
+	fclose(fp);
+
+	return has_id && has_nr && has_value &&
+	       (tp->nr.size == 4 || tp->nr.size == 8) &&
+	       (tp->value.size >= 4);
+}
+
+static int
+open_event(const struct tracepoint *tp, const int pid)
+{
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_TRACEPOINT,
+		.size = sizeof(attr),
+		.config = tp->id,
+		.sample_period = 1,
+		.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME |
+			       PERF_SAMPLE_RAW,
+		.disabled = pid == 0,
+		.watermark = 1,
+	};
+
+	if (sample_regs_user) {
+		attr.sample_type |= PERF_SAMPLE_REGS_USER;
+		attr.sample_regs_user = sample_regs_user;
+	}
+
+	return syscall(__NR_perf_event_open, &attr, pid, -1, -1,
+		       PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Check that the tracepoints can be sampled, falling back to the ptrace
+ * backend if they cannot.
+ */
+void
+perf_summary_init(void)
+{
+	if (!perf_summary)
+		return;
+
+	const char *what = NULL;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(tracepoints); ++i) {
+		if (!read_tracepoint(&tracepoints[i])) {
+			what = "raw_syscalls tracepoints are not available"
+			       " in tracefs";
+			break;
+		}
+	}
+
+	if (!what) {
+		/*
+		 * The ABI of the registers tells 32-bit syscalls of tracees
+		 * from the 64-bit ones.  Register 0 exists on every arch.
+		 */
+		sample_regs_user = SUPPORTED_PERSONALITIES > 1;
+
+		int fd = open_event(&tracepoints[0], 0);
+
+		if (fd < 0 && errno == EINVAL && sample_regs_user) {
+			sample_regs_user = 0;
+			fd = open_event(&tracepoints[0], 0);
+		}
+		if (fd < 0)
+			what = strerror(errno);
+		else
+			close(fd);
+	}
+
+	if (what) {
+		error_msg("--summary-backend=perf is not available (%s),"
+			  " falling back to ptrace", what);
+		perf_summary = false;
+		return;
+	}
+
+	/* The syscall times are the wall clock times between the samples.  */
+	count_wallclock = true;
+
+	debug_msg("--summary-backend=perf: counting syscalls with perf events");
+}
+
+static void
+close_events(struct perf_tracee *t)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(t->fds); ++i) {
+		if (t->fds[i] >= 0)
+			close(t->fds[i]);
+	}
+	if (t->map)
+		munmap(t->map, t->size);
+	free(t);
+}
+
+/* Start counting the syscalls of a new tracee.  */
+void
+perf_summary_attach(struct tcb *tcp)
+{
+	struct perf_tracee *t = xzalloc(sizeof(*t));
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(t->fds); ++i)
+		t->fds[i] = -1;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(tracepoints); ++i) {
+		t->fds[i] = open_event(&tracepoints[i], tcp->pid);
+		if (t->fds[i] < 0) {
+			perror_msg("perf_event_open: the syscalls of pid %d"
+				   " are not counted", tcp->pid);
+			close_events(t);
+			return;
+		}
+	}
+
+	for (unsigned int pages = RING_PAGES; pages && !t->map; pages /= 2) {
+		t->size = (1 + pages) * get_pagesize();
+		t->map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			      t->fds[0], 0);
+		if (t->map == MAP_FAILED)
+			t->map = NULL;
+	}
+	if (!t->map) {
+		perror_msg("mmap: the syscalls of pid %d are not counted",
+			   tcp->pid);
+		close_events(t);
+		return;
+	}
+
+	for (unsigned int i = 1; i < ARRAY_SIZE(t->fds); ++i) {
+		if (ioctl(t->fds[i], PERF_EVENT_IOC_SET_OUTPUT, t->fds[0]) < 0) {
+			perror_msg("PERF_EVENT_IOC_SET_OUTPUT: the syscalls"
+				   " of pid %d are not counted", tcp->pid);
+			close_events(t);
+			return;
+		}
+	}
+
+	/* SIGIO interrupts the wait for tracees to read the buffer.  */
+	if (fcntl(t->fds[0], F_SETOWN, getpid()) < 0 ||
+	    fcntl(t->fds[0], F_SETFL, O_ASYNC | O_NONBLOCK) < 0)
+		perror_msg("fcntl");
+
+	if (tracees_used >= tracees_size)
+		tracees = xgrowarray(tracees, &tracees_size, sizeof(*tracees));
+	tracees[tracees_used++] = t;
+	tcp->perf_tracee = t;
+}
+
+static uint64_t
+get_field(const unsigned char *raw, const uint32_t raw_size,
+	  const struct tp_field *f, const bool is_signed)
+{
+	if (f->offset + f->size > raw_size)
+		return 0;
+
+	if (f->size == 4) {
+		uint32_t v;
+
+		memcpy(&v, raw + f->offset, sizeof(v));
+		return is_signed ? (uint64_t) (int64_t) (int32_t) v : v;
+	} else {
+		uint64_t v;
+
+		memcpy(&v, raw + f->offset, sizeof(v));
+		return v;
+	}
+}
+
+static unsigned int
+sample_personality(const uint64_t abi, const kernel_ulong_t scno)
+{
+# if SUPPORTED_PERSONALITIES > 1
+	if (abi == PERF_SAMPLE_REGS_ABI_32)
+		return 1;
+# endif
+# if SUPPORTED_PERSONALITIES > 2 && defined X86_64
+	/* See arch_get_scno for the syscall number -1.  */
+	if (abi == PERF_SAMPLE_REGS_ABI_64 && (scno & __X32_SYSCALL_BIT) &&
+	    (kernel_long_t) scno != -1)
+		return 2;
+# endif
+	return 0;
+}
+
+/* A sample in the buffer of a tracee is always of that tracee.  */
+static void
+handle_sample(struct perf_tracee *t, const unsigned char *rec,
+	      const size_t size)
+{
+	/* u32 pid, tid; u64 time; u32 raw_size; raw; [u64 abi; u64 regs[]] */
+	const size_t raw_pos = sizeof(struct perf_event_header) + 8 + 8;
+	uint32_t raw_size;
+	uint64_t time, abi = 0;
+
+	if (size < raw_pos + sizeof(raw_size))
+		return;
+	memcpy(&time, rec + sizeof(struct perf_event_header) + 8, sizeof(time));
+	memcpy(&raw_size, rec + raw_pos, sizeof(raw_size));
+
+	const unsigned char *raw = rec + raw_pos + sizeof(raw_size);
+
+	if (raw_pos + sizeof(raw_size) + raw_size > size || raw_size < 2)
+		return;
+	if (sample_regs_user &&
+	    raw_pos + sizeof(raw_size) + raw_size + sizeof(abi) <= size)
+		memcpy(&abi, raw + raw_size, sizeof(abi));
+
+	uint16_t type;
+
+	memcpy(&type, raw, sizeof(type));
+
+	if (type == tracepoints[0].id) {
+		const struct tracepoint *tp = &tracepoints[0];
+		const kernel_ulong_t scno = get_field(raw, raw_size,
+						      &tp->nr, true);
+
+		t->time = time;
+		t->pers = sample_personality(abi, scno);
+		t->scno = shuffle_scno(scno);
+		return;
+	}
+
+	/* Syscalls entered before the events were opened are not counted.  */
+	if (type != tracepoints[1].id || !t->time)
+		return;
+
+	const kernel_long_t ret = get_field(raw, raw_size,
+					    &tracepoints[1].value, true);
+	const uint64_t ns = time > t->time ? time - t->time : 0;
+	const struct timespec wts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	t->time = 0;
+
+	if (!is_number_in_set_array(t->scno, trace_set, t->pers))
+		return;
+
+	if (current_personality != t->pers)
+		set_personality(t->pers);
+	count_syscall_time(t->scno, is_negated_errno(ret) ? -ret : 0, &wts);
+}
+
+static void
+read_ring(struct perf_tracee *t)
+{
+	struct perf_event_mmap_page *const meta = t->map;
+	const unsigned char *const data =
+		(const unsigned char *) t->map + get_pagesize();
+	const uint64_t data_size = t->size - get_pagesize();
+	const uint64_t head = meta->data_head;
+	uint64_t tail = meta->data_tail;
+	static unsigned char rec[USHRT_MAX + 1];
+
+	/* Read the records only after data_head.  */
+	__sync_synchronize();
+
+	while (tail < head) {
+		struct perf_event_header hdr;
+
+		for (size_t i = 0; i < sizeof(hdr); ++i)
+			((unsigned char *) &hdr)[i] =
+				data[(tail + i) % data_size];
+		if (hdr.size < sizeof(hdr))
+			break;
+
+		for (size_t i = 0; i < hdr.size; ++i)
+			rec[i] = data[(tail + i) % data_size];
+
+		switch (hdr.type) {
+		case PERF_RECORD_SAMPLE:
+			handle_sample(t, rec, hdr.size);
+			break;
+		case PERF_RECORD_LOST: {
+			/* u64 id; u64 lost; */
+			uint64_t n;
+
+			if (hdr.size >= sizeof(hdr) + 16) {
+				memcpy(&n, rec + sizeof(hdr) + 8, sizeof(n));
+				lost += n;
+			}
+			break;
+		}
+		}
+
+		tail += hdr.size;
+	}
+
+	/* Free the space only after the records have been read.  */
+	__sync_synchronize();
+	meta->data_tail = tail;
+}
+
+/* Count the syscalls sampled since the previous call.  */
+void
+perf_summary_read(void)
+{
+	const unsigned int old_pers = current_personality;
+
+	for (size_t i = 0; i < tracees_used; ++i)
+		read_ring(tracees[i]);
+
+	if (current_personality != old_pers)
+		set_personality(old_pers);
+}
+
+/* Count the samples of the tracee before it is gone.  */
+void
+perf_summary_drop(struct tcb *tcp)
+{
+	struct perf_tracee *const t = tcp->perf_tracee;
+
+	if (!t)
+		return;
+
+	perf_summary_read();
+
+	for (size_t i = 0; i < tracees_used; ++i) {
+		if (tracees[i] == t) {
+			tracees[i] = tracees[--tracees_used];
+			break;
+		}
+	}
+	close_events(t);
+	tcp->perf_tracee = NULL;
+}
+
+void
+perf_summary_finish(void)
+{
+	perf_summary_read();
+
+	if (lost)
+		error_msg("--summary-backend=perf: %" PRIu64 " syscall events"
+			  " lost, the summary is incomplete", lost);
+
+	for (size_t i = 0; i < tracees_used; ++i)
+		close_events(tracees[i]);
+	tracees_used = 0;
+}
+
+#else /* !HAVE_LINUX_PERF_EVENT_H */
+
+void
+perf_summary_init(void)
+{
+	if (perf_summary) {
+		error_msg("--summary-backend=perf is not supported by this"
+			  " build of strace, falling back to ptrace");
+		perf_summary = false;
+	}
+}
+
+void
+perf_summary_attach(struct tcb *tcp)
+{
+}
+
+void
+perf_summary_read(void)
+{
+}
+
+void
+perf_summary_drop(struct tcb *tcp)
+{
+}
+
+void
+perf_summary_finish(void)
+{
+}
+
+#endif
@@ -0,0 +1,555 @@
+/*
+ * Process tree report (--process-tree option): the parent, the command line,
+ * the times, and the exit status of every traced process are recorded
+ * from the ptrace events and printed on exit as a tree or as JSON.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "largefile_wrappers.h"
+#include "xstring.h"
+
+enum ptree_state {
+	PTREE_RUNNING,
+	PTREE_EXITED,
+	PTREE_SIGNALLED,
+	PTREE_SUPERSEDED,	/* a thread whose execve took over the leader */
+};
+
+struct ptree_proc {
+	struct ptree_proc *parent;
+	struct ptree_proc *first_child;
+	struct ptree_proc *last_child;
+	struct ptree_proc *next_sibling;
+	struct ptree_proc *pending_next;
+	char *cmdline;		/* NUL separated arguments */
+	size_t cmdline_len;
+	char *exec_cmdline;	/* the arguments of the pending execve */
+	size_t exec_cmdline_len;
+	struct timespec start;
+	struct timespec exec;
+	struct timespec end;
+	struct timespec cpu;
+	unsigned int nexecs;
+	int pid;
+	int status;
+	bool thread;
+	enum ptree_state state;
+};
+
+enum process_tree_format process_tree_format;
+
+static struct ptree_proc **procs;
+static size_t nprocs_recorded;
+static size_t procs_size;
+
+/*
+ * Children reported by fork events before their first stop, hashed by pid
+ * with at least as many buckets as there are entries.
+ */
+static struct ptree_proc **pending;
+static size_t npending;
+static size_t pending_size;	/* a power of 2 */
+
+static struct timespec start_ts;
+
+/*
+ * Read the command line of a process that has not been seen to execve,
+ * e.g. one attached with -p.
+ */
+static void
+read_cmdline(struct ptree_proc *p, const int pid)
+{
+	char path[sizeof("/proc/%d/cmdline") + sizeof(int) * 3];
+
+	xsprintf(path, "/proc/%d/cmdline", pid);
+
+	const int fd = open_file(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+
+	size_t size = 0;
+	ssize_t rc;
+
+	free(p->cmdline);
+	p->cmdline = NULL;
+	p->cmdline_len = 0;
+	do {
+		if (p->cmdline_len + 1 >= size)
+			p->cmdline = xgrowarray(p->cmdline, &size, 1);
+		rc = read(fd, p->cmdline + p->cmdline_len,
+			  size - p->cmdline_len - 1);
+		if (rc > 0)
+			p->cmdline_len += rc;
+	} while (rc > 0 || (rc < 0 && errno == EINTR));
+
+	close(fd);
+
+	/* Strip the terminating NUL of the last argument.  */
+	if (p->cmdline_len && !p->cmdline[p->cmdline_len - 1])
+		--p->cmdline_len;
+	p->cmdline[p->cmdline_len] = '\0';
+}
+
+static struct ptree_proc **
+pending_bucket(const int pid)
+{
+	return &pending[(unsigned int) pid & (pending_size - 1)];
+}
+
+static void
+pending_add(struct ptree_proc *p)
+{
+	if (npending >= pending_size) {
+		struct ptree_proc **const old = pending;
+		const size_t old_size = pending_size;
+
+		pending_size = pending_size ? pending_size * 2 : 64;
+		pending = xcalloc(pending_size, sizeof(*pending));
+		for (size_t i = 0; i < old_size; ++i) {
+			for (struct ptree_proc *q = old[i], *next; q; q = next) {
+				struct ptree_proc **const bucket =
+					pending_bucket(q->pid);
+
+				next = q->pending_next;
+				q->pending_next = *bucket;
+				*bucket = q;
+			}
+		}
+		free(old);
+	}
+
+	struct ptree_proc **const bucket = pending_bucket(p->pid);
+
+	p->pending_next = *bucket;
+	*bucket = p;
+	++npending;
+}
+
+static struct ptree_proc *
+pending_remove(const int pid)
+{
+	if (!npending)
+		return NULL;
+
+	for (struct ptree_proc **pp = pending_bucket(pid); *pp;
+	     pp = &(*pp)->pending_next) {
+		struct ptree_proc *const p = *pp;
+
+		if (p->pid == pid) {
+			*pp = p->pending_next;
+			p->pending_next = NULL;
+			--npending;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static struct ptree_proc *
+new_proc(const int pid, struct ptree_proc *const parent)
+{
+	struct ptree_proc *const p = xzalloc(sizeof(*p));
+
+	p->pid = pid;
+	p->start = *get_event_ts();
+	p->parent = parent;
+
+	if (parent) {
+		if (parent->last_child)
+			parent->last_child->next_sibling = p;
+		else
+			parent->first_child = p;
+		parent->last_child = p;
+
+		/* Until execve, the child runs the command of the parent.  */
+		if (parent->cmdline) {
+			p->cmdline = xmalloc(parent->cmdline_len + 1);
+			memcpy(p->cmdline, parent->cmdline,
+			       parent->cmdline_len + 1);
+			p->cmdline_len = parent->cmdline_len;
+		}
+	}
+
+	if (nprocs_recorded >= procs_size)
+		procs = xgrowarray(procs, &procs_size, sizeof(*procs));
+	procs[nprocs_recorded++] = p;
+
+	return p;
+}
+
+void
+process_tree_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+}
+
+/* Called when a tcb is allocated for a new tracee.  */
+void
+process_tree_attach(struct tcb *tcp)
+{
+	tcp->ptree_proc = pending_remove(tcp->pid);
+	if (tcp->ptree_proc)
+		return;
+
+	tcp->ptree_proc = new_proc(tcp->pid, NULL);
+	read_cmdline(tcp->ptree_proc, tcp->pid);
+}
+
+static bool
+is_thread(const int pid)
+{
+	char path[sizeof("/proc/%d/status") + sizeof(int) * 3];
+	char buf[512];
+
+	xsprintf(path, "/proc/%d/status", pid);
+
+	const int fd = open_file(path, O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+
+	close(fd);
+	if (len <= 0)
+		return false;
+	buf[len] = '\0';
+
+	const char *const tgid = strstr(buf, "\nTgid:");
+
+	return tgid && atoi(tgid + sizeof("\nTgid:") - 1) != pid;
+}
+
+/*
+ * Called on PTRACE_EVENT_CLONE, PTRACE_EVENT_FORK, and PTRACE_EVENT_VFORK,
+ * child_tcp is the tcb of child_pid if it has already been allocated.
+ */
+void
+process_tree_clone(struct tcb *tcp, struct tcb *child_tcp,
+		   const int child_pid, const bool clone)
+{
+	struct ptree_proc *const parent = tcp->ptree_proc;
+	struct ptree_proc *child;
+
+	if (child_tcp && child_tcp->ptree_proc) {
+		/* The child has stopped before the event was reported.  */
+		child = child_tcp->ptree_proc;
+		if (child->parent || child == parent)
+			return;
+		child->parent = parent;
+		if (parent) {
+			if (parent->last_child)
+				parent->last_child->next_sibling = child;
+			else
+				parent->first_child = child;
+			parent->last_child = child;
+		}
+	} else {
+		child = new_proc(child_pid, parent);
+		pending_add(child);
+	}
+
+	child->thread = clone && is_thread(child_pid);
+}
+
+/*
+ * Called on entering execve, execveat, and execv, addr is the address
+ * of their argv: the arguments are read while the tracee is stopped,
+ * so they cannot change before the execve succeeds.
+ */
+void
+process_tree_execve(struct tcb *tcp, kernel_ulong_t addr)
+{
+	struct ptree_proc *const p = tcp->ptree_proc;
+
+	if (!p)
+		return;
+
+	size_t size = 0;
+
+	free(p->exec_cmdline);
+	p->exec_cmdline = NULL;
+	p->exec_cmdline_len = 0;
+
+	for (; addr; addr += current_wordsize) {
+		union {
+			unsigned int p32;
+			kernel_ulong_t p64;
+			char data[sizeof(kernel_ulong_t)];
+		} cp;
+
+		if (umoven(tcp, addr, current_wordsize, cp.data))
+			break;
+
+		kernel_ulong_t str = current_wordsize < sizeof(cp.p64)
+				     ? cp.p32 : cp.p64;
+
+		if (!str)
+			break;
+
+		/* Read the argument in chunks up to its terminating NUL.  */
+		for (int rc = 0; !rc; ) {
+			if (size - p->exec_cmdline_len < 2)
+				p->exec_cmdline = xgrowarray(p->exec_cmdline,
+							     &size, 1);
+
+			const unsigned int len = size - p->exec_cmdline_len - 1;
+
+			rc = umovestr(tcp, str, len,
+				      p->exec_cmdline + p->exec_cmdline_len);
+			if (rc < 0)
+				goto out;
+			p->exec_cmdline_len += rc ? (unsigned int) rc : len;
+			str += len;
+		}
+	}
+
+out:
+	if (!p->exec_cmdline)
+		p->exec_cmdline = xgrowarray(NULL, &size, 1);
+	/* Strip the terminating NUL of the last argument.  */
+	if (p->exec_cmdline_len &&
+	    !p->exec_cmdline[p->exec_cmdline_len - 1])
+		--p->exec_cmdline_len;
+	p->exec_cmdline[p->exec_cmdline_len] = '\0';
+}
+
+/* Called on PTRACE_EVENT_EXEC.  */
+void
+process_tree_exec(struct tcb *tcp)
+{
+	struct ptree_proc *const p = tcp->ptree_proc;
+
+	if (!p)
+		return;
+
+	p->exec = *get_event_ts();
+	p->nexecs++;
+	p->pid = tcp->pid;
+
+	if (p->exec_cmdline) {
+		free(p->cmdline);
+		p->cmdline = p->exec_cmdline;
+		p->cmdline_len = p->exec_cmdline_len;
+		p->exec_cmdline = NULL;
+		p->exec_cmdline_len = 0;
+	} else {
+		/*
+		 * The entering of the execve has not been seen,
+		 * e.g. it was not stopped by the seccomp filter.
+		 */
+		read_cmdline(p, tcp->pid);
+	}
+}
+
+/*
+ * Called when the execve of a non-leader thread has taken over the pid
+ * of the leader: the process keeps the record of the leader.
+ */
+void
+process_tree_switch(struct tcb *execve_thread, struct tcb *leader)
+{
+	struct ptree_proc *const thread = execve_thread->ptree_proc;
+
+	execve_thread->ptree_proc = leader->ptree_proc;
+	leader->ptree_proc = NULL;
+
+	if (thread) {
+		thread->end = *get_event_ts();
+		thread->state = PTREE_SUPERSEDED;
+
+		/* The arguments of the execve belong to the process now.  */
+		if (thread->exec_cmdline && execve_thread->ptree_proc) {
+			struct ptree_proc *const p = execve_thread->ptree_proc;
+
+			free(p->exec_cmdline);
+			p->exec_cmdline = thread->exec_cmdline;
+			p->exec_cmdline_len = thread->exec_cmdline_len;
+			thread->exec_cmdline = NULL;
+			thread->exec_cmdline_len = 0;
+		}
+	}
+}
+
+/* Called when the tracee is reaped, ru is its resource usage.  */
+void
+process_tree_exit(struct tcb *tcp, const int status, const struct rusage *ru)
+{
+	struct ptree_proc *const p = tcp->ptree_proc;
+
+	if (!p)
+		return;
+
+	p->end = *get_event_ts();
+	p->status = status;
+	p->state = WIFSIGNALED(status) ? PTREE_SIGNALLED : PTREE_EXITED;
+
+	struct timespec sys = {
+		.tv_sec = ru->ru_stime.tv_sec,
+		.tv_nsec = ru->ru_stime.tv_usec * 1000,
+	};
+
+	p->cpu.tv_sec = ru->ru_utime.tv_sec;
+	p->cpu.tv_nsec = ru->ru_utime.tv_usec * 1000;
+	ts_add(&p->cpu, &p->cpu, &sys);
+}
+
+static double
+ts_since_start(const struct timespec *ts)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, ts, &start_ts);
+
+	return ts_float(&dt);
+}
+
+/* Return the exit status, or NULL if the process has not been reaped.  */
+static const char *
+sprint_status(const struct ptree_proc *p)
+{
+	static char buf[sizeof("SIGRT_32 (core dumped)") + sizeof(int) * 3];
+
+	switch (p->state) {
+	case PTREE_EXITED:
+		xsprintf(buf, "%d", WEXITSTATUS(p->status));
+		return buf;
+	case PTREE_SIGNALLED:
+		xsprintf(buf, "%s%s", sprintsigname(WTERMSIG(p->status)),
+			 WCOREDUMP(p->status) ? " (core dumped)" : "");
+		return buf;
+	case PTREE_SUPERSEDED:
+		return "superseded";
+	case PTREE_RUNNING:
+		break;
+	}
+
+	return NULL;
+}
+
+static void
+print_text_proc(FILE *fp, const struct ptree_proc *p, const unsigned int depth)
+{
+	struct timespec wall;
+
+	ts_sub(&wall, &p->end, &p->start);
+
+	fprintf(fp, "%-7d %11.6f ", p->pid, ts_since_start(&p->start));
+	if (p->state == PTREE_RUNNING)
+		fprintf(fp, "%11s %11s ", "-", "-");
+	else
+		fprintf(fp, "%11.6f %11.6f ", ts_float(&wall),
+			ts_float(&p->cpu));
+
+	fprintf(fp, "%-10s ", sprint_status(p) ?: "-");
+
+	for (unsigned int i = 0; i < depth; ++i)
+		fputs("  ", fp);
+	if (depth)
+		fputs("`- ", fp);
+
+	if (p->thread)
+		fputs("(thread) ", fp);
+	for (size_t i = 0; i < p->cmdline_len; ++i)
+		fputc(p->cmdline[i] ? p->cmdline[i] : ' ', fp);
+	fputc('\n', fp);
+}
+
+static void
+print_text_tree(FILE *fp, const struct ptree_proc *p, const unsigned int depth)
+{
+	print_text_proc(fp, p, depth);
+	for (const struct ptree_proc *c = p->first_child; c;
+	     c = c->next_sibling)
+		print_text_tree(fp, c, depth + 1);
+}
+
+static void
+print_json_proc(FILE *fp, const struct ptree_proc *p)
+{
+	fprintf(fp, "{\"pid\": %d, \"ppid\": ", p->pid);
+	if (p->parent)
+		fprintf(fp, "%d", p->parent->pid);
+	else
+		fputs("null", fp);
+	fprintf(fp, ", \"thread\": %s, \"argv\": [",
+		p->thread ? "true" : "false");
+
+	if (p->cmdline_len) {
+		for (size_t i = 0; i <= p->cmdline_len;) {
+			const size_t len = strnlen(p->cmdline + i,
+						   p->cmdline_len - i);
+
+			if (i)
+				fputs(", ", fp);
+			fprint_json_string(fp, p->cmdline + i, len);
+			i += len + 1;
+		}
+	}
+
+	fprintf(fp, "], \"execs\": %u, \"start\": %.6f, \"exec\": ",
+		p->nexecs, ts_since_start(&p->start));
+	if (p->nexecs)
+		fprintf(fp, "%.6f", ts_since_start(&p->exec));
+	else
+		fputs("null", fp);
+
+	if (p->state == PTREE_RUNNING) {
+		fputs(", \"end\": null, \"wall\": null, \"cpu\": null", fp);
+	} else {
+		struct timespec wall;
+
+		ts_sub(&wall, &p->end, &p->start);
+		fprintf(fp, ", \"end\": %.6f, \"wall\": %.6f, \"cpu\": %.6f",
+			ts_since_start(&p->end), ts_float(&wall),
+			ts_float(&p->cpu));
+	}
+
+	const char *const status = sprint_status(p);
+
+	fputs(", \"status\": ", fp);
+	if (p->state == PTREE_EXITED)
+		fputs(status, fp);
+	else if (status)
+		fprint_json_string(fp, status, strlen(status));
+	else
+		fputs("null", fp);
+	fputc('}', fp);
+}
+
+void
+process_tree_print(FILE *fp)
+{
+	switch (process_tree_format) {
+	case PROCESS_TREE_NONE:
+		return;
+
+	case PROCESS_TREE_TEXT:
+		fprintf(fp, "%-7s %11s %11s %11s %-10s %s\n",
+			"pid", "start", "wall", "cpu", "status", "command");
+		for (size_t i = 0; i < nprocs_recorded; ++i) {
+			if (!procs[i]->parent)
+				print_text_tree(fp, procs[i], 0);
+		}
+		break;
+
+	case PROCESS_TREE_JSON:
+		fputs("[", fp);
+		for (size_t i = 0; i < nprocs_recorded; ++i) {
+			fputs(i ? ",\n " : "\n ", fp);
+			print_json_proc(fp, procs[i]);
+		}
+		fputs("\n]\n", fp);
+		break;
+	}
+}
@@ -0,0 +1,396 @@
+/*
+ * Seccomp user notification backend (--seccomp-notify option): instead of
+ * being traced with ptrace, the command is started under a seccomp filter
+ * that makes the selected syscalls wait for strace on their entering.
+ * strace receives them on the listener fd of the filter, decodes their
+ * arguments, reading the memory of the waiting tasks with process_vm_readv,
+ * and lets them continue.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "filter_seccomp.h"
+#include "scno.h"
+#include "syscall.h"
+
+bool seccomp_notify;
+
+#ifdef HAVE_LINUX_SECCOMP_H
+# include <linux/seccomp.h>
+#endif
+
+#if defined SECCOMP_USER_NOTIF_FLAG_CONTINUE && defined __NR_futex
+
+# define XLAT_MACROS_ONLY
+#  include "xlat/futexops.h"
+# undef XLAT_MACROS_ONLY
+
+/*
+ * The listener fd is created by the child when it installs the filter,
+ * just before its execve.  The child cannot send it to strace over
+ * a socket, as every syscall it makes after that may wait for strace,
+ * so it only stores the number of the fd in this shared page,
+ * and strace takes the fd with pidfd_getfd.  The child wakes strace
+ * with FUTEX_WAKE on the page, which the filter lets through.
+ */
+static volatile int *listener_handoff;
+
+static struct seccomp_notif_sizes notif_sizes;
+
+/*
+ * The tasks are not traced, so strace does not learn about their deaths
+ * from wait.  Every thread group of the tcbs is watched with a pidfd
+ * instead, which becomes readable once all of its threads have exited,
+ * e.g. after a fatal signal.  The listener fd and the pidfds are polled
+ * with an epoll fd, the listener fd has tgid 0.
+ */
+struct notify_group {
+	int tgid;
+	int pidfd;
+};
+
+static int epoll_fd = -1;
+static struct notify_group *groups;
+static size_t ngroups;
+static size_t groups_size;
+
+/* The listener fd and the id of the notification being decoded.  */
+static int listener_fd = -1;
+static uint64_t decoded_id;
+static bool decoding;
+
+void
+seccomp_notify_prepare(void)
+{
+	void *p = mmap(NULL, sizeof(*listener_handoff),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (p == MAP_FAILED)
+		perror_msg_and_die("mmap");
+	listener_handoff = p;
+
+	if (!check_seccomp_notify_filter(p))
+		error_msg_and_die("--seccomp-notify: no usable seccomp filter");
+
+	if (syscall(__NR_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &notif_sizes))
+		perror_msg_and_die("--seccomp-notify: "
+				   "seccomp(SECCOMP_GET_NOTIF_SIZES)");
+}
+
+/* Called in the child just before its execve.  */
+void
+seccomp_notify_install(void)
+{
+	*listener_handoff = init_seccomp_notify_filter();
+	syscall(__NR_futex, listener_handoff, FUTEX_WAKE, INT_MAX,
+		NULL, NULL, 0);
+}
+
+/* Take the listener fd of the filter installed by the child pid.  */
+int
+seccomp_notify_listen(const int pid)
+{
+	const int pidfd = syscall(__NR_pidfd_open, pid, 0);
+
+	if (pidfd < 0)
+		perror_msg_and_die("pidfd_open");
+
+	/*
+	 * The timeout only bounds the time it takes to notice that
+	 * the child has died before installing the filter.
+	 */
+	const struct timespec timeout = { .tv_sec = 1 };
+
+	while (!*listener_handoff) {
+		if (syscall(__NR_futex, listener_handoff, FUTEX_WAIT, 0,
+			    &timeout, NULL, 0) == 0 || errno == EAGAIN)
+			continue;
+		if (errno != ETIMEDOUT && errno != EINTR)
+			perror_msg_and_die("futex");
+
+		siginfo_t si = { .si_pid = 0 };
+
+		if (!waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT)
+		    && si.si_pid)
+			error_msg_and_die("--seccomp-notify: the child exited "
+					  "before installing the filter");
+	}
+
+	/* The fd is close-on-exec already.  */
+	const int fd = syscall(__NR_pidfd_getfd, pidfd, *listener_handoff, 0);
+
+	if (fd < 0)
+		perror_msg_and_die("pidfd_getfd");
+
+	close(pidfd);
+	munmap((void *) listener_handoff, sizeof(*listener_handoff));
+	listener_handoff = NULL;
+
+	return fd;
+}
+
+static void
+epoll_add(const int fd, const int tgid)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.u64 = (uint64_t) (unsigned int) fd << 32
+			    | (unsigned int) tgid,
+	};
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		perror_msg_and_die("epoll_ctl");
+}
+
+/*
+ * Watch the thread group of a new tcb.
+ * Return false if the thread group is gone already.
+ */
+static bool
+watch_group(const int tgid)
+{
+	if (tgid <= 0)
+		return false;
+
+	for (size_t i = 0; i < ngroups; ++i) {
+		if (groups[i].tgid == tgid)
+			return true;
+	}
+
+	const int pidfd = syscall(__NR_pidfd_open, tgid, 0);
+
+	if (pidfd < 0) {
+		if (errno == ESRCH)
+			return false;
+		perror_msg_and_die("pidfd_open");
+	}
+
+	epoll_add(pidfd, tgid);
+
+	if (ngroups >= groups_size)
+		groups = xgrowarray(groups, &groups_size, sizeof(*groups));
+	groups[ngroups].tgid = tgid;
+	groups[ngroups].pidfd = pidfd;
+	++ngroups;
+
+	return true;
+}
+
+static void
+unwatch_group(const int pidfd)
+{
+	close(pidfd);
+
+	for (size_t i = 0; i < ngroups; ++i) {
+		if (groups[i].pidfd == pidfd) {
+			groups[i] = groups[--ngroups];
+			break;
+		}
+	}
+}
+
+/*
+ * Whether the task of the notification being decoded is still waiting
+ * for strace: after it has been killed, its pid and memory may belong
+ * to another task.  Called after every read of its memory.
+ */
+bool
+seccomp_notify_id_valid(void)
+{
+	if (!decoding)
+		return true;
+
+	uint64_t id = decoded_id;
+
+	return ioctl(listener_fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &id) == 0;
+}
+
+/*
+ * Receive a notification, print its syscall for the tcb returned
+ * by get_tcb, and let it continue.
+ */
+static void
+handle_notification(const int fd, struct tcb *(*get_tcb)(int pid),
+		    void (*drop_tcb)(struct tcb *),
+		    void (*forget_group)(int tgid, bool exited))
+{
+	static struct seccomp_notif *req;
+	static struct seccomp_notif_resp *resp;
+
+	if (!req) {
+		req = xzalloc(MAX(sizeof(*req), notif_sizes.seccomp_notif));
+		resp = xzalloc(MAX(sizeof(*resp),
+				   notif_sizes.seccomp_notif_resp));
+	}
+
+	memset(req, 0, MAX(sizeof(*req), notif_sizes.seccomp_notif));
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_RECV, req) < 0) {
+		switch (errno) {
+		case EINTR:
+		case ENOENT:
+			/* The task has been killed before it was received.  */
+			return;
+		}
+		perror_msg_and_die("ioctl(SECCOMP_IOCTL_NOTIF_RECV)");
+	}
+
+	/* The cached memory may be of another task.  */
+	invalidate_umove_cache();
+
+	listener_fd = fd;
+	decoded_id = req->id;
+	decoding = true;
+
+	/*
+	 * The task waits until the response, so its pid and memory stay
+	 * the same while it is decoded, unless it is killed meanwhile:
+	 * the id of the notification is checked after get_tcb has looked
+	 * the pid up in /proc, and after every read of the memory.
+	 */
+	struct tcb *tcp = get_tcb(req->pid);
+
+	if (tcp && (!seccomp_notify_id_valid() || !watch_group(tcp->tgid))) {
+		drop_tcb(tcp);
+		tcp = NULL;
+	}
+
+	if (tcp) {
+		uint64_t args[6];
+
+		for (unsigned int i = 0; i < ARRAY_SIZE(args); ++i)
+			args[i] = req->data.args[i];
+		syscall_trace_seccomp_notify(tcp,
+			seccomp_data_personality(req->data.arch, req->data.nr),
+			req->data.nr, args);
+	}
+
+	decoding = false;
+
+	memset(resp, 0, MAX(sizeof(*resp), notif_sizes.seccomp_notif_resp));
+	resp->id = req->id;
+	resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+	if (ioctl(fd, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0) {
+		if (errno != ENOENT)
+			perror_msg_and_die("ioctl(SECCOMP_IOCTL_NOTIF_SEND)");
+		/* The task has been killed.  */
+		if (tcp)
+			drop_tcb(tcp);
+		return;
+	}
+
+	if (!tcp)
+		return;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_exit:
+		/* exit_group shares the decoder of exit.  */
+		if (strcmp(tcp_sysent(tcp)->sys_name, "exit_group"))
+			drop_tcb(tcp);
+		else
+			forget_group(tcp->tgid, true);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		/*
+		 * A successful execve kills the other threads, and the pid
+		 * of the process is taken over by the thread that called it.
+		 */
+		forget_group(tcp->tgid, false);
+		break;
+	}
+}
+
+/*
+ * Wait for the next notification on the listener fd or the exit
+ * of a thread group, and handle it.  get_tcb returns the tcb of a pid,
+ * a tcb is passed to drop_tcb once its task is gone, and the tgid
+ * of a thread group is passed to forget_group after all of its tasks
+ * have exited, or after one of them has called execve, which may
+ * have killed the others.
+ * Return 1 if there may be more notifications, 0 if there are no tasks
+ * under the filter left, -1 if the wait has been interrupted by a signal.
+ */
+int
+seccomp_notify_next(const int fd, struct tcb *(*get_tcb)(int pid),
+		    void (*drop_tcb)(struct tcb *),
+		    void (*forget_group)(int tgid, bool exited))
+{
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0)
+			perror_msg_and_die("epoll_create1");
+		epoll_add(fd, 0);
+	}
+
+	struct epoll_event ev;
+	const int rc = epoll_wait(epoll_fd, &ev, 1, -1);
+
+	if (rc < 0) {
+		if (errno == EINTR)
+			return -1;
+		perror_msg_and_die("epoll_wait");
+	}
+	if (!rc)
+		return 1;
+
+	const int tgid = (unsigned int) ev.data.u64;
+
+	if (tgid) {
+		forget_group(tgid, true);
+		unwatch_group(ev.data.u64 >> 32);
+		return 1;
+	}
+
+	if (!(ev.events & EPOLLIN))
+		return 0;
+
+	handle_notification(fd, get_tcb, drop_tcb, forget_group);
+
+	return 1;
+}
+
+#else /* !SECCOMP_USER_NOTIF_FLAG_CONTINUE || !__NR_futex */
+
+void
+seccomp_notify_prepare(void)
+{
+	error_msg_and_die("--seccomp-notify is not supported by this build"
+			  " of strace");
+}
+
+void
+seccomp_notify_install(void)
+{
+}
+
+int
+seccomp_notify_listen(const int pid)
+{
+	return -1;
+}
+
+int
+seccomp_notify_next(const int fd, struct tcb *(*get_tcb)(int pid),
+		    void (*drop_tcb)(struct tcb *),
+		    void (*forget_group)(int tgid, bool exited))
+{
+	return 0;
+}
+
+bool
+seccomp_notify_id_valid(void)
+{
+	return true;
+}
+
+#endif
@@ -9,10 +9,13 @@
 /*
  * open_memstream returns a FILE stream that allows writing to a
  * dynamically growing buffer, that can be either copied to
- * tcp->outf (syscall successful) or dropped (syscall failed)
+ * tcp->outf (syscall successful or slow enough) or dropped (syscall failed
+ * or too fast), or kept for the report of the slowest syscalls,
+ * or in the flight recorder.
  */
 
 #include "defs.h"
+#include "number_set.h"
 
 struct staged_output_data {
 	char *memfptr;
@@ -20,6 +23,15 @@ struct staged_output_data {
 	FILE *real_outf;	/* Backup for real outf while staging */
 };
 
+/* Whether syscall output is to be staged before it is published. */
+bool
+syscall_output_staged(void)
+{
+	return !is_complete_set(status_set, NUMBER_OF_STATUSES)
+	       || slowest_count || ts_nz(&min_duration)
+	       || flight_recorder_size || timeline_file;
+}
+
 FILE *
 strace_open_memstream(struct tcb *tcp)
 {
@@ -45,6 +57,35 @@ strace_open_memstream(struct tcb *tcp)
 	return fp;
 }
 
+#if HAVE_OPEN_MEMSTREAM
+/*
+ * Close the staged output stream of tcp and restore its real outf,
+ * return the staged output to be freed by the caller.
+ */
+static char *
+close_memstream(struct tcb *tcp)
+{
+	if (fclose(tcp->outf))
+		perror_msg("fclose(tcp->outf)");
+
+	tcp->outf = tcp->staged_output_data->real_outf;
+
+	char *buf = tcp->staged_output_data->memfptr;
+
+	free(tcp->staged_output_data);
+	tcp->staged_output_data = NULL;
+
+	return buf;
+}
+#endif
+
+/* The size of the output staged for tcp so far. */
+size_t
+strace_staged_output_size(const struct tcb *tcp)
+{
+	return tcp->staged_output_data ? tcp->staged_output_data->memfloc : 0;
+}
+
 void
 strace_close_memstream(struct tcb *tcp, bool publish)
 {
@@ -54,22 +95,226 @@ strace_close_memstream(struct tcb *tcp, bool publish)
 		return;
 	}
 
-	if (fclose(tcp->outf))
-		perror_msg("fclose(tcp->outf)");
+	char *buf = close_memstream(tcp);
 
-	tcp->outf = tcp->staged_output_data->real_outf;
-	if (tcp->staged_output_data->memfptr) {
+	if (buf) {
 		if (publish)
-			fputs_unlocked(tcp->staged_output_data->memfptr,
-				       tcp->outf);
+			fputs_unlocked(buf, tcp->outf);
 		else
-			debug_msg("syscall output dropped: %s",
-				  tcp->staged_output_data->memfptr);
+			debug_msg("syscall output dropped: %s", buf);
 
-		free(tcp->staged_output_data->memfptr);
-		tcp->staged_output_data->memfptr = NULL;
+		free(buf);
+	}
+#endif
+}
+
+/*
+ * The N slowest syscalls seen so far (--slowest=N option),
+ * kept as a min-heap ordered by duration.
+ */
+struct slow_syscall {
+	struct timespec duration;
+	struct timespec start;	/* wall clock time of syscall entering */
+	int pid;
+	char *output;
+};
+
+static struct slow_syscall *slowest;
+static size_t slowest_used;
+static size_t slowest_bytes;	/* total size of the kept output */
+
+static void
+slowest_swap(const size_t i, const size_t j)
+{
+	const struct slow_syscall tmp = slowest[i];
+
+	slowest[i] = slowest[j];
+	slowest[j] = tmp;
+}
+
+static void
+slowest_sift_up(size_t i)
+{
+	while (i > 0) {
+		const size_t parent = (i - 1) / 2;
+
+		if (ts_cmp(&slowest[parent].duration, &slowest[i].duration) <= 0)
+			break;
+		slowest_swap(i, parent);
+		i = parent;
+	}
+}
+
+static void
+slowest_sift_down(size_t i)
+{
+	for (;;) {
+		const size_t left = 2 * i + 1;
+		const size_t right = left + 1;
+		size_t min = i;
+
+		if (left < slowest_used &&
+		    ts_cmp(&slowest[left].duration, &slowest[min].duration) < 0)
+			min = left;
+		if (right < slowest_used &&
+		    ts_cmp(&slowest[right].duration, &slowest[min].duration) < 0)
+			min = right;
+		if (min == i)
+			break;
+		slowest_swap(i, min);
+		i = min;
+	}
+}
+
+/*
+ * Offer the output of a syscall of tcp that took the given duration
+ * to the slowest syscalls heap, the output is either taken or freed.
+ */
+static void
+slowest_add(struct tcb *tcp, const struct timespec *duration, char *output)
+{
+	if (!slowest)
+		slowest = xcalloc(slowest_count, sizeof(*slowest));
+
+	size_t i;
+
+	if (slowest_used < slowest_count) {
+		i = slowest_used++;
+	} else if (ts_cmp(duration, &slowest[0].duration) > 0) {
+		slowest_bytes -= strlen(slowest[0].output);
+		free(slowest[0].output);
+		i = 0;
+	} else {
+		free(output);
+		return;
+	}
+
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	ts_sub(&elapsed, get_event_ts(), &tcp->etime);
+
+	slowest[i].duration = *duration;
+	ts_sub(&slowest[i].start, &now, &elapsed);
+	slowest[i].pid = tcp->pid;
+	slowest[i].output = output;
+	slowest_bytes += strlen(output);
+
+	if (i)
+		slowest_sift_up(i);
+	else
+		slowest_sift_down(0);
+}
+
+/*
+ * Finish staging of the current syscall of tcp that ended at end_ts
+ * (or is still in progress if end_ts is NULL): publish its output,
+ * drop it, or hand it over to the --slowest report or the flight recorder,
+ * and add it to the --timeline.
+ */
+void
+strace_finish_staged_output(struct tcb *tcp, bool publish,
+			    const struct timespec *end_ts)
+{
+#if HAVE_OPEN_MEMSTREAM
+	if (!tcp->staged_output_data) {
+		debug_msg("memstream already closed");
+		return;
+	}
+
+	struct timespec now, duration;
+
+	if (publish &&
+	    (slowest_count || ts_nz(&min_duration) || timeline_file)) {
+		if (!end_ts) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			end_ts = &now;
+		}
+		ts_sub(&duration, end_ts, &tcp->etime);
+
+		if (ts_nz(&min_duration) && ts_cmp(&duration, &min_duration) < 0)
+			publish = false;
+	}
+
+	if (!slowest_count && !flight_recorder_size && !timeline_file) {
+		strace_close_memstream(tcp, publish);
+		return;
+	}
+
+	char *buf = close_memstream(tcp);
+
+	if (!buf)
+		return;
+
+	if (!publish) {
+		debug_msg("syscall output dropped: %s", buf);
+		free(buf);
+		return;
+	}
+
+	if (timeline_file)
+		timeline_syscall(tcp, &duration, buf);
+
+	if (flight_recorder_size) {
+		flight_recorder_add(tcp, buf);
+	} else if (slowest_count) {
+		slowest_add(tcp, &duration, buf);
+	} else {
+		fputs_unlocked(buf, tcp->outf);
+		free(buf);
 	}
-	free(tcp->staged_output_data);
-	tcp->staged_output_data = NULL;
 #endif
 }
+
+size_t
+slowest_output_size(void)
+{
+	return slowest_bytes;
+}
+
+static int
+slow_syscall_cmp(const void *a, const void *b)
+{
+	return -ts_cmp(&((const struct slow_syscall *) a)->duration,
+		       &((const struct slow_syscall *) b)->duration);
+}
+
+void
+slowest_summary(FILE *outf)
+{
+	if (!slowest_used)
+		return;
+
+	qsort(slowest, slowest_used, sizeof(*slowest), slow_syscall_cmp);
+
+	static const char dashes[] = "----------------";
+
+	fprintf(outf, "%11s %7s %15s %s\n",
+		"seconds", "pid", "started", "syscall");
+	fprintf(outf, "%.11s %.7s %.15s %.16s\n",
+		dashes, dashes, dashes, dashes);
+
+	for (size_t i = 0; i < slowest_used; ++i) {
+		const struct slow_syscall *const s = &slowest[i];
+		char str[sizeof("HH:MM:SS")];
+		struct tm *tm = localtime(&s->start.tv_sec);
+
+		if (!tm || !strftime(str, sizeof(str), "%T", tm))
+			strcpy(str, "??:??:??");
+
+		fprintf(outf, "%11.6f %7d %s.%06ld %s",
+			ts_float(&s->duration), s->pid, str,
+			(long) s->start.tv_nsec / 1000, s->output);
+
+		const size_t len = strlen(s->output);
+		if (!len || s->output[len - 1] != '\n')
+			fputc('\n', outf);
+
+		free(s->output);
+	}
+
+	free(slowest);
+	slowest = NULL;
+	slowest_used = 0;
+	slowest_bytes = 0;
+}
@@ -49,10 +49,15 @@ extern char *optarg;
 #ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+enum stack_summary_weight stack_summary;
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
 
+#ifndef CLOCK_BOOTTIME
+# define CLOCK_BOOTTIME 7
+#endif
+
 /* Glue for systems without a MMU that cannot provide fork() */
 #if !defined(HAVE_FORK)
 # undef NOMMU_SYSTEM
@@ -73,6 +78,17 @@ static struct xlat_data xflag_str[] = {
 	{ HEXSTR_NON_ASCII,	"non-ascii" },
 	{ HEXSTR_ALL,		"all" },
 };
+#ifdef ENABLE_STACKTRACE
+static const struct xlat_data stack_summary_str[] = {
+	{ STACK_SUMMARY_COUNT,	"folded" },
+	{ STACK_SUMMARY_COUNT,	"folded:count" },
+	{ STACK_SUMMARY_TIME,	"folded:time" },
+};
+#endif
+static const struct xlat_data process_tree_str[] = {
+	{ PROCESS_TREE_TEXT,	"text" },
+	{ PROCESS_TREE_JSON,	"json" },
+};
 unsigned int xflag;
 bool debug_flag;
 bool Tflag;
@@ -80,9 +96,14 @@ int Tflag_scale = 1000;
 int Tflag_width = 6;
 bool iflag;
 bool count_wallclock;
+bool count_io;
+unsigned int slowest_count;
+unsigned int flight_recorder_size;
+struct timespec min_duration;
 static int tflag_scale = 1000000000;
 static unsigned tflag_width = 0;
 static const char *tflag_format = NULL;
+static clockid_t tflag_clock = CLOCK_REALTIME;
 static bool rflag;
 static int rflag_scale = 1000;
 static int rflag_width = 6;
@@ -137,6 +158,8 @@ static bool detach_on_execve;
 
 static int exit_code;
 static int strace_child;
+/* The listener fd of the filter of strace_child, for --seccomp-notify.  */
+static int seccomp_notify_fd = -1;
 static int strace_tracer_pid;
 
 static const char *username;
@@ -154,6 +177,7 @@ static const char *outfname;
 /* If -ff, points to stderr. Else, it's our common output log */
 static FILE *shared_log;
 static bool open_append;
+static bool output_thread;
 
 struct tcb *printing_tcp;
 static struct tcb *current_tcp;
@@ -169,6 +193,16 @@ static struct tcb **tcbtab;
 static unsigned int nprocs;
 static size_t tcbtabsize;
 
+/*
+ * The tcbs in use hashed by pid for pid2tcb(), with at least as many buckets
+ * as there are tcbs, and the unused tcbs, so that neither the lookup
+ * of the tracee of an event nor the allocation of a tcb for a new one
+ * has to scan tcbtab.
+ */
+static struct tcb **pid_hash;
+static size_t pid_hash_size;	/* a power of 2 */
+static struct tcb *free_tcbs;
+
 static struct tcb_wait_data *tcb_wait_tab;
 static size_t tcb_wait_tab_size;
 
@@ -182,16 +216,51 @@ unsigned os_release; /* generated from uname()'s u.release */
 static void detach(struct tcb *tcp);
 static void cleanup(int sig);
 static void interrupt(int sig);
+static void flight_recorder_sighandler(int sig);
+static void request_sighandler(int sig);
+static void io_sighandler(int sig);
+static struct tcb *pid2tcb(int pid);
 
 #ifdef HAVE_SIG_ATOMIC_T
 static volatile sig_atomic_t interrupted, restart_failed;
+static volatile sig_atomic_t flight_recorder_requested;
+static volatile sig_atomic_t snapshot_requested, control_requested;
+static volatile sig_atomic_t perf_read_requested;
 #else
 static volatile int interrupted, restart_failed;
+static volatile int flight_recorder_requested;
+static volatile int snapshot_requested, control_requested;
+static volatile int perf_read_requested;
 #endif
 
+static const char *control_path;
+static const char *cgroup_path;
+/* SIGCHLD, blocked with --cgroup to be read by cgroup_wait.  */
+static sigset_t cgroup_wait_set;
+/* The members of the cgroup that are not permitted to be attached to.  */
+static int *cgroup_denied_pids;
+static size_t cgroup_denied_count, cgroup_denied_size;
+/* The denied members still found in the cgroup by the current scan.  */
+static size_t cgroup_denied_kept;
+static uint64_t event_count;
+/* The time and the event count of the previous snapshot */
+static struct timespec snapshot_ts;
+
+/* Attach latency and the longest stop of the tracees of startup_attach.  */
+static struct timespec attach_start_ts, attach_latency, attach_max_stop;
+static unsigned int attach_count, attach_pending;
+static uint64_t snapshot_event_count;
+
 static sigset_t timer_set;
 static void timer_sighandler(int);
 
+/*
+ * The signals that request work from the main loop are blocked except
+ * while waiting for tracees, so they never interrupt writing of the output.
+ */
+static sigset_t request_set;
+static bool request_signals;
+
 #ifndef HAVE_STRERROR
 
 # if !HAVE_DECL_SYS_ERRLIST
@@ -278,6 +347,8 @@ Startup:\n\
                  remove VAR from the environment for command\n\
   -p PID, --attach=PID\n\
                  trace process with process id PID, may be repeated\n\
+  --cgroup=PATH  trace all processes of the cgroup PATH and its new members,\n\
+                 implies -f\n\
   -u USERNAME, --user=USERNAME\n\
                  run command as USERNAME handling setuid and/or setgid\n\
 \n\
@@ -305,6 +376,9 @@ Filtering:\n\
   -e trace=[!]{[?]SYSCALL[@64|@32|@x32]|[?]/REGEX|GROUP|all|none},\n\
   --trace=[!]{[?]SYSCALL[@64|@32|@x32]|[?]/REGEX|GROUP|all|none}\n\
                  trace only specified syscalls.\n\
+  -e trace=SET:PREDICATE[:PREDICATE]...\n\
+                 trace syscalls from SET only when their arguments match\n\
+     predicates: argN=VALUE, argN&MASK, fd=VALUE (same as arg0=VALUE)\n\
      groups:     %%creds, %%desc, %%file, %%fstat, %%fstatfs %%ipc, %%lstat,\n\
                  %%memory, %%net, %%process, %%pure, %%signal, %%stat, %%%%stat,\n\
                  %%statfs, %%%%statfs\n\
@@ -320,6 +394,16 @@ Filtering:\n\
                  print only syscalls that returned without an error code\n\
   -Z, --failed-only\n\
                  print only syscalls that returned with an error code\n\
+  --min-duration=TIME[UNIT]\n\
+                 print only syscalls that took longer than TIME UNITs\n\
+     units:      one of s, ms, us, ns; default is microseconds\n\
+  --flight-recorder=N\n\
+                 keep the last N syscalls of each process in memory and\n\
+                 print them on an error selected by --dump-on-error, a fatal\n\
+                 signal or a non-zero exit of a tracee, or SIGUSR2\n\
+  --dump-on-error=[SYSCALL_SET:]ERRNO_SET\n\
+                 dump the flight recorder when a syscall from SYSCALL_SET\n\
+                 fails with an error from ERRNO_SET\n\
 \n\
 Output format:\n\
   -a COLUMN, --columns=COLUMN\n\
@@ -349,6 +433,10 @@ Output format:\n\
 "\
   -k, --stack-traces\n\
                  obtain stack trace between each syscall\n\
+  --stack-summary=folded[:count|:time]\n\
+                 instead of printing syscalls, report their stacks on exit\n\
+                 in the folded format of flamegraph.pl, weighted by\n\
+                 the number of calls (default) or by microseconds spent\n\
 "
 #endif
 "\
@@ -358,6 +446,12 @@ Output format:\n\
                  open the file provided in the -o option in append mode\n\
   --output-separately\n\
                  output into separate files (by appending pid to file names)\n\
+  --timeline=FILE\n\
+                 write the syscalls of every thread to FILE in the trace\n\
+                 event format of the Chrome and Perfetto trace viewers\n\
+  --output-thread\n\
+                 write the trace output from a separate thread, so that\n\
+                 tracees are not stopped while the output is written\n\
   -q, --quiet=attach,personality\n\
                  suppress messages about attaching, detaching, etc.\n\
   -qq, --quiet=attach,personality,exit\n\
@@ -369,10 +463,11 @@ Output format:\n\
      precision:  one of s, ms, us, ns; default is microseconds\n\
   -s STRSIZE, --string-limit=STRSIZE\n\
                  limit length of print strings to STRSIZE chars (default %d)\n\
-  --absolute-timestamps=[[format:]FORMAT[,[precision:]PRECISION]]\n\
+  --absolute-timestamps=[[format:]FORMAT[,[precision:]PRECISION][,clock:CLOCK]]\n\
                  set the format of absolute timestamps\n\
      format:     none, time, or unix; default is time\n\
      precision:  one of s, ms, us, ns; default is seconds\n\
+     clock:      realtime, monotonic, or boottime; default is realtime\n\
   -t, --absolute-timestamps[=time]\n\
                  print absolute timestamp\n\
   -tt, --absolute-timestamps=[time,]us\n\
@@ -400,7 +495,7 @@ Output format:\n\
 Statistics:\n\
   -c, --summary-only\n\
                  count time, calls, and errors for each syscall and report\n\
-                 summary\n\
+                 summary (SIGUSR1 prints the current summary to stderr)\n\
   -C, --summary  like -c, but also print the regular output\n\
   -O OVERHEAD[UNIT], --summary-syscall-overhead=OVERHEAD[UNIT]\n\
                  set overhead for tracing syscalls to OVERHEAD UNITs\n\
@@ -411,10 +506,23 @@ Statistics:\n\
   -U COLUMNS, --summary-columns=COLUMNS\n\
                  show specific columns in the summary report: comma-separated\n\
                  list of time-percent, total-time, min-time, max-time, \n\
-                 avg-time, calls, errors, name\n\
+                 avg-time, calls, errors, errnos, name\n\
                  (default time-percent,total-time,avg-time,calls,errors,name)\n\
   -w, --summary-wall-clock\n\
                  summarise syscall latency (default is system time)\n\
+  --summary-io   also report bytes, calls, and latency of I/O syscalls\n\
+                 for each file descriptor and the path it refers to\n\
+  --summary-backend=BACKEND\n\
+                 count syscalls with: ptrace, perf (default ptrace)\n\
+  --slowest=N    report N slowest syscalls with their decoded output\n\
+                 instead of printing them\n\
+  --build-profile[=text|json]\n\
+                 follow forks and report the process tree without tracing\n\
+                 syscalls other than execve, using a seccomp filter\n\
+  --process-tree[=text|json]\n\
+                 report the parent, command, start time, wall and CPU time,\n\
+                 and exit status of every traced process (requires -f\n\
+                 for the children)\n\
 \n\
 Tampering:\n\
   -e inject=SET[:error=ERRNO|:retval=VALUE][:signal=SIG][:syscall=SYSCALL]\n\
@@ -428,9 +536,20 @@ Tampering:\n\
                  synonym for -e inject with default ERRNO set to ENOSYS.\n\
 \n\
 Miscellaneous:\n\
+  --control=PATH serve requests for the current summary and filter changes\n\
+                 on UNIX socket PATH\n\
+  --merge=STRACE_LOG\n\
+                 merge the STRACE_LOG.PID files written by -ff -tt[t]\n\
+                 into the standard output and exit\n\
   -d, --debug    enable debug output to stderr\n\
   -h, --help     print help message\n\
   --seccomp-bpf  enable seccomp-bpf filtering\n\
+  --seccomp-notify\n\
+                 trace PROG with seccomp user notifications instead of\n\
+                 ptrace, showing syscalls on entering only\n\
+  --seccomp-profile=FILE\n\
+                 build the seccomp filter for the syscall counts\n\
+                 in FILE, the output of strace -c\n\
   -V, --version  print version\n\
 "
 /* ancient, no one should use it
@@ -736,6 +855,103 @@ set_current_tcp(const struct tcb *tcp)
 		set_personality(current_tcp->currpers);
 }
 
+/* CLOCK_MONOTONIC time of the current event, read on its first use.  */
+static struct timespec event_ts;
+static bool event_ts_valid;
+
+static void
+reset_event_ts(void)
+{
+	event_ts_valid = false;
+}
+
+/*
+ * Return the time of the current event.  The clock is read once per event,
+ * the same value is used for timestamps, syscall times, and statistics.
+ */
+const struct timespec *
+get_event_ts(void)
+{
+	if (!event_ts_valid) {
+		clock_gettime(CLOCK_MONOTONIC, &event_ts);
+		event_ts_valid = true;
+	}
+
+	return &event_ts;
+}
+
+/* Write the fraction of a second nsec/scale as width decimal digits.  */
+static char *
+format_ts_frac(char *p, long nsec, unsigned int width, int scale)
+{
+	long frac = nsec / scale;
+
+	for (unsigned int i = width; i; --i) {
+		p[i - 1] = '0' + frac % 10;
+		frac /= 10;
+	}
+
+	return p + width;
+}
+
+/*
+ * Print the absolute timestamp of the event that happened at the given
+ * CLOCK_MONOTONIC time.  The time of tflag_clock is derived from it using
+ * an offset that is refreshed, along with the formatted seconds, only when
+ * the second changes, so most lines cost neither a clock read
+ * nor a localtime/strftime call.
+ */
+static void
+print_absolute_ts(const struct timespec *mono)
+{
+	static struct timespec offset;
+	static time_t cached_sec;
+	static bool cached;
+	static char sec_str[MAX(sizeof("HH:MM:SS"), sizeof(time_t) * 3)];
+	static size_t sec_len;
+
+	struct timespec ts;
+	ts_add(&ts, mono, &offset);
+
+	if (!cached || ts.tv_sec != cached_sec) {
+		if (tflag_clock != CLOCK_MONOTONIC) {
+			struct timespec now_mono, now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now_mono);
+			clock_gettime(tflag_clock, &now);
+			ts_sub(&offset, &now, &now_mono);
+			ts_add(&ts, mono, &offset);
+		}
+
+		const time_t sec = ts.tv_sec;
+		struct tm *tm = NULL;
+
+		if (strcmp(tflag_format, "%s"))
+			tm = tflag_clock == CLOCK_REALTIME ? localtime(&sec)
+							   : gmtime(&sec);
+		if (tm)
+			strftime(sec_str, sizeof(sec_str), tflag_format, tm);
+		else
+			xsprintf(sec_str, "%lld", (long long) sec);
+
+		sec_len = strlen(sec_str);
+		cached_sec = sec;
+		cached = true;
+	}
+
+	char str[sizeof(sec_str) + sizeof(".123456789 ")];
+	char *p = mempcpy(str, sec_str, sec_len);
+
+	if (tflag_width) {
+		*p++ = '.';
+		p = format_ts_frac(p, ts.tv_nsec, tflag_width, tflag_scale);
+	}
+	*p++ = ' ';
+	*p = '\0';
+
+	tprints(str);
+}
+
 void
 printleader(struct tcb *tcp)
 {
@@ -769,43 +985,33 @@ printleader(struct tcb *tcp)
 	else if (nprocs > 1 && !outfname)
 		tprintf("[pid %5u] ", tcp->pid);
 
-	if (tflag_format) {
-		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-
-		time_t local = ts.tv_sec;
-		char str[MAX(sizeof("HH:MM:SS"), sizeof(local) * 3)];
-		struct tm *tm = localtime(&local);
-
-		if (tm)
-			strftime(str, sizeof(str), tflag_format, tm);
-		else
-			xsprintf(str, "%lld", (long long) local);
-		if (tflag_width)
-			tprintf("%s.%0*ld ", str, tflag_width,
-				(long) ts.tv_nsec / tflag_scale);
-		else
-			tprintf("%s ", str);
-	}
+	if (tflag_format)
+		print_absolute_ts(get_event_ts());
 
 	if (rflag) {
-		struct timespec ts;
-		clock_gettime(CLOCK_MONOTONIC, &ts);
+		const struct timespec *ts = get_event_ts();
 
 		static struct timespec ots;
 		if (ots.tv_sec == 0)
-			ots = ts;
+			ots = *ts;
 
 		struct timespec dts;
-		ts_sub(&dts, &ts, &ots);
-		ots = ts;
+		ts_sub(&dts, ts, &ots);
+		ots = *ts;
+
+		char str[sizeof("(+") + sizeof(long) * 3 + sizeof(".123456789) ")];
+		char *p = str + xsprintf(str, "%s%6ld",
+					 tflag_format ? "(+" : "",
+					 (long) dts.tv_sec);
 
-		tprintf("%s%6ld", tflag_format ? "(+" : "", (long) dts.tv_sec);
 		if (rflag_width) {
-			tprintf(".%0*ld",
-				rflag_width, (long) dts.tv_nsec / rflag_scale);
+			*p++ = '.';
+			p = format_ts_frac(p, dts.tv_nsec, rflag_width,
+					   rflag_scale);
 		}
-		tprints(tflag_format ? ") " : " ");
+		strcpy(p, tflag_format ? ") " : " ");
+
+		tprints(str);
 	}
 
 	if (iflag)
@@ -832,7 +1038,13 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 		char name[PATH_MAX];
 		xsprintf(name, "%s.%u", outfname, tcp->pid);
 		tcp->outf = strace_fopen(name);
+		if (output_thread)
+			tcp->outf = output_thread_wrap(tcp->outf, name);
 	}
+	if (timeline_file)
+		timeline_attach(tcp);
+	if (perf_summary)
+		perf_summary_attach(tcp);
 
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled)
@@ -840,6 +1052,59 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 #endif
 }
 
+static struct tcb **
+pid_hash_bucket(const int pid)
+{
+	return &pid_hash[(unsigned int) pid & (pid_hash_size - 1)];
+}
+
+static void
+pid_hash_add(struct tcb *tcp)
+{
+	struct tcb **const bucket = pid_hash_bucket(tcp->pid);
+
+	tcp->pid_hash_next = *bucket;
+	*bucket = tcp;
+}
+
+static void
+pid_hash_remove(struct tcb *tcp)
+{
+	struct tcb **ptcp = pid_hash_bucket(tcp->pid);
+
+	for (; *ptcp; ptcp = &(*ptcp)->pid_hash_next) {
+		if (*ptcp == tcp) {
+			*ptcp = tcp->pid_hash_next;
+			break;
+		}
+	}
+	tcp->pid_hash_next = NULL;
+}
+
+/* Change the pid of a tcb in use, its bucket changes accordingly.  */
+static void
+set_tcb_pid(struct tcb *tcp, const int pid)
+{
+	pid_hash_remove(tcp);
+	tcp->pid = pid;
+	pid_hash_add(tcp);
+}
+
+static void
+expand_pid_hash(void)
+{
+	free(pid_hash);
+	pid_hash_size = pid_hash_size ? pid_hash_size * 2 : 64;
+	while (pid_hash_size < tcbtabsize)
+		pid_hash_size *= 2;
+	pid_hash = xcalloc(pid_hash_size, sizeof(*pid_hash));
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		if (tcbtab[i]->pid)
+			pid_hash_add(tcbtab[i]);
+	}
+}
+
 static void
 expand_tcbtab(void)
 {
@@ -860,33 +1125,44 @@ expand_tcbtab(void)
 	for (tcb_ptr = tcbtab + old_tcbtabsize;
 	    tcb_ptr < tcbtab + tcbtabsize; tcb_ptr++, newtcbs++)
 		*tcb_ptr = newtcbs;
+
+	/* Free tcbs are taken in the order of tcbtab.  */
+	while (tcb_ptr > tcbtab + old_tcbtabsize) {
+		--tcb_ptr;
+		(*tcb_ptr)->pid_hash_next = free_tcbs;
+		free_tcbs = *tcb_ptr;
+	}
+
+	if (pid_hash_size < tcbtabsize)
+		expand_pid_hash();
 }
 
 static struct tcb *
 alloctcb(int pid)
 {
-	unsigned int i;
 	struct tcb *tcp;
 
 	if (nprocs == tcbtabsize)
 		expand_tcbtab();
 
-	for (i = 0; i < tcbtabsize; i++) {
-		tcp = tcbtab[i];
-		if (!tcp->pid) {
-			memset(tcp, 0, sizeof(*tcp));
-			list_init(&tcp->wait_list);
-			tcp->pid = pid;
+	tcp = free_tcbs;
+	if (!tcp || tcp->pid)
+		error_msg_and_die("bug in alloctcb");
+	free_tcbs = tcp->pid_hash_next;
+
+	memset(tcp, 0, sizeof(*tcp));
+	list_init(&tcp->wait_list);
+	tcp->pid = pid;
+	tcp->mem_fd = -1;
+	pid_hash_add(tcp);
 #if SUPPORTED_PERSONALITIES > 1
-			tcp->currpers = current_personality;
+	tcp->currpers = current_personality;
 #endif
-			nprocs++;
-			debug_msg("new tcb for pid %d, active tcbs:%d",
-				  tcp->pid, nprocs);
-			return tcp;
-		}
-	}
-	error_msg_and_die("bug in alloctcb");
+	nprocs++;
+	debug_msg("new tcb for pid %d, active tcbs:%d", tcp->pid, nprocs);
+	if (process_tree_format)
+		process_tree_attach(tcp);
+	return tcp;
 }
 
 void *
@@ -920,6 +1196,54 @@ free_tcb_priv_data(struct tcb *tcp)
 	}
 }
 
+/* The tracee is stopped since now until its first restart.  */
+static void
+attach_stop_begin(struct tcb *const tcp)
+{
+	clock_gettime(CLOCK_MONOTONIC, &tcp->attach_ts);
+	++attach_count;
+	++attach_pending;
+}
+
+/*
+ * The tracee grabbed by startup_attach is restarted after its first stop,
+ * or it is gone.  When all of them are, the attach is complete.
+ */
+static void
+attach_stop_end(struct tcb *const tcp, const bool restarted)
+{
+	if (!ts_nz(&tcp->attach_ts))
+		return;
+
+	struct timespec now, dt;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (restarted) {
+		ts_sub(&dt, &now, &tcp->attach_ts);
+		if (ts_cmp(&dt, &attach_max_stop) > 0)
+			attach_max_stop = dt;
+	}
+	tcp->attach_ts.tv_sec = tcp->attach_ts.tv_nsec = 0;
+
+	if (--attach_pending)
+		return;
+
+	ts_sub(&attach_latency, &now, &attach_start_ts);
+	debug_msg("attached %u tracee%s in %.6f seconds, the longest stop"
+		  " was %.6f seconds", attach_count,
+		  attach_count == 1 ? "" : "s",
+		  ts_float(&attach_latency), ts_float(&attach_max_stop));
+}
+
+static void
+attach_summary(FILE *const fp)
+{
+	fprintf(fp, "attached %u tracee%s in %.6f seconds, the longest stop"
+		" was %.6f seconds\n", attach_count,
+		attach_count == 1 ? "" : "s",
+		ts_float(&attach_latency), ts_float(&attach_max_stop));
+}
+
 static void
 droptcb(struct tcb *tcp)
 {
@@ -940,6 +1264,13 @@ droptcb(struct tcb *tcp)
 
 	free_tcb_priv_data(tcp);
 
+	if (count_io)
+		io_summary_forget_pid(tcp->pid);
+	if (perf_summary)
+		perf_summary_drop(tcp);
+	close_proc_mem(tcp);
+	attach_stop_end(tcp, false);
+
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled)
 		unwind_tcb_fin(tcp);
@@ -957,10 +1288,24 @@ droptcb(struct tcb *tcp)
 
 	if (tcp->outf) {
 		bool publish = true;
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
 			publish = is_number_in_set(STATUS_DETACHED, status_set);
+		if (slowest_count || flight_recorder_size) {
+			if (tcp->staged_output_data) {
+				if (tcp->curcol != 0)
+					fputs_unlocked(" <detached ...>\n",
+						       tcp->outf);
+				strace_finish_staged_output(tcp, publish, NULL);
+			}
+			/* Staged output never reaches the real tcp->outf.  */
+			publish = false;
+		} else if (tcp->staged_output_data) {
 			strace_close_memstream(tcp, publish);
 		}
+		if (flight_recorder_size)
+			flight_recorder_drop(tcp);
+		if (timeline_file)
+			timeline_detach(tcp);
 
 		if (output_separately) {
 			if (tcp->curcol != 0 && publish)
@@ -979,20 +1324,26 @@ droptcb(struct tcb *tcp)
 		printing_tcp = NULL;
 
 	list_remove(&tcp->wait_list);
+	pid_hash_remove(tcp);
 
 	memset(tcp, 0, sizeof(*tcp));
+	tcp->pid_hash_next = free_tcbs;
+	free_tcbs = tcp;
 }
 
-/* Detach traced process.
+/*
+ * Detach from the tracee if it is stopped, otherwise make it stop
+ * for detach.
+ * Return true if its stop has to be waited for and passed to detach_stopped,
+ * false if the tracee is detached or gone.
  * Never call DETACH twice on the same process as both unattached and
  * attached-unstopped processes give the same ESRCH.  For unattached process we
  * would SIGSTOP it and wait for its SIGSTOP notification forever.
  */
-static void
-detach(struct tcb *tcp)
+static bool
+detach_or_stop(struct tcb *tcp)
 {
 	int error;
-	int status;
 
 	/*
 	 * Linux wrongly insists the child be stopped
@@ -1001,24 +1352,24 @@ detach(struct tcb *tcp)
 	 */
 
 	if (!(tcp->flags & TCB_ATTACHED))
-		goto drop;
+		return false;
 
 	/* We attached but possibly didn't see the expected SIGSTOP.
 	 * We must catch exactly one as otherwise the detached process
 	 * would be left stopped (process state T).
 	 */
 	if (tcp->flags & TCB_IGNORE_ONE_SIGSTOP)
-		goto wait_loop;
+		return true;
 
 	error = ptrace(PTRACE_DETACH, tcp->pid, 0, 0);
 	if (!error) {
 		/* On a clear day, you can see forever. */
-		goto drop;
+		return false;
 	}
 	if (errno != ESRCH) {
 		/* Shouldn't happen. */
 		perror_func_msg("ptrace(PTRACE_DETACH,%u)", tcp->pid);
-		goto drop;
+		return false;
 	}
 	/* ESRCH: process is either not stopped or doesn't exist. */
 	if (my_tkill(tcp->pid, 0) < 0) {
@@ -1026,7 +1377,7 @@ detach(struct tcb *tcp)
 			/* Shouldn't happen. */
 			perror_func_msg("tkill(%u,0)", tcp->pid);
 		/* else: process doesn't exist. */
-		goto drop;
+		return false;
 	}
 	/* Process is not stopped, need to stop it. */
 	if (use_seize) {
@@ -1038,110 +1389,243 @@ detach(struct tcb *tcp)
 		 */
 		error = ptrace(PTRACE_INTERRUPT, tcp->pid, 0, 0);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_func_msg("ptrace(PTRACE_INTERRUPT,%u)", tcp->pid);
 	} else {
 		error = my_tkill(tcp->pid, SIGSTOP);
 		if (!error)
-			goto wait_loop;
+			return true;
 		if (errno != ESRCH)
 			perror_func_msg("tkill(%u,SIGSTOP)", tcp->pid);
 	}
 	/* Either process doesn't exist, or some weird error. */
-	goto drop;
+	return false;
+}
 
- wait_loop:
-	/* We end up here in three cases:
-	 * 1. We sent PTRACE_INTERRUPT (use_seize case)
-	 * 2. We sent SIGSTOP (!use_seize)
-	 * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
-	 */
-	for (;;) {
-		unsigned int sig;
-		if (waitpid(tcp->pid, &status, __WALL) < 0) {
-			if (errno == EINTR)
-				continue;
-			/*
-			 * if (errno == ECHILD) break;
-			 * ^^^  WRONG! We expect this PID to exist,
-			 * and want to emit a message otherwise:
-			 */
-			perror_func_msg("waitpid(%u)", tcp->pid);
-			break;
-		}
-		if (!WIFSTOPPED(status)) {
+/*
+ * Handle the wait status of the tracee detach_or_stop has returned true for.
+ * We end up here in three cases:
+ * 1. We sent PTRACE_INTERRUPT (use_seize case)
+ * 2. We sent SIGSTOP (!use_seize)
+ * 3. Attach SIGSTOP was already pending (TCB_IGNORE_ONE_SIGSTOP set)
+ * Return true if the tracee is detached or gone, false if its stop
+ * for detach is still to come.
+ */
+static bool
+detach_stopped(struct tcb *tcp, const int status)
+{
+	unsigned int sig;
+
+	if (!WIFSTOPPED(status)) {
+		/*
+		 * Tracee exited or was killed by signal.
+		 * We shouldn't normally reach this place:
+		 * we don't want to consume exit status.
+		 * Consider "strace -p PID" being ^C-ed:
+		 * we want merely to detach from PID.
+		 *
+		 * However, we _can_ end up here if tracee
+		 * was SIGKILLed.
+		 */
+		return true;
+	}
+	sig = WSTOPSIG(status);
+	debug_msg("detach wait: event:%d sig:%d",
+		  (unsigned) status >> 16, sig);
+	if (use_seize) {
+		unsigned event = (unsigned)status >> 16;
+		if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
 			/*
-			 * Tracee exited or was killed by signal.
-			 * We shouldn't normally reach this place:
-			 * we don't want to consume exit status.
-			 * Consider "strace -p PID" being ^C-ed:
-			 * we want merely to detach from PID.
-			 *
-			 * However, we _can_ end up here if tracee
-			 * was SIGKILLed.
+			 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
+			 * sig == other: process was already stopped
+			 * with this stopping sig (see tests/detach-stopped).
+			 * Looks like re-injecting this sig is not necessary
+			 * in DETACH for the tracee to remain stopped.
 			 */
-			break;
+			sig = 0;
 		}
-		sig = WSTOPSIG(status);
-		debug_msg("detach wait: event:%d sig:%d",
-			  (unsigned) status >> 16, sig);
-		if (use_seize) {
-			unsigned event = (unsigned)status >> 16;
-			if (event == PTRACE_EVENT_STOP /*&& sig == SIGTRAP*/) {
+		/*
+		 * PTRACE_INTERRUPT is not guaranteed to produce
+		 * the above event if other ptrace-stop is pending.
+		 * See tests/detach-sleeping testcase:
+		 * strace got SIGINT while tracee is sleeping.
+		 * We sent PTRACE_INTERRUPT.
+		 * We see syscall exit, not PTRACE_INTERRUPT stop.
+		 * We won't get PTRACE_INTERRUPT stop
+		 * if we would CONT now. Need to DETACH.
+		 */
+		if (sig == syscall_trap_sig)
+			sig = 0;
+		/* else: not sure in which case we can be here.
+		 * Signal stop? Inject it while detaching.
+		 */
+		ptrace_restart(PTRACE_DETACH, tcp, sig);
+		return true;
+	}
+	/* Note: this check has to be after use_seize check */
+	/* (else, in use_seize case SIGSTOP will be mistreated) */
+	if (sig == SIGSTOP) {
+		/* Detach, suppressing SIGSTOP */
+		ptrace_restart(PTRACE_DETACH, tcp, 0);
+		return true;
+	}
+	if (sig == syscall_trap_sig)
+		sig = 0;
+	/* Can't detach just yet, may need to wait for SIGSTOP */
+	/* Should not fail.
+	 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
+	 * ptrace_restart emits an error message if it fails.
+	 */
+	return ptrace_restart(PTRACE_CONT, tcp, sig) < 0;
+}
+
+static void
+detach_drop(struct tcb *tcp)
+{
+	if (!is_number_in_set(QUIET_ATTACH, quiet_set)
+	    && (tcp->flags & TCB_ATTACHED))
+		error_msg("Process %u detached", tcp->pid);
+
+	droptcb(tcp);
+}
+
+/* Detach traced process.  */
+static void
+detach(struct tcb *tcp)
+{
+	int status;
+
+	if (detach_or_stop(tcp)) {
+		for (;;) {
+			if (waitpid(tcp->pid, &status, __WALL) < 0) {
+				if (errno == EINTR)
+					continue;
 				/*
-				 * sig == SIGTRAP: PTRACE_INTERRUPT stop.
-				 * sig == other: process was already stopped
-				 * with this stopping sig (see tests/detach-stopped).
-				 * Looks like re-injecting this sig is not necessary
-				 * in DETACH for the tracee to remain stopped.
+				 * if (errno == ECHILD) break;
+				 * ^^^  WRONG! We expect this PID to exist,
+				 * and want to emit a message otherwise:
 				 */
-				sig = 0;
+				perror_func_msg("waitpid(%u)", tcp->pid);
+				break;
 			}
-			/*
-			 * PTRACE_INTERRUPT is not guaranteed to produce
-			 * the above event if other ptrace-stop is pending.
-			 * See tests/detach-sleeping testcase:
-			 * strace got SIGINT while tracee is sleeping.
-			 * We sent PTRACE_INTERRUPT.
-			 * We see syscall exit, not PTRACE_INTERRUPT stop.
-			 * We won't get PTRACE_INTERRUPT stop
-			 * if we would CONT now. Need to DETACH.
-			 */
-			if (sig == syscall_trap_sig)
-				sig = 0;
-			/* else: not sure in which case we can be here.
-			 * Signal stop? Inject it while detaching.
-			 */
-			ptrace_restart(PTRACE_DETACH, tcp, sig);
-			break;
+			if (detach_stopped(tcp, status))
+				break;
 		}
-		/* Note: this check has to be after use_seize check */
-		/* (else, in use_seize case SIGSTOP will be mistreated) */
-		if (sig == SIGSTOP) {
-			/* Detach, suppressing SIGSTOP */
-			ptrace_restart(PTRACE_DETACH, tcp, 0);
+	}
+
+	detach_drop(tcp);
+}
+
+
+/* Report the tracees that have not stopped for detach_all in this time.  */
+static const struct timespec detach_straggler_ts = { .tv_sec = 1 };
+
+/*
+ * Detach from all tracees at once: make all of them stop first, then
+ * reap their stops in batches and detach from each of them as soon
+ * as its stop is seen, so the time the tracees are stopped does not
+ * grow with their number as it would with detach called for each one.
+ */
+static void
+detach_all(void)
+{
+	struct timespec start_ts, now, dt;
+	unsigned int ntracees = 0, npending = 0;
+	bool stragglers_reported = false;
+	sigset_t chld_set, old_set;
+
+	/* SIGCHLD stays pending while blocked, see sigtimedwait below.  */
+	sigemptyset(&chld_set);
+	sigaddset(&chld_set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld_set, &old_set);
+
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (!tcp->pid)
+			continue;
+		++ntracees;
+		if (detach_or_stop(tcp))
+			++npending;
+		else
+			detach_drop(tcp);
+	}
+
+	/* Only the tracees waited for are left in tcbtab.  */
+	while (npending) {
+		int status;
+		const int pid = waitpid(-1, &status, __WALL | WNOHANG);
+
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_func_msg("waitpid");
 			break;
 		}
-		if (sig == syscall_trap_sig)
-			sig = 0;
-		/* Can't detach just yet, may need to wait for SIGSTOP */
-		error = ptrace_restart(PTRACE_CONT, tcp, sig);
-		if (error < 0) {
-			/* Should not happen.
-			 * Note: ptrace_restart returns 0 on ESRCH, so it's not it.
-			 * ptrace_restart already emitted error message.
+
+		if (!pid) {
+			if (stragglers_reported) {
+				sigwaitinfo(&chld_set, NULL);
+				continue;
+			}
+
+			/*
+			 * Wait for the next stop, or until it is time
+			 * to report the tracees that have not stopped.
 			 */
-			break;
+			struct timespec timeout;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			ts_sub(&dt, &now, &start_ts);
+			ts_sub(&timeout, &detach_straggler_ts, &dt);
+			if (timeout.tv_sec >= 0 &&
+			    (sigtimedwait(&chld_set, NULL, &timeout) >= 0 ||
+			     errno != EAGAIN))
+				continue;
+
+			error_msg("%u tracee%s did not stop for detach"
+				  " in %.6f seconds, still waiting",
+				  npending, npending == 1 ? "" : "s",
+				  ts_float(&detach_straggler_ts));
+			for (size_t i = 0; i < tcbtabsize; ++i) {
+				if (tcbtab[i]->pid)
+					debug_msg("pid %d has not stopped"
+						  " for detach", tcbtab[i]->pid);
+			}
+			stragglers_reported = true;
+			continue;
+		}
+
+		if (pid == popen_pid) {
+			if (!WIFSTOPPED(status))
+				popen_pid = 0;
+			continue;
+		}
+
+		struct tcb *const tcp = pid2tcb(pid);
+
+		if (!tcp) {
+			/* A new child of a tracee in its first stop.  */
+			if (WIFSTOPPED(status))
+				ptrace(PTRACE_DETACH, pid, 0, 0);
+			continue;
+		}
+
+		if (detach_stopped(tcp, status)) {
+			detach_drop(tcp);
+			--npending;
 		}
 	}
 
- drop:
-	if (!is_number_in_set(QUIET_ATTACH, quiet_set)
-	    && (tcp->flags & TCB_ATTACHED))
-		error_msg("Process %u detached", tcp->pid);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &start_ts);
+	debug_msg("detached %u tracee%s in %.6f seconds",
+		  ntracees, ntracees == 1 ? "" : "s", ts_float(&dt));
 
-	droptcb(tcp);
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
 }
 
 static void
@@ -1172,52 +1656,86 @@ process_opt_p_list(char *opt)
 	}
 }
 
-static void
-attach_tcb(struct tcb *const tcp)
+/*
+ * Seize the tracee without stopping it, it is interrupted later
+ * by interrupt_seized, or attach to it without PTRACE_SEIZE.
+ */
+static int
+ptrace_grab(const int pid)
 {
-	if (ptrace_attach_or_seize(tcp->pid) < 0) {
-		perror_msg("attach: ptrace(%s, %d)",
-			   ptrace_attach_cmd, tcp->pid);
-		droptcb(tcp);
-		return;
-	}
+	if (!use_seize)
+		return ptrace_attach_or_seize(pid);
+
+	ptrace_attach_cmd = "PTRACE_SEIZE";
+	return ptrace(PTRACE_SEIZE, pid, 0L, (unsigned long) ptrace_setoptions);
+}
 
+static void
+after_successful_grab(struct tcb *const tcp)
+{
 	after_successful_attach(tcp, TCB_GRABBED | post_attach_sigstop);
-	debug_msg("attach to pid %d (main) succeeded", tcp->pid);
+	if (!use_seize)
+		attach_stop_begin(tcp);
+}
 
+/*
+ * Grab the threads of the tracee.  The task directory is scanned again
+ * for the threads created meanwhile by the threads that were not grabbed
+ * yet, until no new threads are found.
+ */
+static void
+attach_threads(struct tcb *const tcp, unsigned int *const ntid,
+	       unsigned int *const nerr)
+{
 	static const char task_path[] = "/proc/%d/task";
 	char procdir[sizeof(task_path) + sizeof(int) * 3];
-	DIR *dir;
-	unsigned int ntid = 0, nerr = 0;
+	unsigned int ngrabbed;
+
+	xsprintf(procdir, task_path, tcp->pid);
 
-	if (followfork && tcp->pid != strace_child &&
-	    xsprintf(procdir, task_path, tcp->pid) > 0 &&
-	    (dir = opendir(procdir)) != NULL) {
+	do {
+		DIR *dir = opendir(procdir);
 		struct_dirent *de;
 
+		if (!dir)
+			return;
+
+		ngrabbed = 0;
 		while ((de = read_dir(dir)) != NULL) {
 			if (de->d_fileno == 0)
 				continue;
 
 			int tid = string_to_uint(de->d_name);
-			if (tid <= 0 || tid == tcp->pid)
+			if (tid <= 0 || pid2tcb(tid))
 				continue;
 
-			++ntid;
-			if (ptrace_attach_or_seize(tid) < 0) {
-				++nerr;
+			++*ntid;
+			if (ptrace_grab(tid) < 0) {
+				++*nerr;
 				debug_perror_msg("attach: ptrace(%s, %d)",
 						 ptrace_attach_cmd, tid);
 				continue;
 			}
 
-			after_successful_attach(alloctcb(tid),
-						TCB_GRABBED | post_attach_sigstop);
+			after_successful_grab(alloctcb(tid));
+			++ngrabbed;
 			debug_msg("attach to pid %d succeeded", tid);
 		}
 
 		closedir(dir);
-	}
+	} while (ngrabbed);
+}
+
+static void
+attach_grabbed(struct tcb *const tcp)
+{
+	after_successful_grab(tcp);
+	debug_msg("attach to pid %d (main) succeeded", tcp->pid);
+
+	unsigned int ntid = 0, nerr = 0;
+
+	if (followfork && tcp->pid != strace_child)
+		attach_threads(tcp, &ntid, &nerr);
 
 	if (!is_number_in_set(QUIET_ATTACH, quiet_set)) {
 		if (ntid > nerr)
@@ -1230,6 +1748,44 @@ attach_tcb(struct tcb *const tcp)
 	}
 }
 
+static void
+attach_tcb(struct tcb *const tcp)
+{
+	if (ptrace_grab(tcp->pid) < 0) {
+		perror_msg("attach: ptrace(%s, %d)",
+			   ptrace_attach_cmd, tcp->pid);
+		droptcb(tcp);
+		return;
+	}
+
+	attach_grabbed(tcp);
+}
+
+/*
+ * Stop all the tracees seized by startup_attach or by a scan of the cgroup
+ * at once, their stops are handled by the main loop.
+ */
+static void
+interrupt_seized(void)
+{
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (!tcp->pid || ts_nz(&tcp->attach_ts) ||
+		    (tcp->flags & (TCB_STARTUP | TCB_GRABBED)) !=
+		    (TCB_STARTUP | TCB_GRABBED))
+			continue;
+
+		/* If the tracee is gone, its exit is reported by wait4.  */
+		if (ptrace(PTRACE_INTERRUPT, tcp->pid, 0L, 0L) < 0) {
+			debug_perror_msg("attach: ptrace(PTRACE_INTERRUPT, %d)",
+					 tcp->pid);
+			continue;
+		}
+		attach_stop_begin(tcp);
+	}
+}
+
 static void
 startup_attach(void)
 {
@@ -1278,6 +1834,8 @@ startup_attach(void)
 		}
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &attach_start_ts);
+
 	for (tcbi = 0; tcbi < tcbtabsize; tcbi++) {
 		tcp = tcbtab[tcbi];
 
@@ -1288,26 +1846,159 @@ startup_attach(void)
 		if (tcp->flags & TCB_ATTACHED)
 			continue; /* no, we already attached it */
 
-		if (tcp->pid == parent_pid || tcp->pid == strace_tracer_pid) {
-			errno = EPERM;
-			perror_msg("attach: pid %d", tcp->pid);
-			droptcb(tcp);
-			continue;
-		}
+		if (tcp->pid == parent_pid || tcp->pid == strace_tracer_pid) {
+			errno = EPERM;
+			perror_msg("attach: pid %d", tcp->pid);
+			droptcb(tcp);
+			continue;
+		}
+
+		attach_tcb(tcp);
+
+		if (interrupted)
+			return;
+	} /* for each tcbtab[] */
+
+	if (use_seize)
+		interrupt_seized();
+
+	if (daemonized_tracer) {
+		/*
+		 * Make parent go away.
+		 * Also makes grandparent's wait() unblock.
+		 */
+		kill(parent_pid, SIGKILL);
+		strace_child = 0;
+	}
+}
+
+static bool
+untraced_cgroup_member(const int pid)
+{
+	return pid != strace_tracer_pid && pid != popen_pid && !pid2tcb(pid);
+}
+
+/* Add a process of the cgroup to be attached to by startup_attach.  */
+static bool
+add_cgroup_member(const int pid)
+{
+	if (!untraced_cgroup_member(pid))
+		return false;
+
+	alloctcb(pid);
+	return true;
+}
+
+/*
+ * Whether the process has been denied to be attached to.  The denied pids
+ * found by the scan are moved to the front of cgroup_denied_pids, the rest
+ * of them are gone from the cgroup and are forgotten after the scan.
+ */
+static bool
+cgroup_member_denied(const int pid)
+{
+	for (size_t i = cgroup_denied_kept; i < cgroup_denied_count; ++i) {
+		if (cgroup_denied_pids[i] == pid) {
+			cgroup_denied_pids[i] =
+				cgroup_denied_pids[cgroup_denied_kept];
+			cgroup_denied_pids[cgroup_denied_kept++] = pid;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void
+add_cgroup_denied_pid(const int pid)
+{
+	if (cgroup_denied_count >= cgroup_denied_size)
+		cgroup_denied_pids = xgrowarray(cgroup_denied_pids,
+						&cgroup_denied_size,
+						sizeof(*cgroup_denied_pids));
+	if (cgroup_denied_kept < cgroup_denied_count)
+		cgroup_denied_pids[cgroup_denied_count] =
+			cgroup_denied_pids[cgroup_denied_kept];
+	cgroup_denied_pids[cgroup_denied_kept++] = pid;
+	++cgroup_denied_count;
+}
+
+/*
+ * Attach to a process that has migrated into the cgroup.  The processes
+ * that cannot be grabbed are usually new children of the tracees
+ * that have not been reported by wait4 yet, so this is not an error,
+ * unless the process is not permitted to be traced.  The latter is reported
+ * once, and the process is not tried again while it is in the cgroup.
+ */
+static bool
+attach_cgroup_member(const int pid)
+{
+	if (!untraced_cgroup_member(pid) || cgroup_member_denied(pid))
+		return false;
+
+	if (ptrace_grab(pid) < 0) {
+		if (errno == EPERM) {
+			perror_msg("attach: ptrace(%s, %d)",
+				   ptrace_attach_cmd, pid);
+			add_cgroup_denied_pid(pid);
+		} else {
+			debug_perror_msg("attach: ptrace(%s, %d)",
+					 ptrace_attach_cmd, pid);
+		}
+		return false;
+	}
+
+	/* The attach latency is measured for every batch of new members.  */
+	if (!attach_pending) {
+		clock_gettime(CLOCK_MONOTONIC, &attach_start_ts);
+		attach_count = 0;
+		attach_max_stop.tv_sec = attach_max_stop.tv_nsec = 0;
+	}
+
+	attach_grabbed(alloctcb(pid));
+	return true;
+}
+
+static void
+attach_cgroup(void)
+{
+	cgroup_denied_kept = 0;
+	const bool present = cgroup_scan(attach_cgroup_member);
+	cgroup_denied_count = cgroup_denied_kept;
+
+	if (present) {
+		if (use_seize)
+			interrupt_seized();
+		return;
+	}
+
+	debug_msg("cgroup %s has been removed", cgroup_path);
+	cgroup_close();
+	cgroup_path = NULL;
+}
+
+/*
+ * With --cgroup, waiting for the tracees must not last past the next scan
+ * of the cgroup, so SIGCHLD is kept blocked and waited for with
+ * cgroup_wait along with the inotify events of the cgroup.
+ * When the scan is due, the wait is reported as interrupted.
+ */
+static int
+cgroup_wait4(int *const status, struct rusage *const ru)
+{
+	for (;;) {
+		const int pid = wait4(-1, status, __WALL | WNOHANG, ru);
 
-		attach_tcb(tcp);
+		if (pid > 0 || (pid < 0 && (errno != ECHILD || nprocs)))
+			return pid;
 
-		if (interrupted)
-			return;
-	} /* for each tcbtab[] */
+		if (cgroup_scan_due()) {
+			errno = EINTR;
+			return -1;
+		}
 
-	if (daemonized_tracer) {
-		/*
-		 * Make parent go away.
-		 * Also makes grandparent's wait() unblock.
-		 */
-		kill(parent_pid, SIGKILL);
-		strace_child = 0;
+		if (cgroup_wait(nprocs) < 0 && errno == EINTR)
+			return -1;
 	}
 }
 
@@ -1331,7 +2022,7 @@ exec_or_die(void)
 
 	if (params->fd_to_close >= 0)
 		close(params->fd_to_close);
-	if (!daemonized_tracer && !use_seize) {
+	if (!daemonized_tracer && !use_seize && !seccomp_notify) {
 		if (ptrace(PTRACE_TRACEME, 0L, 0L, 0L) < 0) {
 			perror_msg_and_die("ptrace(PTRACE_TRACEME, ...)");
 		}
@@ -1356,7 +2047,9 @@ exec_or_die(void)
 			perror_msg_and_die("setreuid");
 		}
 
-	if (!daemonized_tracer) {
+	if (seccomp_notify) {
+		/* Nothing to wait for, the filter is installed below.  */
+	} else if (!daemonized_tracer) {
 		/*
 		 * Induce a ptrace stop. Tracer (our parent)
 		 * will resume us with PTRACE_SYSCALL and display
@@ -1381,6 +2074,8 @@ exec_or_die(void)
 		  seccomp_filtering ? "enabled" : "disabled");
 	if (seccomp_filtering)
 		init_seccomp_filter();
+	if (seccomp_notify)
+		seccomp_notify_install();
 	execv(params->pathname, params->argv);
 	perror_msg_and_die("exec");
 }
@@ -1534,6 +2229,9 @@ startup_child(char **argv)
 		prctl(PR_SET_PTRACER, PR_SET_PTRACER_ANY);
 #endif
 
+	if (seccomp_notify)
+		seccomp_notify_prepare();
+
 	pid = fork();
 	if (pid < 0)
 		perror_func_msg_and_die("fork");
@@ -1550,6 +2248,12 @@ startup_child(char **argv)
 
 	/* We are the tracer */
 
+	if (seccomp_notify) {
+		strace_child = pid;
+		seccomp_notify_fd = seccomp_notify_listen(pid);
+		return;
+	}
+
 	if (!daemonized_tracer) {
 		strace_child = pid;
 		if (!use_seize) {
@@ -1743,6 +2447,7 @@ parse_ts_arg(const char *in_arg)
 {
 	static const char format_pfx[] = "format:";
 	static const char scale_pfx[] = "precision:";
+	static const char clock_pfx[] = "clock:";
 
 	enum {
 		TOKEN_FORMAT = 1 << 0,
@@ -1771,6 +2476,23 @@ parse_ts_arg(const char *in_arg)
 			token += sizeof(scale_pfx) - 1;
 			token_type = TOKEN_SCALE;
 
+		} else if (!strncasecmp(token, clock_pfx,
+					sizeof(clock_pfx) - 1)) {
+			token += sizeof(clock_pfx) - 1;
+
+			if (!strcasecmp(token, "realtime")) {
+				tflag_clock = CLOCK_REALTIME;
+				continue;
+			} else if (!strcasecmp(token, "monotonic")) {
+				tflag_clock = CLOCK_MONOTONIC;
+				continue;
+			} else if (!strcasecmp(token, "boottime")) {
+				tflag_clock = CLOCK_BOOTTIME;
+				continue;
+			}
+
+			free(arg);
+			return -1;
 		}
 
 		if (token_type & TOKEN_FORMAT) {
@@ -1851,6 +2573,9 @@ init(int argc, char *argv[])
 	int qflag_short = 0;
 	int followfork_short = 0;
 	int yflag_short = 0;
+	const char *merge_prefix = NULL;
+	bool build_profile = false;
+	const char *timeline_path = NULL;
 	bool tflag_long_set = false;
 	int tflag_short = 0;
 	bool columns_set = false;
@@ -1890,6 +2615,22 @@ init(int argc, char *argv[])
 		GETOPT_FOLLOWFORKS,
 		GETOPT_OUTPUT_SEPARATELY,
 		GETOPT_TS,
+		GETOPT_SUMMARY_IO,
+		GETOPT_SUMMARY_BACKEND,
+		GETOPT_SLOWEST,
+		GETOPT_MIN_DURATION,
+		GETOPT_FLIGHT_RECORDER,
+		GETOPT_DUMP_ON_ERROR,
+		GETOPT_CONTROL,
+		GETOPT_CGROUP,
+		GETOPT_MERGE,
+		GETOPT_PROCESS_TREE,
+		GETOPT_BUILD_PROFILE,
+		GETOPT_TIMELINE,
+		GETOPT_STACK_SUMMARY,
+		GETOPT_OUTPUT_THREAD,
+		GETOPT_SECCOMP_NOTIFY,
+		GETOPT_SECCOMP_PROFILE,
 
 		GETOPT_QUAL_TRACE,
 		GETOPT_QUAL_ABBREV,
@@ -1923,6 +2664,7 @@ init(int argc, char *argv[])
 		{ "instruction-pointer", no_argument,      0, 'i' },
 		{ "interruptible",	required_argument, 0, 'I' },
 		{ "stack-traces",	no_argument,	   0, 'k' },
+		{ "stack-summary",	required_argument, 0, GETOPT_STACK_SUMMARY },
 		{ "output",		required_argument, 0, 'o' },
 		{ "summary-syscall-overhead", required_argument, 0, 'O' },
 		{ "attach",		required_argument, 0, 'p' },
@@ -1938,12 +2680,27 @@ init(int argc, char *argv[])
 		{ "no-abbrev",		no_argument,	   0, 'v' },
 		{ "version",		no_argument,	   0, 'V' },
 		{ "summary-wall-clock", no_argument,	   0, 'w' },
+		{ "summary-io",		no_argument,	   0, GETOPT_SUMMARY_IO },
+		{ "summary-backend",	required_argument, 0, GETOPT_SUMMARY_BACKEND },
+		{ "slowest",		required_argument, 0, GETOPT_SLOWEST },
+		{ "min-duration",	required_argument, 0, GETOPT_MIN_DURATION },
+		{ "flight-recorder",	required_argument, 0, GETOPT_FLIGHT_RECORDER },
+		{ "dump-on-error",	required_argument, 0, GETOPT_DUMP_ON_ERROR },
+		{ "control",		required_argument, 0, GETOPT_CONTROL },
+		{ "cgroup",		required_argument, 0, GETOPT_CGROUP },
+		{ "merge",		required_argument, 0, GETOPT_MERGE },
+		{ "process-tree",	optional_argument, 0, GETOPT_PROCESS_TREE },
+		{ "build-profile",	optional_argument, 0, GETOPT_BUILD_PROFILE },
+		{ "timeline",		required_argument, 0, GETOPT_TIMELINE },
+		{ "output-thread",	no_argument,	   0, GETOPT_OUTPUT_THREAD },
 		{ "strings-in-hex",	optional_argument, 0, GETOPT_HEX_STR },
 		{ "const-print-style",	required_argument, 0, 'X' },
 		{ "successful-only",	no_argument,	   0, 'z' },
 		{ "failed-only",	no_argument,	   0, 'Z' },
 		{ "failing-only",	no_argument,	   0, 'Z' },
 		{ "seccomp-bpf",	no_argument,	   0, GETOPT_SECCOMP },
+		{ "seccomp-notify",	no_argument,	   0, GETOPT_SECCOMP_NOTIFY },
+		{ "seccomp-profile",	required_argument, 0, GETOPT_SECCOMP_PROFILE },
 
 		{ "trace",	required_argument, 0, GETOPT_QUAL_TRACE },
 		{ "abbrev",	required_argument, 0, GETOPT_QUAL_ABBREV },
@@ -2053,6 +2810,20 @@ init(int argc, char *argv[])
 			error_msg_and_die("Stack traces (-k/--stack-traces "
 					  "option) are not supported by this "
 					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_SUMMARY:
+#ifdef ENABLE_STACKTRACE
+			stack_summary = find_arg_val(optarg, stack_summary_str,
+						     STACK_SUMMARY_NONE,
+						     STACK_SUMMARY_NONE);
+			if (stack_summary == STACK_SUMMARY_NONE)
+				error_opt_arg(c, lopt, optarg);
+			stack_trace_enabled = true;
+#else
+			error_msg_and_die("Stack traces (--stack-summary "
+					  "option) are not supported by this "
+					  "build of strace");
 #endif
 			break;
 		case 'o':
@@ -2122,6 +2893,67 @@ init(int argc, char *argv[])
 		case 'w':
 			count_wallclock = 1;
 			break;
+		case GETOPT_SUMMARY_IO:
+			count_io = true;
+			break;
+		case GETOPT_SUMMARY_BACKEND:
+			if (!strcmp(optarg, "perf"))
+				perf_summary = true;
+			else if (!strcmp(optarg, "ptrace"))
+				perf_summary = false;
+			else
+				error_msg_and_help("invalid --summary-backend"
+						   " argument: '%s'", optarg);
+			break;
+		case GETOPT_SLOWEST:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_opt_arg(c, lopt, optarg);
+			slowest_count = i;
+			break;
+		case GETOPT_MIN_DURATION:
+			if (parse_ts(optarg, &min_duration) < 0)
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_FLIGHT_RECORDER:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_opt_arg(c, lopt, optarg);
+			flight_recorder_size = i;
+			break;
+		case GETOPT_DUMP_ON_ERROR:
+			qualify_dump_on_error(optarg);
+			break;
+		case GETOPT_CONTROL:
+			control_path = optarg;
+			break;
+		case GETOPT_CGROUP:
+			cgroup_path = optarg;
+			break;
+		case GETOPT_MERGE:
+			merge_prefix = optarg;
+			break;
+		case GETOPT_TIMELINE:
+			timeline_path = optarg;
+			break;
+		case GETOPT_OUTPUT_THREAD:
+			output_thread = true;
+			break;
+		case GETOPT_BUILD_PROFILE:
+			build_profile = true;
+			seccomp_filtering = true;
+			qualify_trace("none");
+			qualify_signals("none");
+			ATTRIBUTE_FALLTHROUGH;
+		case GETOPT_PROCESS_TREE:
+			process_tree_format =
+				find_arg_val(optarg, process_tree_str,
+					     PROCESS_TREE_TEXT,
+					     PROCESS_TREE_NONE);
+			if (process_tree_format == PROCESS_TREE_NONE)
+				error_opt_arg(c, lopt, optarg);
+			process_tree_init();
+			break;
 		case 'x':
 			xflag++;
 			break;
@@ -2157,6 +2989,12 @@ init(int argc, char *argv[])
 		case GETOPT_SECCOMP:
 			seccomp_filtering = true;
 			break;
+		case GETOPT_SECCOMP_NOTIFY:
+			seccomp_notify = true;
+			break;
+		case GETOPT_SECCOMP_PROFILE:
+			seccomp_profile_path = optarg;
+			break;
 		case GETOPT_QUAL_TRACE:
 			qualify_trace(optarg);
 			break;
@@ -2205,7 +3043,14 @@ init(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
-	if (argc < 0 || (!nprocs && !argc)) {
+	if (merge_prefix) {
+		if (argc || nprocs)
+			error_msg_and_help("--merge cannot be used"
+					   " with PROG or -p");
+		exit(merge_logs(merge_prefix));
+	}
+
+	if (argc < 0 || (!nprocs && !argc && !cgroup_path)) {
 		error_msg_and_help("must have PROG [ARGS] or -p PID");
 	}
 
@@ -2256,6 +3101,10 @@ init(int argc, char *argv[])
 		qualify_decode_fd(yflag_short == 1 ? yflag_qual : yyflag_qual);
 	}
 
+	if (seccomp_profile_path && !seccomp_filtering && !seccomp_notify)
+		error_msg("--seccomp-profile has no effect without"
+			  " --seccomp-bpf or --seccomp-notify");
+
 	if (seccomp_filtering && detach_on_execve) {
 		error_msg("--seccomp-bpf is not enabled because"
 			  " it is not compatible with -b");
@@ -2275,8 +3124,27 @@ init(int argc, char *argv[])
 		}
 	}
 
+	/* The children of the processes of the cgroup are in the cgroup, too.  */
+	if (cgroup_path)
+		followfork = true;
+
+	if (build_profile) {
+		if (!followfork)
+			followfork = true;
+		/*
+		 * Without syscalls to print there is nothing to complete
+		 * before the exit, so PTRACE_EVENT_EXIT stops can be avoided.
+		 */
+		bool tracing_syscalls = false;
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p)
+			tracing_syscalls |=
+				!number_set_array_is_empty(trace_set, p);
+		if (!tracing_syscalls)
+			ptrace_setoptions &= ~PTRACE_O_TRACEEXIT;
+	}
+
 	if (seccomp_filtering) {
-		if (nprocs && (!argc || debug_flag))
+		if ((nprocs || cgroup_path) && (!argc || debug_flag))
 			error_msg("--seccomp-bpf is not enabled for processes"
 				  " attached with -p");
 		if (!followfork) {
@@ -2296,17 +3164,96 @@ init(int argc, char *argv[])
 		}
 	}
 
+	if (seccomp_notify) {
+		if (nprocs || cgroup_path || !argc || daemonized_tracer)
+			error_msg_and_help("--seccomp-notify requires PROG [ARGS]"
+					   " and cannot be used with -p, --cgroup"
+					   " or -D/--daemonize");
+		if (seccomp_filtering)
+			error_msg_and_help("--seccomp-notify and --seccomp-bpf"
+					   " are mutually exclusive");
+		if (cflag || Tflag || stack_trace_enabled
+		    || process_tree_format || detach_on_execve)
+			error_msg_and_help("--seccomp-notify cannot be used with"
+					   " -b, -c, -C, -k, -T, or"
+					   " --process-tree");
+		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)
+		    || slowest_count || ts_nz(&min_duration)
+		    || flight_recorder_size || timeline_path || control_path)
+			error_msg_and_help("--seccomp-notify cannot be used with"
+					   " -z, -Z, -e status, --slowest,"
+					   " --min-duration, --flight-recorder,"
+					   " --timeline, or --control");
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			if (inject_vec[p])
+				error_msg_and_help("--seccomp-notify cannot be"
+						   " used with -e inject"
+						   " or -e fault");
+		}
+	}
+
 	if (output_separately && cflag) {
 		error_msg_and_help("(-c/--summary-only or -C/--summary) and"
 				   " -ff/--output-separately"
 				   " are mutually exclusive");
 	}
 
+	if (output_separately && slowest_count) {
+		error_msg_and_help("--slowest and -ff/--output-separately"
+				   " are mutually exclusive");
+	}
+
+	if (flight_recorder_size && slowest_count) {
+		error_msg_and_help("--flight-recorder and --slowest"
+				   " are mutually exclusive");
+	}
+
+	if (flight_recorder_size && cflag == CFLAG_ONLY_STATS) {
+		error_msg_and_help("--flight-recorder and -c/--summary-only"
+				   " are mutually exclusive");
+	}
+
+	if (timeline_path && cflag == CFLAG_ONLY_STATS) {
+		error_msg_and_help("--timeline and -c/--summary-only"
+				   " are mutually exclusive");
+	}
+
+	if (dump_errno_set && !flight_recorder_size) {
+		error_msg_and_help("--dump-on-error must be given with"
+				   " --flight-recorder");
+	}
+
 	if (count_wallclock && !cflag) {
 		error_msg_and_help("-w/--summary-wall-clock must be given with"
 				   " (-c/--summary-only or -C/--summary)");
 	}
 
+	if (count_io && !cflag) {
+		error_msg_and_help("--summary-io must be given with"
+				   " (-c/--summary-only or -C/--summary)");
+	}
+
+	if (perf_summary) {
+		if (cflag != CFLAG_ONLY_STATS)
+			error_msg_and_help("--summary-backend=perf must be given"
+					   " with -c/--summary-only");
+		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)
+		    || count_io || slowest_count || ts_nz(&min_duration)
+		    || tracing_paths || stack_trace_enabled
+		    || seccomp_filtering || seccomp_notify)
+			error_msg_and_help("--summary-backend=perf cannot be used"
+					   " with -z, -Z, -e status, --summary-io,"
+					   " --slowest, --min-duration, -P, -k,"
+					   " --seccomp-bpf, or --seccomp-notify");
+		for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+			if (inject_vec[p])
+				error_msg_and_help("--summary-backend=perf cannot be"
+						   " used with -e inject"
+						   " or -e fault");
+		}
+		perf_summary_init();
+	}
+
 	if (columns_set && !cflag) {
 		error_msg_and_help("-U/--summary-columns must be given with"
 				   " (-c/--summary-only or -C/--summary)");
@@ -2317,11 +3264,11 @@ init(int argc, char *argv[])
 			  " (-c/--summary-only or -C/--summary)");
 	}
 
-	if (cflag == CFLAG_ONLY_STATS) {
+	if (cflag == CFLAG_ONLY_STATS && !slowest_count) {
 		if (iflag)
 			error_msg("-i/--instruction-pointer has no effect "
 				  "with -c/--summary-only");
-		if (stack_trace_enabled)
+		if (stack_trace_enabled && !stack_summary)
 			error_msg("-k/--stack-traces has no effect "
 				  "with -c/--summary-only");
 		if (rflag)
@@ -2336,6 +3283,9 @@ init(int argc, char *argv[])
 		if (!number_set_array_is_empty(decode_fd_set, 0))
 			error_msg("-y/--decode-fds has no effect "
 				  "with -c/--summary-only");
+		if (ts_nz(&min_duration))
+			error_msg("--min-duration has no effect "
+				  "with -c/--summary-only");
 	}
 
 	if (!outfname) {
@@ -2350,6 +3300,16 @@ init(int argc, char *argv[])
 #ifndef HAVE_OPEN_MEMSTREAM
 	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
 		error_msg_and_help("open_memstream is required to use -z, -Z, or -e status");
+	if (slowest_count || ts_nz(&min_duration) || flight_recorder_size
+	    || control_path || timeline_path)
+		error_msg_and_help("open_memstream is required to use --slowest,"
+				   " --min-duration, --flight-recorder,"
+				   " --control, or --timeline");
+#endif
+#if !defined HAVE_FOPENCOOKIE || !defined HAVE_PTHREAD
+	if (output_thread)
+		error_msg_and_help("fopencookie and pthreads are required"
+				   " to use --output-thread");
 #endif
 
 	if (zflags > 1)
@@ -2442,6 +3402,15 @@ init(int argc, char *argv[])
 	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
 		setvbuf(shared_log, NULL, _IOLBF, 0);
 	}
+	if (output_thread)
+		shared_log = output_thread_wrap(shared_log, outfname);
+
+	if (timeline_path) {
+		FILE *fp = strace_fopen(timeline_path);
+
+		timeline_init(output_thread
+			      ? output_thread_wrap(fp, timeline_path) : fp);
+	}
 
 	/*
 	 * argv[0]	-pPID	-oFILE	Default interactive setting
@@ -2462,6 +3431,9 @@ init(int argc, char *argv[])
 	if (!opt_intr)
 		opt_intr = INTR_WHILE_WAIT;
 
+	if (build_profile && !qflag_short && !quiet_set_updated)
+		qflag_short = 2;
+
 	if (qflag_short) {
 		if (quiet_set_updated) {
 			error_msg_and_die("-q and -e quiet/--quiet cannot"
@@ -2500,11 +3472,41 @@ init(int argc, char *argv[])
 		set_sighandler(SIGTERM, interactive ? interrupt : SIG_IGN, NULL);
 	}
 
+	sigemptyset(&request_set);
+	if (flight_recorder_size) {
+		sigaddset(&request_set, SIGUSR2);
+		set_sighandler(SIGUSR2, flight_recorder_sighandler, NULL);
+		request_signals = true;
+	}
+	if (cflag) {
+		sigaddset(&request_set, SIGUSR1);
+		set_sighandler(SIGUSR1, request_sighandler, NULL);
+		request_signals = true;
+	}
+	if (control_path || perf_summary) {
+		sigaddset(&request_set, SIGIO);
+		set_sighandler(SIGIO, io_sighandler, NULL);
+		request_signals = true;
+	}
+	if (control_path)
+		control_open(control_path);
+	clock_gettime(CLOCK_MONOTONIC, &snapshot_ts);
+
+	sigprocmask(SIG_BLOCK, &request_set, NULL);
+
 	sigemptyset(&timer_set);
 	sigaddset(&timer_set, SIGALRM);
 	sigprocmask(SIG_BLOCK, &timer_set, NULL);
 	set_sighandler(SIGALRM, timer_sighandler, NULL);
 
+	if (cgroup_path) {
+		sigemptyset(&cgroup_wait_set);
+		sigaddset(&cgroup_wait_set, SIGCHLD);
+		sigprocmask(SIG_BLOCK, &cgroup_wait_set, NULL);
+		cgroup_open(cgroup_path);
+		cgroup_scan(add_cgroup_member);
+	}
+
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
 
@@ -2520,23 +3522,13 @@ init(int argc, char *argv[])
 static struct tcb *
 pid2tcb(const int pid)
 {
-	if (pid <= 0)
+	if (pid <= 0 || !pid_hash)
 		return NULL;
 
-#define PID2TCB_CACHE_SIZE 1024U
-#define PID2TCB_CACHE_MASK (PID2TCB_CACHE_SIZE - 1)
-
-	static struct tcb *pid2tcb_cache[PID2TCB_CACHE_SIZE];
-	struct tcb **const ptcp = &pid2tcb_cache[pid & PID2TCB_CACHE_MASK];
-	struct tcb *tcp = *ptcp;
-
-	if (tcp && tcp->pid == pid)
-		return tcp;
-
-	for (unsigned int i = 0; i < tcbtabsize; ++i) {
-		tcp = tcbtab[i];
+	for (struct tcb *tcp = *pid_hash_bucket(pid); tcp;
+	     tcp = tcp->pid_hash_next) {
 		if (tcp->pid == pid)
-			return *ptcp = tcp;
+			return tcp;
 	}
 
 	return NULL;
@@ -2551,6 +3543,8 @@ cleanup(int fatal_sig)
 	if (!fatal_sig)
 		fatal_sig = SIGTERM;
 
+	reset_event_ts();
+
 	for (i = 0; i < tcbtabsize; i++) {
 		tcp = tcbtab[i];
 		if (!tcp->pid)
@@ -2560,8 +3554,9 @@ cleanup(int fatal_sig)
 			kill(tcp->pid, SIGCONT);
 			kill(tcp->pid, fatal_sig);
 		}
-		detach(tcp);
 	}
+
+	detach_all();
 }
 
 static void
@@ -2570,6 +3565,101 @@ interrupt(int sig)
 	interrupted = sig;
 }
 
+static void
+flight_recorder_sighandler(int sig)
+{
+	flight_recorder_requested = 1;
+}
+
+static bool
+requests_pending(void)
+{
+	return flight_recorder_requested || snapshot_requested
+	       || control_requested || perf_read_requested;
+}
+
+static void
+request_sighandler(int sig)
+{
+	snapshot_requested = 1;
+}
+
+/*
+ * SIGIO is sent both by the control socket and by the ring buffers
+ * of --summary-backend=perf, the handler cannot tell them apart.
+ */
+static void
+io_sighandler(int sig)
+{
+	if (control_path)
+		control_requested = 1;
+	if (perf_summary)
+		perf_read_requested = 1;
+}
+
+/*
+ * Print the current state of tracing: the number of tracees, the event rate
+ * since the previous snapshot, the size of the output kept in memory,
+ * and the call summary collected so far.
+ */
+void
+print_snapshot(FILE *fp)
+{
+	struct timespec now, dt;
+	size_t backlog = slowest_output_size() + flight_recorder_output_size();
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&dt, &now, &snapshot_ts);
+
+	const double secs = ts_float(&dt);
+	const uint64_t events = event_count - snapshot_event_count;
+
+	for (size_t i = 0; i < tcbtabsize; ++i) {
+		if (tcbtab[i]->pid)
+			backlog += strace_staged_output_size(tcbtab[i]);
+	}
+
+	fprintf(fp, "strace: %u tracee%s, %" PRIu64 " event%s"
+		" (%.0f per second) since the previous snapshot"
+		", %zu bytes of output pending\n",
+		nprocs, nprocs == 1 ? "" : "s",
+		events, events == 1 ? "" : "s",
+		secs > 0 ? events / secs : 0.0, backlog);
+
+	if (perf_summary)
+		perf_summary_read();
+	if (cflag)
+		call_summary(fp);
+	if (count_io)
+		io_call_summary(fp);
+	fflush(fp);
+
+	snapshot_ts = now;
+	snapshot_event_count = event_count;
+}
+
+/*
+ * Print the snapshot requested by SIGUSR1.  When the trace goes to stderr
+ * as well, the snapshot is written to the same stream after the line
+ * being printed is ended, like the output of another tracee would be.
+ */
+static void
+print_requested_snapshot(void)
+{
+	if (outfname) {
+		print_snapshot(stderr);
+		return;
+	}
+
+	if (printing_tcp && printing_tcp->curcol != 0 &&
+	    !printing_tcp->staged_output_data) {
+		set_current_tcp(printing_tcp);
+		tprints(" <unfinished ...>\n");
+		line_ended();
+	}
+	print_snapshot(shared_log);
+}
+
 static void
 print_debug_info(const int pid, int status)
 {
@@ -2706,11 +3796,13 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	/* And their column positions */
 	execve_thread->curcol = tcp->curcol;
 	tcp->curcol = 0;
+	if (process_tree_format)
+		process_tree_switch(execve_thread, tcp);
 	/* Drop leader, but close execve'd thread outfile (if -ff) */
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
-	tcp->pid = pid;
+	set_tcb_pid(tcp, pid);
 	if (cflag != CFLAG_ONLY_STATS) {
 		if (!is_number_in_set(QUIET_THREAD_EXECVE, quiet_set)) {
 			printleader(tcp);
@@ -2722,7 +3814,7 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 		 * Need to reopen memstream for thread
 		 * as we closed it in droptcb.
 		 */
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
+		if (syscall_output_staged())
 			strace_open_memstream(tcp);
 		tcp->flags |= TCB_REPRINT;
 	}
@@ -2749,6 +3841,9 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
+	if (flight_recorder_size)
+		flight_recorder_dump("fatal signal");
+
 	if (cflag != CFLAG_ONLY_STATS
 	    && is_number_in_set(WTERMSIG(status), signal_set)) {
 		printleader(tcp);
@@ -2767,6 +3862,9 @@ print_exited(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
+	if (flight_recorder_size && WEXITSTATUS(status))
+		flight_recorder_dump("non-zero exit status");
+
 	if (cflag != CFLAG_ONLY_STATS &&
 	    !is_number_in_set(QUIET_EXIT, quiet_set)) {
 		printleader(tcp);
@@ -2791,7 +3889,7 @@ print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 		line_ended();
 
 #ifdef ENABLE_STACKTRACE
-		if (stack_trace_enabled)
+		if (stack_trace_enabled && !stack_summary)
 			unwind_tcb_print(tcp);
 #endif
 	}
@@ -2803,6 +3901,7 @@ startup_tcb(struct tcb *tcp)
 	debug_msg("pid %d has TCB_STARTUP, initializing it", tcp->pid);
 
 	tcp->flags &= ~TCB_STARTUP;
+	attach_stop_end(tcp, true);
 
 	if (!use_seize) {
 		debug_msg("setting opts 0x%x on pid %d",
@@ -2854,9 +3953,9 @@ print_event_exit(struct tcb *tcp)
 	tprints(") ");
 	tabto();
 	tprints("= ?\n");
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+	if (tcp->staged_output_data) {
 		bool publish = is_number_in_set(STATUS_UNFINISHED, status_set);
-		strace_close_memstream(tcp, publish);
+		strace_finish_staged_output(tcp, publish, NULL);
 	}
 	line_ended();
 }
@@ -2909,6 +4008,31 @@ next_event(void)
 	if (interrupted)
 		return NULL;
 
+	reset_event_ts();
+
+	if (flight_recorder_requested) {
+		flight_recorder_requested = 0;
+		flight_recorder_dump("SIGUSR2");
+	}
+
+	if (snapshot_requested) {
+		snapshot_requested = 0;
+		print_requested_snapshot();
+	}
+
+	if (control_requested) {
+		control_requested = 0;
+		control_process();
+	}
+
+	if (perf_read_requested) {
+		perf_read_requested = 0;
+		perf_summary_read();
+	}
+
+	if (cgroup_path && cgroup_scan_due())
+		attach_cgroup();
+
 	invalidate_umove_cache();
 
 	struct tcb *tcp = NULL;
@@ -2948,7 +4072,7 @@ next_event(void)
 		 * but that loses the ability to wait for its completion
 		 * on exit. Oh well...
 		 */
-		if (nprocs == 0)
+		if (nprocs == 0 && !cgroup_path)
 			return NULL;
 	}
 
@@ -2974,9 +4098,30 @@ next_event(void)
 	 */
 	int status;
 	struct rusage ru;
-	int pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
+	int pid;
+
+	/*
+	 * A request signal that has arrived before the unblocking
+	 * is handled now, the wait is reported as interrupted for it.
+	 */
+	if (request_signals)
+		sigprocmask(SIG_UNBLOCK, &request_set, NULL);
+
+	if (request_signals && requests_pending()) {
+		pid = -1;
+		errno = EINTR;
+	} else {
+		pid = cgroup_path
+		      ? cgroup_wait4(&status,
+				     (cflag || process_tree_format) ? &ru : NULL)
+		      : wait4(-1, &status, __WALL,
+			      (cflag || process_tree_format) ? &ru : NULL);
+	}
 	int wait_errno = errno;
 
+	if (request_signals)
+		sigprocmask(SIG_BLOCK, &request_set, NULL);
+
 	/*
 	 * The window of opportunity to handle expirations
 	 * of the delay timer closes here.
@@ -3050,6 +4195,10 @@ next_event(void)
 		init_trace_wait_data(wd);
 		wd->status = status;
 
+		if (process_tree_format &&
+		    (WIFSIGNALED(status) || WIFEXITED(status)))
+			process_tree_exit(tcp, status, &ru);
+
 		if (WIFSIGNALED(status)) {
 			wd->te = TE_SIGNALLED;
 		} else if (WIFEXITED(status)) {
@@ -3131,6 +4280,16 @@ next_event(void)
 			case PTRACE_EVENT_SECCOMP:
 				wd->te = TE_SECCOMP;
 				break;
+			case PTRACE_EVENT_CLONE:
+			case PTRACE_EVENT_FORK:
+			case PTRACE_EVENT_VFORK:
+				if ((process_tree_format || seccomp_filtering) &&
+				    ptrace(PTRACE_GETEVENTMSG, pid, NULL,
+					   &wd->msg) == 0) {
+					wd->te = TE_STOP_AFTER_CLONE;
+					break;
+				}
+				ATTRIBUTE_FALLTHROUGH;
 			default:
 				wd->te = TE_RESTART;
 			}
@@ -3156,7 +4315,8 @@ next_event(void)
 			break;
 
 next_event_wait_next:
-		pid = wait4(-1, &status, __WALL | WNOHANG, (cflag ? &ru : NULL));
+		pid = wait4(-1, &status, __WALL | WNOHANG,
+			    (cflag || process_tree_format) ? &ru : NULL);
 		wait_errno = errno;
 		wait_nohang = true;
 	}
@@ -3176,6 +4336,8 @@ next_event_get_tcp:
 	}
 
 next_event_exit:
+	event_count++;
+
 	/* Is this the very first time we see this tracee stopped? */
 	if (tcp->flags & TCB_STARTUP)
 		startup_tcb(tcp);
@@ -3225,7 +4387,11 @@ dispatch_event(const struct tcb_wait_data *wd)
 	 */
 	int status = wd ? wd->status : 0;
 
-	if (current_tcp && has_seccomp_filter(current_tcp))
+	reset_event_ts();
+
+	if (perf_summary)
+		restart_op = PTRACE_CONT;
+	else if (current_tcp && has_seccomp_filter(current_tcp))
 		restart_op = seccomp_filter_restart_operator(current_tcp);
 	else
 		restart_op = PTRACE_SYSCALL;
@@ -3240,6 +4406,32 @@ dispatch_event(const struct tcb_wait_data *wd)
 	case TE_RESTART:
 		break;
 
+	case TE_STOP_AFTER_CLONE: {
+		struct tcb *child_tcp = pid2tcb(wd->msg);
+
+		/*
+		 * The seccomp filter is inherited by the child, so there is
+		 * no need to wait for its first seccomp-stop to stop tracing
+		 * all of its syscalls.
+		 */
+		if (has_seccomp_filter(current_tcp)) {
+			/*
+			 * status is the event stop of the parent, the child
+			 * is going to report its initial SIGSTOP.
+			 */
+			if (!child_tcp)
+				child_tcp = maybe_allocate_tcb(wd->msg,
+							W_STOPCODE(SIGSTOP));
+			if (child_tcp)
+				child_tcp->flags |= TCB_SECCOMP_FILTER;
+		}
+
+		if (process_tree_format)
+			process_tree_clone(current_tcp, child_tcp, wd->msg,
+					   (status >> 16) == PTRACE_EVENT_CLONE);
+		break;
+	}
+
 	case TE_SECCOMP:
 		if (!has_seccomp_filter(current_tcp)) {
 			/*
@@ -3353,9 +4545,11 @@ dispatch_event(const struct tcb_wait_data *wd)
 		 * not the case, we might have a situation when we attach to a
 		 * process and the first thing we see is a PTRACE_EVENT_EXEC
 		 * and all the following syscall state tracking is screwed up
-		 * otherwise.
+		 * otherwise.  With --summary-backend=perf there are no syscall
+		 * stops to track.
 		 */
-		if (!maybe_switch_current_tcp() && entering(current_tcp)) {
+		if (!maybe_switch_current_tcp() && entering(current_tcp) &&
+		    !perf_summary) {
 			int ret;
 
 			error_msg("Stray PTRACE_EVENT_EXEC from pid %d"
@@ -3372,6 +4566,13 @@ dispatch_event(const struct tcb_wait_data *wd)
 			}
 		}
 
+		/* The old /proc/pid/mem refers to the old address space.  */
+		close_proc_mem(current_tcp);
+		if (process_tree_format)
+			process_tree_exec(current_tcp);
+		if (timeline_file)
+			timeline_exec(current_tcp);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -3491,17 +4692,114 @@ timer_sighandler(int sig)
 	errno = saved_errno;
 }
 
+static struct tcb *
+seccomp_notify_tcb(const int pid)
+{
+	struct tcb *tcp = pid2tcb(pid);
+
+	if (tcp && (tcp->flags & TCB_RECHECK_PID)) {
+		if (get_proc_tgid(pid) == tcp->tgid) {
+			tcp->flags &= ~TCB_RECHECK_PID;
+		} else {
+			droptcb(tcp);
+			tcp = NULL;
+		}
+	}
+
+	if (!tcp) {
+		tcp = alloctcb(pid);
+		after_successful_attach(tcp, 0);
+		tcp->tgid = get_proc_tgid(pid);
+	}
+
+	return tcp;
+}
+
+/*
+ * Drop the tcbs of a thread group that has exited, or mark them
+ * for a check of their pids after an execve.
+ */
+static void
+seccomp_notify_forget_group(const int tgid, const bool exited)
+{
+	for (unsigned int i = 0; i < tcbtabsize; ++i) {
+		struct tcb *const tcp = tcbtab[i];
+
+		if (!tcp->pid || tcp->tgid != tgid)
+			continue;
+		if (exited)
+			droptcb(tcp);
+		else
+			tcp->flags |= TCB_RECHECK_PID;
+	}
+}
+
+/*
+ * The main loop of --seccomp-notify: the syscalls are received until
+ * every task under the filter has gone, then strace_child is reaped
+ * for its exit status.
+ */
+static void
+seccomp_notify_loop(void)
+{
+	while (!interrupted) {
+		reset_event_ts();
+		if (!seccomp_notify_next(seccomp_notify_fd, seccomp_notify_tcb,
+					 droptcb, seccomp_notify_forget_group))
+			break;
+	}
+
+	if (interrupted)
+		kill(strace_child, interrupted);
+
+	/* There is nothing to detach from.  */
+	for (unsigned int i = 0; i < tcbtabsize; ++i)
+		droptcb(tcbtab[i]);
+
+	int status;
+
+	while (waitpid(strace_child, &status, 0) < 0) {
+		if (errno != EINTR)
+			perror_msg_and_die("waitpid");
+	}
+	if (WIFSIGNALED(status))
+		exit_code = 0x100 | WTERMSIG(status);
+	else
+		exit_code = WEXITSTATUS(status);
+
+	close(seccomp_notify_fd);
+}
+
 static void ATTRIBUTE_NORETURN
 terminate(void)
 {
 	int sig = interrupted;
 
 	cleanup(sig);
+	if (control_path)
+		control_close();
+	if (cgroup_path)
+		cgroup_close();
+	if (perf_summary)
+		perf_summary_finish();
 	if (cflag)
 		call_summary(shared_log);
+	if (cflag && attach_count)
+		attach_summary(shared_log);
+	if (count_io)
+		io_call_summary(shared_log);
+	if (slowest_count)
+		slowest_summary(shared_log);
+#ifdef ENABLE_STACKTRACE
+	if (stack_summary)
+		unwind_summary_print(shared_log);
+#endif
+	process_tree_print(shared_log);
+	timeline_close();
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
+	output_thread_stop();
 	if (popen_pid) {
 		while (waitpid(popen_pid, NULL, 0) < 0 && errno == EINTR)
 			;
@@ -3540,9 +4838,12 @@ main(int argc, char *argv[])
 	setlocale(LC_ALL, "");
 	init(argc, argv);
 
-	exit_code = !nprocs;
+	exit_code = !nprocs && !cgroup_path;
 
-	while (dispatch_event(next_event()))
-		;
+	if (seccomp_notify)
+		seccomp_notify_loop();
+	else
+		while (dispatch_event(next_event()))
+			;
 	terminate();
 }
@@ -452,6 +452,7 @@ print_err_ret(kernel_ulong_t ret, unsigned long u_error)
 }
 
 static long get_regs(struct tcb *);
+static void set_sysent(struct tcb *);
 static int get_syscall_args(struct tcb *);
 static int get_syscall_result(struct tcb *);
 static void get_error(struct tcb *, bool);
@@ -577,22 +578,9 @@ tamper_with_syscall_exiting(struct tcb *tcp)
  * other: error; call syscall_entering_finish(tcp, res), where res is the value
  *    returned.
  */
-int
-syscall_entering_decode(struct tcb *tcp)
+static void
+decode_subcall(struct tcb *tcp)
 {
-	int res = get_scno(tcp);
-	if (res == 0)
-		return res;
-	if (res != 1 || (res = get_syscall_args(tcp)) != 1) {
-		printleader(tcp);
-		tprintf("%s(", tcp_sysent(tcp)->sys_name);
-		/*
-		 * " <unavailable>" will be added later by the code which
-		 * detects ptrace errors.
-		 */
-		return res;
-	}
-
 #ifdef SYS_syscall_subcall
 	if (tcp_sysent(tcp)->sen == SEN_syscall)
 		decode_syscall_subcall(tcp);
@@ -612,13 +600,87 @@ syscall_entering_decode(struct tcb *tcp)
 # endif
 	}
 #endif
+}
+
+int
+syscall_entering_decode(struct tcb *tcp)
+{
+	int res = get_scno(tcp);
+	if (res == 0)
+		return res;
+	if (res != 1 || (res = get_syscall_args(tcp)) != 1) {
+		printleader(tcp);
+		tprintf("%s(", tcp_sysent(tcp)->sys_name);
+		/*
+		 * " <unavailable>" will be added later by the code which
+		 * detects ptrace errors.
+		 */
+		return res;
+	}
+
+	decode_subcall(tcp);
 
 	return 1;
 }
 
+#ifdef HAVE_LINUX_SECCOMP_H
+/*
+ * The counterpart of trace_syscall() for --seccomp-notify: the syscall number
+ * and arguments come from a seccomp user notification instead of the
+ * registers of a tracee stopped by ptrace, and the syscall is seen only
+ * on entering, so the arguments that are decoded on exiting are printed
+ * as "...".
+ */
+void
+syscall_trace_seccomp_notify(struct tcb *tcp, const unsigned int personality,
+			     const kernel_ulong_t scno, const uint64_t args[6])
+{
+# if SUPPORTED_PERSONALITIES > 1
+	update_personality(tcp, personality);
+# endif
+	tcp->scno = shuffle_scno(scno);
+	set_sysent(tcp);
+
+	const unsigned int n = MIN(ARRAY_SIZE(tcp->u_arg), 6);
+
+	for (unsigned int i = 0; i < n; ++i)
+		tcp->u_arg[i] = args[i];
+# if SUPPORTED_PERSONALITIES > 1
+	if (tcp_sysent(tcp)->sys_flags & COMPAT_SYSCALL_TYPES) {
+		for (unsigned int i = 0; i < n; ++i)
+			tcp->u_arg[i] = (uint32_t) tcp->u_arg[i];
+	}
+# endif
+
+	decode_subcall(tcp);
+
+	unsigned int sig = 0;
+	const int res = syscall_entering_trace(tcp, &sig);
+
+	if (!filtered(tcp)) {
+		tprints((res & RVAL_DECODED) ? ")\n" : "...)\n");
+		line_ended();
+	}
+
+	free_tcb_priv_data(tcp);
+}
+#endif
+
 int
 syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 {
+	if (process_tree_format) {
+		switch (tcp_sysent(tcp)->sen) {
+			case SEN_execve:
+			case SEN_execv:
+				process_tree_execve(tcp, tcp->u_arg[1]);
+				break;
+			case SEN_execveat:
+				process_tree_execve(tcp, tcp->u_arg[2]);
+				break;
+		}
+	}
+
 	if (hide_log(tcp)) {
 		/*
 		 * Restrain from fault injection
@@ -642,7 +704,9 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 		}
 	}
 
-	if (hide_log(tcp) || !traced(tcp) || (tracing_paths && !pathtrace_match(tcp))) {
+	if (hide_log(tcp) || !traced(tcp)
+	    || (tracing_paths && !pathtrace_match(tcp))
+	    || (arg_preds_vec[current_personality] && !arg_preds_match(tcp))) {
 		tcp->flags |= TCB_FILTERED;
 		return 0;
 	}
@@ -652,7 +716,7 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
-	if (cflag == CFLAG_ONLY_STATS) {
+	if (cflag == CFLAG_ONLY_STATS && !slowest_count && !stack_summary) {
 		return 0;
 	}
 
@@ -664,7 +728,11 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	}
 #endif
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
+	/* Stacks are reported on exit instead of printed syscalls.  */
+	if (stack_summary)
+		return 0;
+
+	if (syscall_output_staged())
 		strace_open_memstream(tcp);
 
 	printleader(tcp);
@@ -674,15 +742,22 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	return res;
 }
 
+/* Whether syscall entering and exiting times are needed. */
+static bool
+syscall_timing_needed(void)
+{
+	return Tflag || cflag || slowest_count || ts_nz(&min_duration)
+	       || timeline_file || stack_summary == STACK_SUMMARY_TIME;
+}
+
 void
 syscall_entering_finish(struct tcb *tcp, int res)
 {
 	tcp->flags |= TCB_INSYSCALL;
 	tcp->sys_func_rval = res;
 
-	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
-		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
+	if (syscall_timing_needed() && !filtered(tcp))
+		tcp->etime = *get_event_ts();
 
 	/* Start tracking system time */
 	if (cflag) {
@@ -713,9 +788,8 @@ syscall_entering_finish(struct tcb *tcp, int res)
 int
 syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
-	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
-		clock_gettime(CLOCK_MONOTONIC, pts);
+	if (syscall_timing_needed() && !filtered(tcp))
+		*pts = *get_event_ts();
 
 	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
 		mmap_notify_report(tcp);
@@ -763,11 +837,21 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 
 	if (cflag) {
 		count_syscall(tcp, ts);
-		if (cflag == CFLAG_ONLY_STATS) {
+		if (count_io)
+			count_io_syscall(tcp, ts);
+		if (cflag == CFLAG_ONLY_STATS && !slowest_count
+		    && !stack_summary) {
 			return 0;
 		}
 	}
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_summary) {
+		unwind_tcb_summarize(tcp, ts);
+		return 0;
+	}
+#endif
+
 	print_syscall_resume(tcp);
 	printing_tcp = tcp;
 
@@ -777,10 +861,10 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		tprints(") ");
 		tabto();
 		tprints("= ? <unavailable>\n");
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (tcp->staged_output_data) {
 			bool publish = is_number_in_set(STATUS_UNAVAILABLE,
 							status_set);
-			strace_close_memstream(tcp, publish);
+			strace_finish_staged_output(tcp, publish, ts);
 		}
 		line_ended();
 		return res;
@@ -797,14 +881,21 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			sys_res = tcp_sysent(tcp)->sys_func(tcp);
 	}
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+	/*
+	 * The status qualifier may have been changed at runtime
+	 * after this syscall has been entered without staging.
+	 */
+	if (tcp->staged_output_data
+	    && !is_complete_set(status_set, NUMBER_OF_STATUSES)) {
 		bool publish = syserror(tcp)
 			       && is_number_in_set(STATUS_FAILED, status_set);
 		publish |= !syserror(tcp)
 			   && is_number_in_set(STATUS_SUCCESSFUL, status_set);
-		strace_close_memstream(tcp, publish);
 		if (!publish) {
+			strace_close_memstream(tcp, false);
 			line_ended();
+			if (flight_recorder_size && flight_recorder_is_trigger(tcp))
+				flight_recorder_dump("syscall error");
 			return 0;
 		}
 	}
@@ -938,11 +1029,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			tprints(" (INJECTED)");
 	}
 	if (Tflag) {
-		ts_sub(ts, ts, &tcp->etime);
-		tprintf(" <%ld", (long) ts->tv_sec);
+		struct timespec dt;
+
+		ts_sub(&dt, ts, &tcp->etime);
+		tprintf(" <%ld", (long) dt.tv_sec);
 		if (Tflag_width) {
 			tprintf(".%0*ld",
-				Tflag_width, (long) ts->tv_nsec / Tflag_scale);
+				Tflag_width, (long) dt.tv_nsec / Tflag_scale);
 		}
 		tprints(">");
 	}
@@ -954,6 +1047,13 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	if (stack_trace_enabled)
 		unwind_tcb_print(tcp);
 #endif
+
+	if (tcp->staged_output_data)
+		strace_finish_staged_output(tcp, true, ts);
+
+	if (flight_recorder_size && flight_recorder_is_trigger(tcp))
+		flight_recorder_dump("syscall error");
+
 	return 0;
 }
 
@@ -1314,6 +1414,30 @@ const struct_sysent stub_sysent = {
 	.sys_name = "????",
 };
 
+/* Set the sysent and the qualifier flags of the syscall tcp->scno.  */
+static void
+set_sysent(struct tcb *tcp)
+{
+	if (scno_is_valid(tcp->scno)) {
+		tcp->s_ent = &sysent[tcp->scno];
+		tcp->qual_flg = qual_flags(tcp->scno);
+	} else {
+		struct sysent_buf *s = xzalloc(sizeof(*s));
+
+		s->tcp = tcp;
+		s->ent = stub_sysent;
+		s->ent.sys_name = s->buf;
+		xsprintf(s->buf, "syscall_%#" PRI_klx, shuffle_scno(tcp->scno));
+
+		tcp->s_ent = &s->ent;
+
+		set_tcb_priv_data(tcp, s, free_sysent_buf);
+
+		debug_msg("pid %d invalid syscall %#" PRI_klx,
+			  tcp->pid, shuffle_scno(tcp->scno));
+	}
+}
+
 /*
  * Returns:
  * 0: "ignore this ptrace stop", syscall_entering_decode() should return a "bail
@@ -1345,25 +1469,7 @@ get_scno(struct tcb *tcp)
 	}
 
 	tcp->scno = shuffle_scno(tcp->scno);
-
-	if (scno_is_valid(tcp->scno)) {
-		tcp->s_ent = &sysent[tcp->scno];
-		tcp->qual_flg = qual_flags(tcp->scno);
-	} else {
-		struct sysent_buf *s = xzalloc(sizeof(*s));
-
-		s->tcp = tcp;
-		s->ent = stub_sysent;
-		s->ent.sys_name = s->buf;
-		xsprintf(s->buf, "syscall_%#" PRI_klx, shuffle_scno(tcp->scno));
-
-		tcp->s_ent = &s->ent;
-
-		set_tcb_priv_data(tcp, s, free_sysent_buf);
-
-		debug_msg("pid %d invalid syscall %#" PRI_klx,
-			  tcp->pid, shuffle_scno(tcp->scno));
-	}
+	set_sysent(tcp);
 
 	/*
 	 * We refrain from argument decoding during recovering
@@ -0,0 +1,46 @@
+/*
+ * A process with many threads for attach and detach tests.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void *
+thread(void *arg)
+{
+	for (;;)
+		pause();
+
+	return NULL;
+}
+
+int
+main(int ac, char **av)
+{
+	const unsigned int n = ac > 1 ? atoi(av[1]) : 64;
+
+	for (unsigned int i = 0; i < n; ++i) {
+		pthread_t t;
+
+		errno = pthread_create(&t, NULL, thread, NULL);
+		if (errno)
+			perror_msg_and_fail("pthread_create");
+	}
+
+	printf("%u\n", n + 1);
+	fflush(stdout);
+
+	for (;;)
+		pause();
+
+	return 0;
+}
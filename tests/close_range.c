@@ -0,0 +1,79 @@
+/*
+ * Check decoding of close_range syscall.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#ifdef __NR_close_range
+
+# include <fcntl.h>
+# include <stdio.h>
+# include <unistd.h>
+
+static const char *errstr;
+
+static long
+k_close_range(const unsigned int first, const unsigned int last,
+	      const unsigned int flags)
+{
+	const kernel_ulong_t fill = (kernel_ulong_t) 0xdefaced00000000ULL;
+	const kernel_ulong_t bad = (kernel_ulong_t) 0xbadc0dedbadc0dedULL;
+	const kernel_ulong_t arg1 = fill | first;
+	const kernel_ulong_t arg2 = fill | last;
+	const kernel_ulong_t arg3 = fill | flags;
+	const long rc = syscall(__NR_close_range,
+				arg1, arg2, arg3, bad, bad, bad);
+	errstr = sprintrc(rc);
+	return rc;
+}
+
+int
+main(void)
+{
+	skip_if_unavailable("/proc/self/fd/");
+
+	static const char path[] = "/dev/full";
+	int fd = open(path, O_WRONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", path);
+
+	static const struct {
+		unsigned int val;
+		const char *str;
+	} flags[] = {
+		{ ARG_STR(0) },
+		{ 2, "CLOSE_RANGE_UNSHARE" },
+		{ 1, "0x1 /* CLOSE_RANGE_??? */" },
+		{ 0xfffffffd, "0xfffffffd /* CLOSE_RANGE_??? */" },
+		{ -1, "CLOSE_RANGE_UNSHARE|0xfffffffd" }
+	};
+
+	/* The ranges are empty, no descriptors are closed.  */
+	for (unsigned int i = 0; i < ARRAY_SIZE(flags); ++i) {
+		k_close_range(-1, fd, flags[i].val);
+		printf("close_range(-1, %d<%s>, %s) = %s\n",
+		       fd, path, flags[i].str, errstr);
+
+		k_close_range(-1, -2, flags[i].val);
+		printf("close_range(-1, -2, %s) = %s\n",
+		       flags[i].str, errstr);
+	}
+
+	k_close_range(-1, -1, 0);
+	printf("close_range(-1, -1, 0) = %s\n", errstr);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_close_range")
+
+#endif
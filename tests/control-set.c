@@ -0,0 +1,144 @@
+/*
+ * This file is part of control-set strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int fd;
+static int pid;	/* printed with -f */
+
+/* Send a request, check that the reply starts with the expected prefix.  */
+static void
+request(const char *req, const char *reply)
+{
+	char buf[1024];
+	size_t len = 0;
+
+	if (write(fd, req, strlen(req)) != (ssize_t) strlen(req))
+		perror_msg_and_fail("write");
+
+	do {
+		if (len >= sizeof(buf) - 1)
+			error_msg_and_fail("reply is too long");
+
+		const ssize_t rc = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (rc <= 0)
+			perror_msg_and_fail("read");
+		len += rc;
+		buf[len] = '\0';
+	} while (buf[len - 1] != '\n');
+
+	if (strncmp(buf, reply, strlen(reply)))
+		error_msg_and_fail("%s: unexpected reply: %s", req, buf);
+}
+
+static void
+chdir_missing(const char *path, const bool print)
+{
+	if (chdir(path) != -1 || errno != ENOENT)
+		perror_msg_and_fail("chdir");
+	if (!print)
+		return;
+	if (pid)
+		printf("%-5d ", pid);
+	printf("chdir(\"%s\") = -1 ENOENT (%m)\n", path);
+}
+
+static void
+fchdir_bad(const bool print)
+{
+	if (fchdir(-1) != -1 || errno != EBADF)
+		perror_msg_and_fail("fchdir");
+	if (!print)
+		return;
+	if (pid)
+		printf("%-5d ", pid);
+	printf("fchdir(-1) = -1 EBADF (%m)\n");
+}
+
+int
+main(int ac, char **av)
+{
+	if (ac < 2)
+		error_msg_and_fail("missing operand");
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(av[1]) >= sizeof(addr.sun_path))
+		error_msg_and_skip("%s: path is too long", av[1]);
+	strcpy(addr.sun_path, av[1]);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		perror_msg_and_skip("socket");
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_fail("connect: %s", av[1]);
+
+	const bool seccomp = ac > 2 && !strcmp(av[2], "seccomp");
+	const bool seccomp_preds = ac > 2 && !strcmp(av[2], "seccomp-preds");
+	if (seccomp || seccomp_preds)
+		pid = getpid();
+
+	/* Started with -e trace=fchdir:fd=-1.  */
+	if (seccomp_preds) {
+		fchdir_bad(true);
+		request("set trace=fchdir\n",
+			"error: the arguments of syscall fchdir are checked");
+		request("set trace=none\n", "ok\n");
+		fchdir_bad(false);
+		return 0;
+	}
+
+	/* Started with -e trace=chdir.  */
+	chdir_missing("control-set.a", true);
+
+	if (seccomp) {
+		request("set trace=chdir,getpid\n",
+			"error: syscall getpid does not stop the tracees");
+		request("set trace=none\n", "ok\n");
+		chdir_missing("control-set.b", false);
+		request("set trace=chdir\n", "ok\n");
+		chdir_missing("control-set.c", true);
+		return 0;
+	}
+
+	request("set trace=getpid\n", "ok\n");
+	chdir_missing("control-set.b", false);
+	printf("getpid() = %d\n", getpid());
+
+	request("set trace=control-set.bogus\n",
+		"error: invalid system call 'control-set.bogus'\n");
+	request("set signal=none\n",
+		"error: cannot change 'signal=none' at runtime\n");
+	request("add trace=chdir\n", "error: cannot add 'trace=chdir'\n");
+
+	request("set status=failed\n", "ok\n");
+	request("set trace=chdir,getpid\n", "ok\n");
+	if (chdir("."))
+		perror_msg_and_fail("chdir");
+	chdir_missing("control-set.c", true);
+	getpid();
+
+	request("set path=control-set.e\n", "ok\n");
+	chdir_missing("control-set.d", false);
+	chdir_missing("control-set.e", true);
+	request("add path=control-set.f\n", "ok\n");
+	chdir_missing("control-set.f", true);
+	request("set path=\n", "ok\n");
+	chdir_missing("control-set.g", true);
+
+	request("set trace=none\n", "ok\n");
+	chdir_missing("control-set.h", false);
+
+	return 0;
+}
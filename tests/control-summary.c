@@ -0,0 +1,64 @@
+/*
+ * This file is part of control-summary strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static char buf[65536];
+
+/* Send a request and read the reply up to the given terminator.  */
+static void
+request(const int fd, const char *req, const char *end)
+{
+	size_t len = 0;
+
+	if (write(fd, req, strlen(req)) != (ssize_t) strlen(req))
+		perror_msg_and_fail("write");
+
+	do {
+		if (len >= sizeof(buf) - 1)
+			error_msg_and_fail("reply is too long");
+
+		const ssize_t rc = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (rc <= 0)
+			perror_msg_and_fail("read");
+		len += rc;
+		buf[len] = '\0';
+	} while (len < strlen(end) || strcmp(buf + len - strlen(end), end));
+
+	fputs(buf, stdout);
+}
+
+int
+main(int ac, char **av)
+{
+	if (ac < 2)
+		error_msg_and_fail("missing operand");
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(av[1]) >= sizeof(addr.sun_path))
+		error_msg_and_skip("%s: path is too long", av[1]);
+	strcpy(addr.sun_path, av[1]);
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		perror_msg_and_skip("socket");
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)))
+		perror_msg_and_fail("connect: %s", av[1]);
+
+	request(fd, "bogus\n", "\n");
+	request(fd, "summary\n", "total\n");
+
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * This file is part of count-errnos strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	static const char missing[] = "count-errnos.missing";
+
+	for (unsigned int i = 0; i < 3; ++i)
+		assert(chdir(missing) == -1 && errno == ENOENT);
+
+	assert(chdir("/dev/null") == -1 && errno == ENOTDIR);
+	assert(chdir(".") == 0);
+
+	return 0;
+}
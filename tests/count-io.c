@@ -0,0 +1,71 @@
+/*
+ * This file is part of count-io strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define N 16
+#define SZ 1024
+
+static char buf[SZ];
+
+static void *
+thread(void *arg)
+{
+	/* The same fd of the same process, accounted for in the same row.  */
+	assert(write(*(int *) arg, buf, 10) == 10);
+
+	return NULL;
+}
+
+int
+main(void)
+{
+	int fds[2];
+
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+
+	for (unsigned int i = 0; i < N; ++i) {
+		assert(write(fds[1], buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+		assert(read(fds[0], buf, sizeof(buf)) == (ssize_t) sizeof(buf));
+	}
+
+	assert(close(fds[1]) == 0);
+	assert(read(fds[0], buf, sizeof(buf)) == 0);
+	assert(close(fds[0]) == 0);
+
+	int fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/null");
+	assert(write(fd, buf, 42) == 42);
+	assert(write(-1, buf, 1) == -1);
+
+	pthread_t t;
+	errno = pthread_create(&t, NULL, thread, &fd);
+	if (errno)
+		perror_msg_and_fail("pthread_create");
+	errno = pthread_join(t, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_join");
+
+	/* A transfer between two fds is counted once in the total.  */
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	assert(write(fds[1], buf, 100) == 100);
+	assert(splice(fds[0], NULL, fd, NULL, 100, 0) == 100);
+
+	assert(close(fd) == 0);
+
+	return 0;
+}
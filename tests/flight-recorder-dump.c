@@ -0,0 +1,46 @@
+/*
+ * This file is part of flight-recorder-dump strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+chdir_missing(void)
+{
+	if (chdir("flight-recorder.missing") != -1 || errno != ENOENT)
+		perror_msg_and_fail("chdir");
+}
+
+int
+main(int argc, char **argv)
+{
+	for (unsigned int i = 0; i < 5; ++i)
+		chdir_missing();
+
+	/* Request a dump from strace, which is the parent.  */
+	if (argc > 1 && !strcmp(argv[1], "usr2")) {
+		if (kill(getppid(), SIGUSR2))
+			perror_msg_and_fail("kill");
+		for (unsigned int i = 0; i < 5; ++i)
+			chdir_missing();
+		return 0;
+	}
+
+	if (chdir("/dev/null") != -1 || errno != ENOTDIR)
+		perror_msg_and_fail("chdir");
+
+	for (unsigned int i = 0; i < 5; ++i)
+		chdir_missing();
+
+	return argc > 1 ? atoi(argv[1]) : 0;
+}
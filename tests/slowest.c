@@ -0,0 +1,47 @@
+/*
+ * This file is part of slowest strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#ifdef __NR_nanosleep
+
+# include <stdint.h>
+# include <unistd.h>
+
+# include "kernel_old_timespec.h"
+
+static void
+k_nanosleep(const long msec)
+{
+	const kernel_old_timespec_t ts = {
+		.tv_sec = 0,
+		.tv_nsec = msec * 1000000
+	};
+
+	if (syscall(__NR_nanosleep, (uintptr_t) &ts, 0))
+		perror_msg_and_fail("nanosleep");
+}
+
+int
+main(void)
+{
+	static const long msecs[] = { 100, 1, 300, 1, 200, 1 };
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(msecs); ++i)
+		k_nanosleep(msecs[i]);
+
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_nanosleep")
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * This file is part of summary-snapshot strace test.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <signal.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	/* Request a snapshot from strace, which is the parent.  */
+	if (kill(getppid(), SIGUSR1))
+		perror_msg_and_fail("kill");
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Check -e trace=SET:PREDICATE qualifiers.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * All the syscalls are printed, the test picks the ones that are expected
+ * to be traced with the qualifier it checks.
+ */
+static void
+do_lseek(const int fd, const long offset,
+	 const int whence, const char *const whence_str)
+{
+	const long rc = syscall(__NR_lseek, fd, offset, whence);
+
+	printf("lseek(%d, %ld, %s) = %s\n",
+	       fd, offset, whence_str, sprintrc(rc));
+}
+
+int
+main(void)
+{
+	for (int fd = 200; fd < 204; ++fd) {
+		const long rc = close(fd);
+
+		printf("close(%d) = %s\n", fd, sprintrc(rc));
+	}
+
+	do_lseek(-1, 0, SEEK_SET, "SEEK_SET");
+	do_lseek(-1, 0, SEEK_CUR, "SEEK_CUR");
+	do_lseek(-1, 0, SEEK_END, "SEEK_END");
+	do_lseek(-2, 0, SEEK_END, "SEEK_END");
+
+	/*
+	 * Offsets that differ from each other only in the upper half
+	 * of a 64-bit kernel long.
+	 */
+	do_lseek(-3, -1, SEEK_SET, "SEEK_SET");
+#if SIZEOF_LONG > 4
+	do_lseek(-3, 0xffffffff, SEEK_SET, "SEEK_SET");
+	do_lseek(-3, 0x100000000, SEEK_SET, "SEEK_SET");
+	do_lseek(-3, -0x100000001, SEEK_SET, "SEEK_SET");
+#endif
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Check the performance of decoding values that are looked up
+ * in large xlat tables and in the ioctl table.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+static volatile bool stop = false;
+
+static void
+handler(int signo)
+{
+	stop = true;
+}
+
+int
+main(void)
+{
+	unsigned int i;
+
+	signal(SIGALRM, handler);
+	alarm(1);
+
+	for (i = 0; !stop; i++) {
+		/* Both known and unknown ioctl codes of various types.  */
+		const unsigned int code =
+			_IOC(i & 3, 'A' + (i >> 2) % 58, (i >> 4) & 0xff,
+			     (i & 1) ? 4 : 8);
+
+		ioctl(-1, code, 0);
+		fcntl(-1, i & 0x7ff);
+		setsockopt(-1, SOL_SOCKET, i & 0xff, NULL, 0);
+	}
+	printf("%d\n", i);
+	return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Check decoding of the values of xlat tables large enough to be indexed:
+ * every value of the table and the values next to it are decoded
+ * the same way as by the linear search of printxval and printflags.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include "scno.h"
+
+#if defined __NR_madvise && defined __NR_inotify_add_watch
+
+# include <stdio.h>
+# include <unistd.h>
+# include <arpa/inet.h>
+# include <sys/socket.h>
+
+# include "xlat.h"
+# include "xlat/ethernet_protocols.h"
+# include "xlat/inet_protocols.h"
+# include "xlat/inotify_flags.h"
+# include "xlat/madvise_cmds.h"
+# include "xlat/sock_options.h"
+
+/*
+ * An unknown socket type flag, so that the sockets are not created
+ * and no protocol modules are requested.
+ */
+# define BOGUS_SOCK_FLAG 0x100
+
+static void
+check_madvise(const unsigned int advice)
+{
+	long rc = syscall(__NR_madvise, 0, 0, (kernel_ulong_t) advice);
+	printf("madvise(NULL, 0, ");
+	printxval(madvise_cmds, advice, "MADV_???");
+	printf(") = %s\n", sprintrc(rc));
+}
+
+static void
+check_inet_protocol(const unsigned int proto)
+{
+	int rc = socket(AF_INET, SOCK_DGRAM | BOGUS_SOCK_FLAG, proto);
+	printf("socket(AF_INET, SOCK_DGRAM|%#x /* SOCK_??? */, ",
+	       BOGUS_SOCK_FLAG);
+	printxval(inet_protocols, proto, "IPPROTO_???");
+	printf(") = %s\n", sprintrc(rc));
+}
+
+static void
+check_ethernet_protocol(const unsigned short proto)
+{
+	int rc = socket(AF_PACKET, SOCK_DGRAM | BOGUS_SOCK_FLAG, htons(proto));
+	printf("socket(AF_PACKET, SOCK_DGRAM|%#x /* SOCK_??? */, htons(",
+	       BOGUS_SOCK_FLAG);
+	printxval(ethernet_protocols, proto, "ETH_P_???");
+	printf(")) = %s\n", sprintrc(rc));
+}
+
+static void
+check_sock_option(const unsigned int name)
+{
+	int rc = setsockopt(-1, SOL_SOCKET, name, NULL, 0);
+	printf("setsockopt(-1, SOL_SOCKET, ");
+	/* SO_ATTACH_FILTER is in setsock_options.  */
+	if (name == SO_ATTACH_FILTER)
+		printf("SO_ATTACH_FILTER");
+	else
+		printxval(sock_options, name, "SO_???");
+	printf(", NULL, 0) = %s\n", sprintrc(rc));
+}
+
+static void
+check_inotify_mask(const unsigned int mask)
+{
+	long rc = syscall(__NR_inotify_add_watch, -1, NULL, mask);
+	printf("inotify_add_watch(-1, NULL, ");
+	printflags(inotify_flags, mask, "IN_???");
+	printf(") = %s\n", sprintrc(rc));
+}
+
+int
+main(void)
+{
+	for (size_t i = 0; i < madvise_cmds->size; ++i) {
+		const unsigned int val = madvise_cmds->data[i].val;
+
+		check_madvise(val - 1);
+		check_madvise(val);
+		check_madvise(val + 1);
+	}
+
+	for (size_t i = 0; i < inet_protocols->size; ++i) {
+		const unsigned int val = inet_protocols->data[i].val;
+
+		check_inet_protocol(val - 1);
+		check_inet_protocol(val);
+		check_inet_protocol(val + 1);
+	}
+
+	for (size_t i = 0; i < ethernet_protocols->size; ++i) {
+		const unsigned short val = ethernet_protocols->data[i].val;
+
+		check_ethernet_protocol(val - 1);
+		check_ethernet_protocol(val);
+		check_ethernet_protocol(val + 1);
+	}
+
+	for (size_t i = 0; i < sock_options->size; ++i) {
+		const unsigned int val = sock_options->data[i].val;
+
+		check_sock_option(val - 1);
+		check_sock_option(val);
+		check_sock_option(val + 1);
+	}
+
+	/*
+	 * Every flag alone, with the unknown bits, with the flags next to it,
+	 * and all the flags at once.
+	 */
+	unsigned int all = 0;
+
+	for (size_t i = 0; i < inotify_flags->size; ++i) {
+		const unsigned int val = inotify_flags->data[i].val;
+
+		check_inotify_mask(val);
+		check_inotify_mask(val | 0x8ff1000);
+		check_inotify_mask(val | (val << 1) | (val >> 1));
+		all |= val;
+	}
+
+	check_inotify_mask(all);
+	check_inotify_mask(~all);
+	check_inotify_mask(-1U);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_madvise && __NR_inotify_add_watch");
+
+#endif
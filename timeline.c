@@ -0,0 +1,271 @@
+/*
+ * Timeline (--timeline option): every syscall is written as soon as it is
+ * finished to a file in the trace event format of the Chrome and Perfetto
+ * trace viewers, as a complete event on the track of its thread nested
+ * in a span that covers the lifetime of the thread.
+ *
+ * Copyright (c) 2020 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include "largefile_wrappers.h"
+#include "xstring.h"
+
+/* The longest decoded syscall text kept in the arguments of an event.  */
+#define TIMELINE_TEXT_MAX	256
+
+struct timeline_thread {
+	struct timespec start;
+	int tgid;
+	int tid;		/* the pid the lifetime span is started for */
+	char name[64];		/* as in the Name: line of /proc/PID/status */
+};
+
+FILE *timeline_file;
+
+static struct timespec timeline_start;
+static bool timeline_empty = true;
+
+void
+timeline_init(FILE *fp)
+{
+	timeline_file = fp;
+	clock_gettime(CLOCK_MONOTONIC, &timeline_start);
+	fputc('[', fp);
+}
+
+/* Start a new event, the caller prints its fields and the closing brace.  */
+static void
+begin_event(const char *ph, const int pid)
+{
+	fprintf(timeline_file, "%s\n{\"ph\": \"%s\", \"pid\": %d",
+		timeline_empty ? "" : ",", ph, pid);
+	timeline_empty = false;
+}
+
+/* Print a time or a duration in microseconds.  */
+static void
+print_us(const char *field, const struct timespec *ts)
+{
+	fprintf(timeline_file, ", \"%s\": %lld.%03u", field,
+		(long long) ts->tv_sec * 1000000 + ts->tv_nsec / 1000,
+		(unsigned int) (ts->tv_nsec % 1000));
+}
+
+static void
+print_ts(const struct timespec *ts)
+{
+	struct timespec rel;
+
+	ts_sub(&rel, ts, &timeline_start);
+	print_us("ts", &rel);
+}
+
+static void
+read_status(struct timeline_thread *t, const int pid)
+{
+	char path[sizeof("/proc/%d/status") + sizeof(int) * 3];
+	char buf[512];
+
+	t->tgid = pid;
+	xsprintf(path, "/proc/%d/status", pid);
+
+	const int fd = open_file(path, O_RDONLY);
+
+	if (fd < 0)
+		return;
+
+	const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+
+	close(fd);
+	if (len <= 0)
+		return;
+	buf[len] = '\0';
+
+	if (!strncmp(buf, "Name:\t", sizeof("Name:\t") - 1)) {
+		const char *const name = buf + sizeof("Name:\t") - 1;
+		const size_t name_len = MIN(strcspn(name, "\n"),
+					    sizeof(t->name) - 1);
+
+		memcpy(t->name, name, name_len);
+		t->name[name_len] = '\0';
+	}
+
+	const char *const tgid = strstr(buf, "\nTgid:");
+
+	if (tgid)
+		t->tgid = atoi(tgid + sizeof("\nTgid:") - 1);
+}
+
+static void
+print_names(const struct timeline_thread *t)
+{
+	const size_t len = strlen(t->name);
+
+	if (t->tgid == t->tid) {
+		begin_event("M", t->tgid);
+		fputs(", \"name\": \"process_name\", \"args\": {\"name\": ",
+		      timeline_file);
+		fprint_json_string(timeline_file, t->name, len);
+		fputs("}}", timeline_file);
+	}
+
+	begin_event("M", t->tgid);
+	fprintf(timeline_file, ", \"tid\": %d, \"name\": \"thread_name\""
+		", \"args\": {\"name\": ", t->tid);
+	fprint_json_string(timeline_file, t->name, len);
+	fputs("}}", timeline_file);
+}
+
+static void
+start_thread(struct timeline_thread *t, const int pid)
+{
+	t->start = *get_event_ts();
+	t->tid = pid;
+	read_status(t, pid);
+	print_names(t);
+}
+
+/* Print the span covering the lifetime of the thread.  */
+static void
+end_thread(const struct timeline_thread *t)
+{
+	struct timespec dur;
+
+	ts_sub(&dur, get_event_ts(), &t->start);
+
+	begin_event("X", t->tgid);
+	fprintf(timeline_file, ", \"tid\": %d, \"cat\": \"thread\""
+		", \"name\": ", t->tid);
+	fprint_json_string(timeline_file, t->name, strlen(t->name));
+	print_ts(&t->start);
+	print_us("dur", &dur);
+	fputc('}', timeline_file);
+}
+
+/* Called when the tracee has been attached.  */
+void
+timeline_attach(struct tcb *tcp)
+{
+	if (!tcp->timeline)
+		tcp->timeline = xzalloc(sizeof(*tcp->timeline));
+	start_thread(tcp->timeline, tcp->pid);
+}
+
+/*
+ * Called on PTRACE_EVENT_EXEC: the name changes, and so does the pid
+ * if the execve has been called by a thread other than the leader.
+ */
+void
+timeline_exec(struct tcb *tcp)
+{
+	struct timeline_thread *const t = tcp->timeline;
+
+	if (!t)
+		return;
+
+	if (t->tid != tcp->pid) {
+		end_thread(t);
+		start_thread(t, tcp->pid);
+	} else {
+		read_status(t, tcp->pid);
+		print_names(t);
+	}
+}
+
+/*
+ * Print the categories of the syscall: "syscall" followed by its classes
+ * as they are named in -e trace=%class.
+ */
+static void
+print_categories(const struct_sysent *s)
+{
+	static const struct {
+		unsigned int flag;
+		const char *name;
+	} classes[] = {
+		{ TRACE_DESC,		"desc"		},
+		{ TRACE_FILE,		"file"		},
+		{ TRACE_MEMORY,		"memory"	},
+		{ TRACE_PROCESS,	"process"	},
+		{ TRACE_CREDS,		"creds"		},
+		{ TRACE_SIGNAL,		"signal"	},
+		{ TRACE_IPC,		"ipc"		},
+		{ TRACE_NETWORK,	"network"	},
+	};
+
+	fputs(", \"cat\": \"syscall", timeline_file);
+	for (unsigned int i = 0; i < ARRAY_SIZE(classes); ++i) {
+		if (s->sys_flags & classes[i].flag)
+			fprintf(timeline_file, ",%s", classes[i].name);
+	}
+	fputc('"', timeline_file);
+}
+
+/*
+ * Called for every syscall that is published, output is its decoded text
+ * staged since the syscall entering, duration is the time it took.
+ */
+void
+timeline_syscall(struct tcb *tcp, const struct timespec *duration,
+		 const char *output)
+{
+	const struct timeline_thread *const t = tcp->timeline;
+
+	if (!t)
+		return;
+
+	const char *const name = tcp_sysent(tcp)->sys_name;
+	const char *text = strstr(output, name);
+
+	if (!text)
+		text = output;
+
+	/* Only the first line, abbreviated to TIMELINE_TEXT_MAX bytes.  */
+	char call[TIMELINE_TEXT_MAX + sizeof("...")];
+	size_t len = strcspn(text, "\n");
+
+	if (len > TIMELINE_TEXT_MAX) {
+		memcpy(call, text, TIMELINE_TEXT_MAX);
+		memcpy(call + TIMELINE_TEXT_MAX, "...", 3);
+		len = TIMELINE_TEXT_MAX + 3;
+		text = call;
+	}
+
+	begin_event("X", t->tgid);
+	fprintf(timeline_file, ", \"tid\": %d", tcp->pid);
+	print_categories(tcp_sysent(tcp));
+	fprintf(timeline_file, ", \"name\": \"%s\"", name);
+	print_ts(&tcp->etime);
+	print_us("dur", duration);
+	fputs(", \"args\": {\"call\": ", timeline_file);
+	fprint_json_string(timeline_file, text, len);
+	fputs("}}", timeline_file);
+}
+
+/* Called when the tcb is dropped.  */
+void
+timeline_detach(struct tcb *tcp)
+{
+	if (!tcp->timeline)
+		return;
+
+	end_thread(tcp->timeline);
+	free(tcp->timeline);
+	tcp->timeline = NULL;
+}
+
+void
+timeline_close(void)
+{
+	if (!timeline_file)
+		return;
+
+	fputs("\n]\n", timeline_file);
+	fclose(timeline_file);
+	timeline_file = NULL;
+}
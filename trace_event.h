@@ -67,6 +67,12 @@ enum trace_event {
 	 */
 	TE_STOP_BEFORE_EXIT,
 
+	/*
+	 * Tracee has created a new task, its pid is in wd->msg.
+	 * Restart the tracee with signal 0.
+	 */
+	TE_STOP_AFTER_CLONE,
+
 	/*
 	 * SECCOMP_RET_TRACE rule is triggered.
 	 */
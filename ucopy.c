@@ -6,17 +6,20 @@
  * Copyright (c) 1999 IBM Deutschland Entwicklung GmbH, IBM Corporation
  *                     Linux for s390 port by D.J. Barrow
  *                    <barrow_dj@mail.yahoo.com,djbarrow@de.ibm.com>
- * Copyright (c) 1999-2019 The strace developers.
+ * Copyright (c) 1999-2020 The strace developers.
  * All rights reserved.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <sys/uio.h>
 
+#include "filter_seccomp.h"
 #include "scno.h"
 #include "ptrace.h"
+#include "xstring.h"
 
 static bool process_vm_readv_not_supported;
 
@@ -40,26 +43,108 @@ static ssize_t strace_process_vm_readv(pid_t pid,
 # define process_vm_readv strace_process_vm_readv
 #endif /* !HAVE_PROCESS_VM_READV */
 
+/*
+ * Read the memory of the tracee with pread64 from its /proc/pid/mem,
+ * which is opened once and kept in tcp->mem_fd, -1 if it is not opened yet.
+ * Fail with EPERM if the file cannot be used.
+ */
 static ssize_t
-process_read_mem(const pid_t pid, void *const laddr,
+proc_mem_read(struct tcb *const tcp, void *const laddr,
+	      const unsigned long raddr, const size_t len)
+{
+	if (tcp->flags & TCB_PROC_MEM_DENIED) {
+		errno = EPERM;
+		return -1;
+	}
+
+	if (tcp->mem_fd < 0) {
+		char path[sizeof("/proc/%u/mem") + sizeof(int) * 3];
+
+		xsprintf(path, "/proc/%u/mem", tcp->pid);
+		tcp->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+
+	if (tcp->mem_fd >= 0) {
+		const ssize_t rc = pread64(tcp->mem_fd, laddr, len, raddr);
+
+		if (rc >= 0 || (errno != EPERM && errno != EACCES))
+			return rc;
+
+		close(tcp->mem_fd);
+		tcp->mem_fd = -1;
+	}
+
+	tcp->flags |= TCB_PROC_MEM_DENIED;
+	errno = EPERM;
+	return -1;
+}
+
+void
+close_proc_mem(struct tcb *const tcp)
+{
+	if (tcp->mem_fd >= 0) {
+		close(tcp->mem_fd);
+		tcp->mem_fd = -1;
+	}
+	tcp->flags &= ~TCB_PROC_MEM_DENIED;
+}
+
+/*
+ * Read the memory of the tracee with process_vm_readv, or from its
+ * /proc/pid/mem if process_vm_readv is not permitted or not supported.
+ */
+static ssize_t
+process_read_mem_unchecked(struct tcb *const tcp, void *const laddr,
+			   void *const raddr, const size_t len)
+{
+	/* The file is opened only after process_vm_readv has failed.  */
+	if (tcp->mem_fd < 0 && !process_vm_readv_not_supported) {
+		const struct iovec local = {
+			.iov_base = laddr,
+			.iov_len = len
+		};
+		const struct iovec remote = {
+			.iov_base = raddr,
+			.iov_len = len
+		};
+
+		const ssize_t rc = process_vm_readv(tcp->pid, &local, 1,
+						    &remote, 1, 0);
+		if (rc >= 0 || (errno != ENOSYS && errno != EPERM))
+			return rc;
+		if (errno == ENOSYS)
+			process_vm_readv_not_supported = true;
+	}
+
+	return proc_mem_read(tcp, laddr, (unsigned long) raddr, len);
+}
+
+static ssize_t
+process_read_mem(struct tcb *const tcp, void *const laddr,
 		 void *const raddr, const size_t len)
 {
-	const struct iovec local = {
-		.iov_base = laddr,
-		.iov_len = len
-	};
-	const struct iovec remote = {
-		.iov_base = raddr,
-		.iov_len = len
-	};
-
-	const ssize_t rc = process_vm_readv(pid, &local, 1, &remote, 1, 0);
-	if (rc < 0 && errno == ENOSYS)
-		process_vm_readv_not_supported = true;
+	const ssize_t rc = process_read_mem_unchecked(tcp, laddr, raddr, len);
+
+	/*
+	 * With --seccomp-notify, the task may have been killed
+	 * and its pid reused before the memory was read.
+	 */
+	if (rc >= 0 && seccomp_notify && !seccomp_notify_id_valid()) {
+		errno = ESRCH;
+		return -1;
+	}
 
 	return rc;
 }
 
+/* Whether PTRACE_PEEKDATA is the only way left to read the memory.  */
+static bool
+peekdata_only(const struct tcb *const tcp)
+{
+	return process_vm_readv_not_supported
+	       && (tcp->flags & TCB_PROC_MEM_DENIED);
+}
+
 static int cached_idx = -1;
 static unsigned long cached_raddr[2];
 
@@ -70,7 +155,7 @@ invalidate_umove_cache(void)
 }
 
 static ssize_t
-vm_read_mem(const pid_t pid, void *const laddr,
+vm_read_mem(struct tcb *const tcp, void *const laddr,
 	    const kernel_ulong_t raddr, const size_t len)
 {
 	if (!len)
@@ -95,7 +180,7 @@ vm_read_mem(const pid_t pid, void *const laddr,
 	if (!raddr_page_start ||
 	    raddr_page_next < raddr_page_start ||
 	    raddr_page_next - raddr_page_start != page_size)
-		return process_read_mem(pid, laddr, (void *) taddr, len);
+		return process_read_mem(tcp, laddr, (void *) taddr, len);
 
 	int idx = -1;
 	if (cached_idx >= 0) {
@@ -114,7 +199,7 @@ vm_read_mem(const pid_t pid, void *const laddr,
 			buf[idx] = xmalloc(page_size);
 
 		const ssize_t rc =
-			process_read_mem(pid, buf[idx],
+			process_read_mem(tcp, buf[idx],
 					 (void *) raddr_page_start, page_size);
 		if (rc < 0)
 			return rc;
@@ -204,10 +289,10 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 
 	const int pid = tcp->pid;
 
-	if (process_vm_readv_not_supported)
+	if (peekdata_only(tcp))
 		return umoven_peekdata(pid, addr, len, our_addr);
 
-	int r = vm_read_mem(pid, our_addr, addr, len);
+	int r = vm_read_mem(tcp, our_addr, addr, len);
 	if ((unsigned int) r == len)
 		return 0;
 	if (r >= 0) {
@@ -311,7 +396,7 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 
 	const int pid = tcp->pid;
 
-	if (process_vm_readv_not_supported)
+	if (peekdata_only(tcp))
 		return umovestr_peekdata(pid, addr, len, laddr);
 
 	const size_t page_size = get_pagesize();
@@ -329,7 +414,7 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 		if (chunk_len > end_in_page) /* crosses to the next page */
 			chunk_len -= end_in_page;
 
-		int r = vm_read_mem(pid, laddr, addr, chunk_len);
+		int r = vm_read_mem(tcp, laddr, addr, chunk_len);
 		if (r > 0) {
 			char *nul_addr = memchr(laddr, '\0', r);
 
@@ -27,9 +27,11 @@ struct call_t {
 struct unwind_queue_t {
 	struct call_t *tail;
 	struct call_t *head;
+	char *folded;	/* frames captured for --stack-summary */
 };
 
 static void queue_print(struct unwind_queue_t *queue);
+static char *fold_stack(struct tcb *tcp);
 
 static const char asprintf_error_str[] = "???";
 
@@ -49,6 +51,7 @@ unwind_tcb_init(struct tcb *tcp)
 	tcp->unwind_queue = xmalloc(sizeof(*tcp->unwind_queue));
 	tcp->unwind_queue->head = NULL;
 	tcp->unwind_queue->tail = NULL;
+	tcp->unwind_queue->folded = NULL;
 
 	tcp->unwind_ctx = unwinder.tcb_init(tcp);
 }
@@ -60,6 +63,7 @@ unwind_tcb_fin(struct tcb *tcp)
 		return;
 
 	queue_print(tcp->unwind_queue);
+	free(tcp->unwind_queue->folded);
 	free(tcp->unwind_queue);
 	tcp->unwind_queue = NULL;
 
@@ -290,7 +294,10 @@ unwind_tcb_capture(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head)
+	if (stack_summary) {
+		free(tcp->unwind_queue->folded);
+		tcp->unwind_queue->folded = fold_stack(tcp);
+	} else if (tcp->unwind_queue->head)
 		error_msg_and_die("bug: unprinted entries in queue");
 	else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
@@ -299,3 +306,218 @@ unwind_tcb_capture(struct tcb *tcp)
 				  tcp->unwind_queue);
 	}
 }
+
+/*
+ * Folded stack summary (--stack-summary option): the stacks of syscalls
+ * are aggregated along with the syscall name and printed on exit
+ * in the "frame;frame;...;syscall weight" format of flamegraph.pl.
+ */
+struct folded_stack {
+	char *stack;
+	uint64_t weight;
+};
+
+static struct folded_stack *folded_tab;
+static size_t folded_size;	/* a power of 2 */
+static size_t folded_used;
+
+struct fold_walk {
+	char **frames;		/* innermost first */
+	size_t nframes;
+	size_t size;
+	size_t len;		/* total length of the frames */
+};
+
+static void
+fold_walk_add(struct fold_walk *w, char *frame)
+{
+	if (w->nframes >= w->size)
+		w->frames = xgrowarray(w->frames, &w->size,
+				       sizeof(*w->frames));
+	w->frames[w->nframes++] = frame;
+	w->len += strlen(frame) + 1;
+}
+
+static void
+fold_call_cb(void *data,
+	     const char *binary_filename,
+	     const char *symbol_name,
+	     unwind_function_offset_t function_offset,
+	     unsigned long true_offset)
+{
+	char *frame;
+
+	if (symbol_name && symbol_name[0] != '\0') {
+#ifdef USE_DEMANGLE
+		char *demangled_name =
+			cplus_demangle(symbol_name, DMGL_AUTO | DMGL_PARAMS);
+
+		frame = demangled_name ? demangled_name
+				       : xstrdup(symbol_name);
+#else
+		frame = xstrdup(symbol_name);
+#endif
+	} else if (binary_filename) {
+		const char *base = strrchr(binary_filename, '/');
+
+		frame = xasprintf("[%s]", base ? base + 1 : binary_filename);
+	} else {
+		frame = xstrdup("[unknown]");
+	}
+
+	/* ';' separates frames and the weight follows the last space.  */
+	for (char *p = frame; *p; ++p) {
+		if (*p == ';')
+			*p = ':';
+	}
+
+	fold_walk_add(data, frame);
+}
+
+static void
+fold_error_cb(void *data, const char *error, unsigned long true_offset)
+{
+	fold_walk_add(data, xstrdup("[unknown]"));
+}
+
+/* Walk the stack of tcp and return its frames outermost first.  */
+static char *
+fold_stack(struct tcb *tcp)
+{
+	struct fold_walk w = { NULL };
+
+	unwinder.tcb_walk(tcp, fold_call_cb, fold_error_cb, &w);
+
+	char *const stack = xmalloc(w.len + 1);
+	char *p = stack;
+
+	*p = '\0';
+	for (size_t i = w.nframes; i > 0; --i) {
+		p = stpcpy(p, w.frames[i - 1]);
+		*p++ = ';';
+		free(w.frames[i - 1]);
+	}
+	*p = '\0';
+	free(w.frames);
+
+	return stack;
+}
+
+static size_t
+folded_hash(const char *str)
+{
+	/* FNV-1a */
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *str; ++str) {
+		h ^= (unsigned char) *str;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static struct folded_stack *
+folded_lookup(const char *stack)
+{
+	size_t i = folded_hash(stack) & (folded_size - 1);
+
+	while (folded_tab[i].stack && strcmp(folded_tab[i].stack, stack))
+		i = (i + 1) & (folded_size - 1);
+
+	return &folded_tab[i];
+}
+
+static void
+folded_add(char *stack, const uint64_t weight)
+{
+	if ((folded_used + 1) * 4 > folded_size * 3) {
+		struct folded_stack *const old = folded_tab;
+		const size_t old_size = folded_size;
+
+		folded_size = folded_size ? folded_size * 2 : 256;
+		folded_tab = xcalloc(folded_size, sizeof(*folded_tab));
+		for (size_t i = 0; i < old_size; ++i) {
+			if (old[i].stack)
+				*folded_lookup(old[i].stack) = old[i];
+		}
+		free(old);
+	}
+
+	struct folded_stack *const e = folded_lookup(stack);
+
+	if (e->stack) {
+		free(stack);
+	} else {
+		e->stack = stack;
+		folded_used++;
+	}
+	e->weight += weight;
+}
+
+/*
+ * Add the stack of the syscall of tcp that is exiting at ts
+ * to the --stack-summary report.
+ */
+void
+unwind_tcb_summarize(struct tcb *tcp, const struct timespec *ts)
+{
+#if SUPPORTED_PERSONALITIES > 1
+	if (tcp->currpers != DEFAULT_PERSONALITY) {
+		/* disable stack trace */
+		return;
+	}
+#endif
+	char *frames = tcp->unwind_queue->folded;
+
+	tcp->unwind_queue->folded = NULL;
+	if (!frames)
+		frames = fold_stack(tcp);
+
+	char *const stack = xasprintf("%s%s", frames,
+				      tcp_sysent(tcp)->sys_name);
+
+	free(frames);
+
+	uint64_t weight = 1;
+
+	if (stack_summary == STACK_SUMMARY_TIME) {
+		struct timespec dt;
+
+		ts_sub(&dt, ts, &tcp->etime);
+		weight = dt.tv_sec * 1000000ULL + dt.tv_nsec / 1000;
+	}
+
+	folded_add(stack, weight);
+}
+
+static int
+folded_stack_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct folded_stack *) a)->stack,
+		      ((const struct folded_stack *) b)->stack);
+}
+
+void
+unwind_summary_print(FILE *outf)
+{
+	size_t n = 0;
+
+	/* Move the used entries to the beginning to sort them.  */
+	for (size_t i = 0; i < folded_size; ++i) {
+		if (folded_tab[i].stack)
+			folded_tab[n++] = folded_tab[i];
+	}
+	if (n)
+		qsort(folded_tab, n, sizeof(*folded_tab), folded_stack_cmp);
+
+	for (size_t i = 0; i < n; ++i) {
+		fprintf(outf, "%s %" PRIu64 "\n",
+			folded_tab[i].stack, folded_tab[i].weight);
+		free(folded_tab[i].stack);
+	}
+
+	free(folded_tab);
+	folded_tab = NULL;
+	folded_size = folded_used = 0;
+}
@@ -525,6 +525,32 @@ getfdinode(struct tcb *tcp, int fd)
 	return 0;
 }
 
+/* Return the thread group id of pid from /proc/pid/status, or -1.  */
+int
+get_proc_tgid(const int pid)
+{
+	char path[sizeof("/proc/%d/status") + sizeof(int) * 3];
+	char buf[512];
+
+	xsprintf(path, "/proc/%d/status", pid);
+
+	const int fd = open_file(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+
+	const ssize_t len = read(fd, buf, sizeof(buf) - 1);
+
+	close(fd);
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	const char *const tgid = strstr(buf, "\nTgid:");
+
+	return tgid ? atoi(tgid + sizeof("\nTgid:") - 1) : -1;
+}
+
 static bool
 printsocket(struct tcb *tcp, int fd, const char *path)
 {
@@ -856,6 +882,26 @@ print_quoted_cstring(const char *str, unsigned int size)
 	return unterminated;
 }
 
+/*
+ * Print `len' bytes of `str' to `fp' as a JSON string literal.
+ */
+void
+fprint_json_string(FILE *fp, const char *str, const size_t len)
+{
+	fputc('"', fp);
+	for (size_t i = 0; i < len; ++i) {
+		const unsigned char c = str[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < ' ' || c == 0x7f)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
 /*
  * Print path string specified by address `addr' and length `n'.
  * If path length exceeds `n', append `...' to the output.
@@ -58,38 +58,298 @@ xlat_bsearch_compare(const void *a, const void *b)
 	return (val1 > val2) ? 1 : (val1 < val2) ? -1 : 0;
 }
 
-const char *
-xlookup(const struct xlat *xlat, const uint64_t val)
+/*
+ * XT_NORMAL and XT_SORTED tables of at least XLAT_INDEX_MIN_SIZE entries
+ * are looked up using an index built on their first lookup.  The values
+ * come from the system headers and many of them are conditional, so the
+ * index cannot be generated along with the table.
+ */
+#define XLAT_INDEX_MIN_SIZE 16
+
+/*
+ * The index maps a value to the position of its first entry in the table
+ * (plus one, zero means no entry).  Values that fit in a range at most
+ * XLAT_INDEX_DENSITY times as large as the table are indexed directly,
+ * the rest are hashed.
+ */
+#define XLAT_INDEX_DENSITY 4
+
+/*
+ * Flags in tables of at most XLAT_FLAGS_MAX_SIZE entries are decoded
+ * by walking the set bits: each bit maps to the set of positions
+ * of the entries whose lowest bit it is, so only the entries that may
+ * match are tried, in the order of the table.
+ */
+#define XLAT_FLAGS_MAX_SIZE 64
+
+struct xlat_index {
+	const struct xlat *xlat;
+	uint64_t by_bit[64];	/* positions of the entries by lowest bit */
+	uint64_t base;		/* the smallest value for a direct index */
+	uint32_t mask;		/* hash table size - 1, zero for a direct index */
+	uint32_t size;
+	uint16_t slots[];
+};
+
+/* Open addressing hash table of the indices keyed by the table address.  */
+static struct xlat_index **xlat_indices;
+static size_t xlat_indices_size;
+static size_t xlat_indices_used;
+
+static inline unsigned int
+ctz64(const uint64_t val)
 {
-	static const struct xlat *x;
-	static size_t idx;
-	const struct xlat_data *e;
+#ifdef HAVE___BUILTIN_CTZLL
+	return __builtin_ctzll(val);
+#else
+	unsigned int ret = 0;
+
+	for (uint64_t v = val; !(v & 1); v >>= 1)
+		++ret;
+
+	return ret;
+#endif
+}
+
+static inline bool
+xlat_is_indexed(const struct xlat *const x)
+{
+	return x->size >= XLAT_INDEX_MIN_SIZE && x->size < UINT16_MAX;
+}
+
+static inline uint32_t
+xlat_hash(const uint64_t val)
+{
+	/* Fibonacci hashing */
+	return (val * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static struct xlat_index **
+xlat_indices_slot(const struct xlat *x)
+{
+	for (size_t i = xlat_hash((uintptr_t) x) & (xlat_indices_size - 1);;
+	     i = (i + 1) & (xlat_indices_size - 1)) {
+		if (!xlat_indices[i] || xlat_indices[i]->xlat == x)
+			return &xlat_indices[i];
+	}
+}
+
+static void
+xlat_indices_grow(void)
+{
+	struct xlat_index **const old = xlat_indices;
+	const size_t old_size = xlat_indices_size;
+
+	xlat_indices_size = old_size ? old_size * 2 : 64;
+	xlat_indices = xcalloc(xlat_indices_size, sizeof(*xlat_indices));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old[i])
+			*xlat_indices_slot(old[i]->xlat) = old[i];
+	}
+
+	free(old);
+}
+
+static uint32_t
+xlat_index_hash_slot(const struct xlat_index *const xi, const uint64_t val)
+{
+	const struct xlat_data *const data = xi->xlat->data;
+
+	for (uint32_t i = xlat_hash(val) & xi->mask;; i = (i + 1) & xi->mask) {
+		if (!xi->slots[i] || data[xi->slots[i] - 1].val == val)
+			return i;
+	}
+}
+
+static struct xlat_index *
+xlat_index_build(const struct xlat *const x)
+{
+	uint64_t min = UINT64_MAX, max = 0;
+	bool direct = false;
+	uint32_t size = 0;
+
+	if (xlat_is_indexed(x)) {
+		for (size_t i = 0; i < x->size; ++i) {
+			if (x->data[i].val < min)
+				min = x->data[i].val;
+			if (x->data[i].val > max)
+				max = x->data[i].val;
+		}
+
+		direct = max - min < (uint64_t) x->size * XLAT_INDEX_DENSITY;
+
+		if (direct) {
+			size = max - min + 1;
+		} else {
+			/* Round up to a power of 2.  */
+			for (size = x->size * 2; size & (size - 1);)
+				size &= size - 1;
+			size <<= 1;
+		}
+	}
+
+	struct xlat_index *const xi =
+		xzalloc(sizeof(*xi) + size * sizeof(xi->slots[0]));
+
+	xi->xlat = x;
+	xi->base = direct ? min : 0;
+	xi->mask = direct ? 0 : size - 1;
+	xi->size = size;
+
+	for (size_t i = 0; x->size <= XLAT_FLAGS_MAX_SIZE && i < x->size; ++i) {
+		if (x->data[i].val && x->data[i].str)
+			xi->by_bit[ctz64(x->data[i].val)] |= 1ULL << i;
+	}
+
+	for (size_t i = 0; size && i < x->size; ++i) {
+		const uint64_t val = x->data[i].val;
+		uint16_t *const slot =
+			&xi->slots[direct ? val - min
+					  : xlat_index_hash_slot(xi, val)];
+
+		/* The first entry wins, as with the linear search.  */
+		if (!*slot)
+			*slot = i + 1;
+	}
+
+	return xi;
+}
 
-	if (xlat) {
-		x = xlat;
-		idx = 0;
+static const struct xlat_index *
+get_xlat_index(const struct xlat *const x)
+{
+	if (xlat_indices_used * 2 >= xlat_indices_size)
+		xlat_indices_grow();
+
+	struct xlat_index **const slot = xlat_indices_slot(x);
+
+	if (!*slot) {
+		*slot = xlat_index_build(x);
+		xlat_indices_used++;
+	}
+
+	return *slot;
+}
+
+static const char *
+xlat_index_lookup(const struct xlat_index *const xi, const uint64_t val)
+{
+	uint16_t pos;
+
+	if (xi->mask) {
+		pos = xi->slots[xlat_index_hash_slot(xi, val)];
+	} else {
+		if (val - xi->base >= xi->size)
+			return NULL;
+		pos = xi->slots[val - xi->base];
 	}
 
+	return pos ? xi->xlat->data[pos - 1].str : NULL;
+}
+
+/* Iterator over the entries of a table that match flags.  */
+struct xlat_flags_iter {
+	const struct xlat *xlat;
+	uint64_t candidates;	/* positions yet to be tried by a bit walk */
+	size_t pos;		/* next position to be tried by a linear walk */
+	bool bit_walk;
+};
+
+static void
+xlat_flags_iter_init(struct xlat_flags_iter *const it,
+		     const struct xlat *const x, uint64_t flags)
+{
+	it->xlat = x;
+	it->candidates = 0;
+	it->pos = 0;
+	/*
+	 * Zero is left to the linear walk, which matches nothing, as before:
+	 * the callers print the name of the zero entry themselves.
+	 */
+	it->bit_walk = flags && x->size <= XLAT_FLAGS_MAX_SIZE;
+
+	if (!it->bit_walk)
+		return;
+
+	const struct xlat_index *const xi = get_xlat_index(x);
+
+	/* A single flag is just one lookup.  */
+	if (!(flags & (flags - 1))) {
+		it->candidates = xi->by_bit[ctz64(flags)];
+		return;
+	}
+
+	for (; flags; flags &= flags - 1)
+		it->candidates |= xi->by_bit[ctz64(flags)];
+}
+
+/*
+ * Return the next entry with a non-zero value all bits of which are set
+ * in flags, in the order of the table.  The caller is expected to clear
+ * the bits of the returned entry in flags before the next call.
+ */
+static const struct xlat_data *
+xlat_flags_next(struct xlat_flags_iter *const it, const uint64_t flags)
+{
+	const struct xlat_data *const data = it->xlat->data;
+
+	if (it->bit_walk) {
+		while (it->candidates) {
+			const struct xlat_data *const e =
+				&data[ctz64(it->candidates)];
+
+			it->candidates &= it->candidates - 1;
+			if ((flags & e->val) == e->val)
+				return e;
+		}
+
+		return NULL;
+	}
+
+	while (it->pos < it->xlat->size) {
+		const struct xlat_data *const e = &data[it->pos++];
+
+		if (e->val && e->str && (flags & e->val) == e->val)
+			return e;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the string of the first entry with the given value,
+ * or NULL if there is no such entry.
+ */
+const char *
+xlookup(const struct xlat *x, const uint64_t val)
+{
+	const struct xlat_data *e;
+
 	if (!x || !x->data)
 		return NULL;
 
 	switch (x->type) {
 	case XT_NORMAL:
-		for (; idx < x->size; idx++)
+		if (xlat_is_indexed(x))
+			return xlat_index_lookup(get_xlat_index(x), val);
+
+		for (size_t idx = 0; idx < x->size; idx++)
 			if (x->data[idx].val == val)
 				return x->data[idx].str;
 		break;
 
 	case XT_SORTED:
+		if (xlat_is_indexed(x))
+			return xlat_index_lookup(get_xlat_index(x), val);
+
 		e = bsearch((const void *) &val,
-			    x->data + idx,
-			    x->size - idx,
+			    x->data,
+			    x->size,
 			    sizeof(x->data[0]),
 			    xlat_bsearch_compare);
-		if (e) {
-			idx = e - x->data;
+		if (e)
 			return e->str;
-		}
 		break;
 
 	case XT_INDEXED:
@@ -357,20 +617,21 @@ sprintflags_ex(const char *prefix, const struct xlat *xlat, uint64_t flags,
 				    sprint_xlat_val(flags, style));
 	}
 
-	for (size_t idx = 0; flags && idx < xlat->size; idx++) {
-		if (xlat->data[idx].val && xlat->data[idx].str
-		    && (flags & xlat->data[idx].val) == xlat->data[idx].val) {
-			if (sep) {
-				*outptr++ = sep;
-			} else if (xlat_verbose(style) == XLAT_STYLE_VERBOSE) {
-				outptr = stpcpy(outptr, " /* ");
-			}
+	struct xlat_flags_iter it;
+	const struct xlat_data *e;
 
-			outptr = stpcpy(outptr, xlat->data[idx].str);
-			found = 1;
-			sep = '|';
-			flags &= ~xlat->data[idx].val;
+	xlat_flags_iter_init(&it, xlat, flags);
+	while (flags && (e = xlat_flags_next(&it, flags))) {
+		if (sep) {
+			*outptr++ = sep;
+		} else if (xlat_verbose(style) == XLAT_STYLE_VERBOSE) {
+			outptr = stpcpy(outptr, " /* ");
 		}
+
+		outptr = stpcpy(outptr, e->str);
+		found = 1;
+		sep = '|';
+		flags &= ~e->val;
 	}
 
 	if (flags) {
@@ -440,21 +701,26 @@ printflags_ex(uint64_t flags, const char *dflt, enum xlat_style style,
 	}
 
 	va_start(args, xlat);
-	for (; xlat; xlat = va_arg(args, const struct xlat *)) {
-		for (size_t idx = 0; (flags || !n) && idx < xlat->size; ++idx) {
-			uint64_t v = xlat->data[idx].val;
-			if (xlat->data[idx].str
-			    && ((flags == v) || (v && (flags & v) == v))) {
-				if (xlat_verbose(style) == XLAT_STYLE_VERBOSE
-				    && !flags)
+	for (; xlat && (flags || !n); xlat = va_arg(args, const struct xlat *)) {
+		if (!flags) {
+			/* Zero is printed using the first entry only.  */
+			if (xlat->size && xlat->data[0].str
+			    && !xlat->data[0].val) {
+				if (xlat_verbose(style) == XLAT_STYLE_VERBOSE)
 					tprints("0");
-				tprintf("%s%s",
-					(n++ ? "|" : init_sep),
-					xlat->data[idx].str);
-				flags &= ~v;
+				tprintf("%s%s", init_sep, xlat->data[0].str);
+				n++;
 			}
-			if (!flags)
-				break;
+			continue;
+		}
+
+		struct xlat_flags_iter it;
+		const struct xlat_data *e;
+
+		xlat_flags_iter_init(&it, xlat, flags);
+		while (flags && (e = xlat_flags_next(&it, flags))) {
+			tprintf("%s%s", (n++ ? "|" : init_sep), e->str);
+			flags &= ~e->val;
 		}
 	}
 	va_end(args);
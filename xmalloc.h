@@ -13,6 +13,7 @@
 #ifndef STRACE_XMALLOC_H
 # define STRACE_XMALLOC_H
 
+# include <stdarg.h>
 # include <stddef.h>
 # include "gcc_compat.h"
 
@@ -70,4 +71,10 @@ void *xgrowarray(void *ptr, size_t *nmemb, size_t memb_size);
 char *xstrdup(const char *str) ATTRIBUTE_MALLOC;
 char *xstrndup(const char *str, size_t n) ATTRIBUTE_MALLOC;
 
+/** Format a string in allocated memory, die if the allocation has failed. */
+char *xasprintf(const char *fmt, ...)
+	ATTRIBUTE_FORMAT((printf, 1, 2)) ATTRIBUTE_MALLOC;
+char *xvasprintf(const char *fmt, va_list ap)
+	ATTRIBUTE_FORMAT((printf, 1, 0)) ATTRIBUTE_MALLOC;
+
 #endif /* !STRACE_XMALLOC_H */